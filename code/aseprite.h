@@ -184,6 +184,20 @@ typedef struct ASE_CellChunk
 #endif
 } ASE_CellChunk;
 
+// What an ASE_CellChunk looks like when its type is ASE_CellType_Linked: instead of having its
+// own pixels, the cell reuses the ones of the cell on the same layer in frame frame_idx.
+typedef struct ASE_LinkedCellChunk 
+{
+	uint16_t layer_idx;
+	int16_t x;
+	int16_t y;
+	uint8_t opacity;
+	ASE_CellType type;
+	int16_t z_idx;
+	uint8_t reserved0[5];
+	uint16_t frame_idx;
+} ASE_LinkedCellChunk;
+
 typedef uint32_t ASE_CellExtraChunkFlags;
 enum 
 {
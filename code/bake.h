@@ -0,0 +1,137 @@
+/**
+ * Baked asset formats. These are written by the game itself (see LoadSprites and LoadLevel) and 
+ * are meant to be mapped straight into memory, so everything is fixed-size and naturally aligned. 
+ * Each file starts with the XXH3 hash of the source asset it was baked from, which is how stale 
+ * files are detected.
+ */
+
+#define BAKE_CACHE_DIR "build/cache"
+
+#define SPRITE_BAKE_MAGIC 0x4B425053u // "SPBK"
+#define SPRITE_BAKE_VERSION 4u
+#define SPRITE_BAKE_PIXELS_ALIGN 16u
+
+typedef uint32_t SpriteBakeFlags;
+enum
+{
+	SpriteBakeFlags_Flattened = 1u, // every frame has at most one cell (see FlattenSpriteFrames)
+};
+
+/*
+Memory layout:
+	SpriteBakeHeader header;
+	SpriteBakeFrame frames[header.num_frames];
+	SpriteBakeCell cells[header.num_cells]; // sorted with CompareSpriteCells, grouped by frame
+	uint32_t palette[header.num_colors];
+	uint32_t or uint8_t pixels[]; // starts at header.pixels_offset. Cells with the same pixels share them.
+*/
+
+typedef struct SpriteBakeHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t source_hash;
+	ivec2s origin;
+	ivec2s size;
+	uint32_t num_frames;
+	uint32_t num_cells;
+	uint64_t pixels_offset;
+	uint64_t pixels_size;
+	SpriteBakeFlags flags;
+	uint32_t num_colors; // 0 unless the sprite is SpriteFormat_Indexed
+} SpriteBakeHeader;
+static_assert(sizeof(SpriteBakeHeader) == 64);
+
+typedef struct SpriteBakeFrame
+{
+	ivec2s hitbox_min;
+	ivec2s hitbox_max;
+	float dur;
+	uint32_t num_cells;
+} SpriteBakeFrame;
+static_assert(sizeof(SpriteBakeFrame) == 24);
+
+typedef struct SpriteBakeCell
+{
+	ivec2s origin;
+	ivec2s size;
+	int32_t z_idx;
+	uint32_t layer_idx;
+	uint64_t pixels_offset; // relative to SpriteBakeHeader::pixels_offset
+	uint64_t hash; // XXH3 of the pixels
+} SpriteBakeCell;
+static_assert(sizeof(SpriteBakeCell) == 40);
+
+#define LEVEL_BAKE_MAGIC 0x4B42564Cu // "LVBK"
+#define LEVEL_BAKE_VERSION 2u
+
+/*
+Memory layout:
+	LevelBakeHeader header;
+	for each level:
+		Tile tiles[level.num_tiles]; // every tile layer in draw order, dst relative to the world
+		uint8_t collision[level.size.x*level.size.y]; // 0 or 1
+		uint8_t padding[]; // up to a multiple of 16 bytes
+	LevelBakeLevel levels[header.num_levels]; // at header.levels_offset
+	LevelBakeEntity entities[header.num_entities]; // at header.entities_offset, entities[0] is always the player
+
+Each level is a contiguous block of the file, so that streaming it in only ever touches the pages
+it lives in.
+*/
+
+typedef struct LevelBakeHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t source_hash;
+	uint32_t num_levels;
+	uint32_t num_entities;
+	uint64_t levels_offset;
+	uint64_t entities_offset;
+} LevelBakeHeader;
+static_assert(sizeof(LevelBakeHeader) == 40);
+
+typedef struct LevelBakeLevel
+{
+	ivec2s pos; // in pixels, relative to the world
+	ivec2s size; // measured in tiles, not pixels
+	uint64_t offset; // of its tiles, from the start of the file
+	uint32_t num_tiles;
+	uint32_t reserved;
+} LevelBakeLevel;
+static_assert(sizeof(LevelBakeLevel) == 32);
+
+typedef struct LevelBakeEntity
+{
+	ivec2s start_pos; // relative to the world
+	uint32_t type; // EntityType
+	uint32_t reserved;
+} LevelBakeEntity;
+static_assert(sizeof(LevelBakeEntity) == 16);
+
+#define PIPELINE_CACHE_PATH BAKE_CACHE_DIR "/pipelines.cache"
+#define PIPELINE_CACHE_MAGIC 0x4B424350u // "PCBK"
+#define PIPELINE_CACHE_VERSION 1u
+
+/*
+Memory layout:
+	PipelineCacheHeader header;
+	uint8_t data[header.data_size]; // straight out of vkGetPipelineCacheData
+
+Unlike the other bakes, this one is written on exit rather than on load, and is only valid for the 
+GPU and driver that wrote it.
+*/
+
+typedef struct PipelineCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vendor_id;
+	uint32_t device_id;
+	uint32_t driver_version;
+	uint32_t reserved;
+	uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+	uint64_t data_size;
+	uint64_t data_hash; // XXH3 of the data, so that a truncated file gets caught
+} PipelineCacheHeader;
+static_assert(sizeof(PipelineCacheHeader) == 56);
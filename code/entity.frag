@@ -1,13 +1,24 @@
 #version 460
 
 layout (location = 0) in vec2 in_texture_pos;
-layout (location = 1) flat in int in_frame_idx;
+layout (location = 1) flat in int in_atlas_page;
+layout (location = 2) flat in int in_palette;
 
 layout (location = 0) out vec4 out_color;
 
-layout (binding = 0, set = 1) uniform sampler2DArray sprite;
+// Every sprite is packed into one of these two array textures, so an instance picks its pixels with
+// nothing but in_atlas_page and in_palette, and all of the entities go out in one draw without any
+// descriptor indexing.
+layout (binding = 0, set = 1) uniform sampler2DArray atlas;
+layout (binding = 1, set = 1) uniform usampler2DArray indexed_atlas;
+layout (binding = 2, set = 1) uniform sampler2D palettes;
 
 void main() {
-    vec3 pos = vec3(in_texture_pos, float(abs(in_frame_idx)-1));
-    out_color = texture(sprite, vec3(pos.x*float(sign(in_frame_idx)), pos.y, pos.z));
-}
\ No newline at end of file
+    if (in_palette < 0) {
+        vec2 atlas_size = vec2(textureSize(atlas, 0).xy);
+        out_color = texture(atlas, vec3(in_texture_pos / atlas_size, float(in_atlas_page)));
+    } else {
+        uint idx = texelFetch(indexed_atlas, ivec3(ivec2(floor(in_texture_pos)), in_atlas_page), 0).r;
+        out_color = texelFetch(palettes, ivec2(int(idx), in_palette), 0);
+    }
+}
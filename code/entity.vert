@@ -1,27 +1,40 @@
 #version 460
 
 layout (location = 0) in ivec4 in_rect;
-layout (location = 1) in int in_frame_idx;
+layout (location = 1) in ivec4 in_src;
+layout (location = 2) in int in_atlas_page;
+layout (location = 3) in int in_palette;
 
 layout (location = 0) out vec2 out_texture_pos;
-layout (location = 1) flat out int out_frame_idx;
+layout (location = 1) flat out int out_atlas_page;
+layout (location = 2) flat out int out_palette;
 
 layout (binding = 0, set = 0) uniform Uniforms {
     ivec2 viewport_size;
-    ivec2 tileset_size;
+    ivec2 tileset_pos;
+    int tileset_page;
+    int tileset_palette;
     int tile_size;
 } uniforms;
 
+layout (push_constant) uniform PushConstants {
+    ivec2 camera_pos;
+} push_constants;
+
 void main() {
     ivec2 a[6] = {ivec2(0, 0), ivec2(0, 1), ivec2(1, 1), ivec2(1, 1), ivec2(1, 0), ivec2(0, 0)};
     
-    ivec2 pos = in_rect.xy;
+    ivec2 pos = in_rect.xy - push_constants.camera_pos;
     ivec2 size = in_rect.zw - in_rect.xy;
     size.x *= a[gl_VertexIndex].x;
     size.y *= a[gl_VertexIndex].y;
     pos += size;
 
+    // in_src.x > in_src.z when the sprite is flipped, which mirrors the cell for free.
+    vec2 src = mix(vec2(in_src.xy), vec2(in_src.zw), vec2(a[gl_VertexIndex]));
+
     gl_Position = vec4(float(pos.x)/float(uniforms.viewport_size.x) - 1.0, float(pos.y)/float(uniforms.viewport_size.y) - 1.0, 0.0, 1.0);
-    out_texture_pos = vec2(a[gl_VertexIndex]);
-    out_frame_idx = in_frame_idx;
+    out_texture_pos = src;
+    out_atlas_page = in_atlas_page;
+    out_palette = in_palette;
 }
\ No newline at end of file
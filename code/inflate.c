@@ -0,0 +1,689 @@
+/**
+ * A table-driven zlib/DEFLATE decoder. ZInflate takes the same arguments and returns the same
+ * thing as INFL_ZInflate (the number of bytes written, or (uint64_t)-1 if the data is broken),
+ * but does a lot more work per table lookup:
+ *
+ * - The bit buffer is refilled 8 bytes at a time without branching on the bit count, which
+ *   always leaves at least 56 bits in it. That's enough for a whole length/distance pair
+ *   including extra bits, so the main loop only refills once per iteration.
+ * - Literal/length codes are looked up in a 10-bit table and distances in an 8-bit table.
+ *   Longer codes go through a second-level subtable. When two literal codes fit in 10 bits
+ *   together, their table entry holds both of them, so runs of literals decode two at a time.
+ *   Most cells are only a few KB, so the tables get rebuilt all the time, and going up to 11
+ *   bits made building them cost more than it saved.
+ * - Matches are copied 16 bytes at a time with SSE2, with special cases for the offsets that
+ *   show up all the time in pixel data: 1, 2 and 4 (the same byte, channel pair or pixel over
+ *   and over again).
+ *
+ * This file doesn't depend on anything in main.c so that inflate_benchmark.c can include it too.
+ */
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define INFLATE_SSE2 1
+#else
+#define INFLATE_SSE2 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define INFLATE_LIKELY(X) __builtin_expect(!!(X), 1)
+#define INFLATE_UNLIKELY(X) __builtin_expect(!!(X), 0)
+#else
+#define INFLATE_LIKELY(X) (X)
+#define INFLATE_UNLIKELY(X) (X)
+#endif
+
+#define INFLATE_LITLEN_TABLE_BITS 10
+#define INFLATE_DIST_TABLE_BITS 8
+#define INFLATE_PRECODE_TABLE_BITS 7
+
+// The largest a table can get with its subtables. These are the same numbers zlib's "enough"
+// utility gives for 288 and 32 symbols with a maximum code length of 15.
+#define INFLATE_LITLEN_TABLE_SIZE 1334
+#define INFLATE_DIST_TABLE_SIZE 402
+#define INFLATE_PRECODE_TABLE_SIZE (1 << INFLATE_PRECODE_TABLE_BITS)
+
+#define INFLATE_MAX_CODE_LEN 15
+#define INFLATE_NUM_LITLEN_SYMS 288
+#define INFLATE_NUM_DIST_SYMS 32
+#define INFLATE_NUM_PRECODE_SYMS 19
+
+#define INFLATE_ERROR ((uint64_t)-1)
+
+/*
+Table entries:
+	bits 0..4    how many bits to consume
+	bits 5..7    InflateEntryKind
+	bits 8..15   the literal, the number of extra bits, or the number of subtable bits
+	bits 16..31  the second literal, the base value, or where the subtable starts
+*/
+typedef uint32_t InflateEntryKind;
+enum
+{
+	InflateEntryKind_Literal = 0u,
+	InflateEntryKind_Literal2 = 1u,
+	InflateEntryKind_Value = 2u, // a length or a distance
+	InflateEntryKind_EndOfBlock = 3u,
+	InflateEntryKind_Subtable = 4u,
+	InflateEntryKind_Invalid = 5u,
+};
+
+#define INFLATE_ENTRY(KIND, LOW, HIGH) (((uint32_t)(KIND) << 5) | ((uint32_t)(LOW) << 8) | ((uint32_t)(HIGH) << 16))
+#define INFLATE_ENTRY_BITS(E) ((E) & 31u)
+#define INFLATE_ENTRY_KIND(E) (((E) >> 5) & 7u)
+#define INFLATE_ENTRY_LOW(E) (((E) >> 8) & 0xFFu)
+#define INFLATE_ENTRY_HIGH(E) ((E) >> 16)
+
+typedef struct InflateBits
+{
+	const uint8_t* in;
+	const uint8_t* in_end;
+	uint64_t buf;
+	uint32_t cnt;
+
+	// How many zero bytes were made up past the end of the input. A few of those are fine, since
+	// the last refill always reads further than the last code.
+	size_t overrun;
+} InflateBits;
+
+typedef struct InflateTables
+{
+	uint32_t litlen[INFLATE_LITLEN_TABLE_SIZE];
+	uint32_t dist[INFLATE_DIST_TABLE_SIZE];
+	uint32_t precode[INFLATE_PRECODE_TABLE_SIZE];
+} InflateTables;
+
+SDL_FORCE_INLINE uint64_t InflateRead64(const uint8_t* p)
+{
+	uint64_t res;
+	SDL_memcpy(&res, p, sizeof(res));
+	return res;
+}
+
+SDL_FORCE_INLINE void InflateRefill(InflateBits* bits)
+{
+	if (INFLATE_LIKELY(bits->in_end - bits->in >= 8))
+	{
+		// The bits past cnt get filled in with the start of the next byte, but they're the bits
+		// that would be there anyway, so ORing them in again next time doesn't change anything.
+		bits->buf |= InflateRead64(bits->in) << bits->cnt;
+		bits->in += (63 - bits->cnt) >> 3;
+		bits->cnt |= 56;
+	}
+	else
+	{
+		while (bits->cnt <= 56)
+		{
+			uint64_t byte = 0;
+			if (bits->in < bits->in_end) byte = *bits->in++;
+			else bits->overrun += 1;
+			bits->buf |= byte << bits->cnt;
+			bits->cnt += 8;
+		}
+	}
+}
+
+SDL_FORCE_INLINE uint32_t InflatePeek(InflateBits* bits, uint32_t cnt)
+{
+	SDL_assert(cnt <= bits->cnt);
+	return (uint32_t)(bits->buf & ((1ull << cnt) - 1));
+}
+
+SDL_FORCE_INLINE void InflateConsume(InflateBits* bits, uint32_t cnt)
+{
+	SDL_assert(cnt <= bits->cnt);
+	bits->buf >>= cnt;
+	bits->cnt -= cnt;
+}
+
+SDL_FORCE_INLINE uint32_t InflateGet(InflateBits* bits, uint32_t cnt)
+{
+	uint32_t res = InflatePeek(bits, cnt);
+	InflateConsume(bits, cnt);
+	return res;
+}
+
+SDL_FORCE_INLINE uint32_t InflateLookup(InflateBits* bits, const uint32_t* table, uint32_t table_bits)
+{
+	uint32_t entry = table[InflatePeek(bits, table_bits)];
+	if (INFLATE_ENTRY_KIND(entry) == InflateEntryKind_Subtable)
+	{
+		InflateConsume(bits, table_bits);
+		entry = table[INFLATE_ENTRY_HIGH(entry) + InflatePeek(bits, INFLATE_ENTRY_LOW(entry))];
+	}
+	return entry;
+}
+
+// Consumes the code and its extra bits in one go.
+SDL_FORCE_INLINE uint32_t InflateDecodeValue(InflateBits* bits, uint32_t entry)
+{
+	uint32_t code_len = INFLATE_ENTRY_BITS(entry);
+	uint32_t extra_bits = INFLATE_ENTRY_LOW(entry);
+	uint32_t res = INFLATE_ENTRY_HIGH(entry) + (uint32_t)((bits->buf >> code_len) & ((1ull << extra_bits) - 1));
+	InflateConsume(bits, code_len + extra_bits);
+	return res;
+}
+
+static uint32_t InflateReverseBits(uint32_t code, uint32_t len)
+{
+	SDL_assert(len > 0 && len <= 16);
+	code = ((code & 0x5555u) << 1) | ((code >> 1) & 0x5555u);
+	code = ((code & 0x3333u) << 2) | ((code >> 2) & 0x3333u);
+	code = ((code & 0x0F0Fu) << 4) | ((code >> 4) & 0x0F0Fu);
+	code = ((code & 0x00FFu) << 8) | ((code >> 8) & 0x00FFu);
+	return code >> (16 - len);
+}
+
+/**
+ * Builds a canonical Huffman decoding table from code lengths. sym_entries has what every symbol
+ * decodes to, minus the number of bits to consume. Incomplete codes are allowed (DEFLATE needs
+ * them for distance codes with a single symbol), and whatever bit patterns aren't used decode to
+ * InflateEntryKind_Invalid.
+ */
+static bool InflateBuildTable(uint32_t* table, size_t table_size, uint32_t table_bits, const uint8_t* lens, size_t num_syms, const uint32_t* sym_entries)
+{
+	SDL_assert(num_syms <= INFLATE_NUM_LITLEN_SYMS);
+
+	uint32_t count[INFLATE_MAX_CODE_LEN + 1] = {0};
+	for (size_t sym = 0; sym < num_syms; sym += 1)
+	{
+		count[lens[sym]] += 1;
+	}
+	count[0] = 0;
+
+	uint32_t max_len = 0;
+	int32_t left = 1;
+	for (uint32_t len = 1; len <= INFLATE_MAX_CODE_LEN; len += 1)
+	{
+		left = (left << 1) - (int32_t)count[len];
+		if (left < 0) return false; // over-subscribed
+		if (count[len] > 0) max_len = len;
+	}
+
+	uint32_t offsets[INFLATE_MAX_CODE_LEN + 1] = {0};
+	uint32_t next_code[INFLATE_MAX_CODE_LEN + 1] = {0};
+	for (uint32_t len = 1; len < INFLATE_MAX_CODE_LEN; len += 1)
+	{
+		offsets[len + 1] = offsets[len] + count[len];
+		next_code[len + 1] = (next_code[len] + count[len]) << 1;
+	}
+
+	uint16_t sorted[INFLATE_NUM_LITLEN_SYMS];
+	size_t num_sorted = 0;
+	for (size_t sym = 0; sym < num_syms; sym += 1)
+	{
+		if (lens[sym] > 0)
+		{
+			sorted[offsets[lens[sym]]++] = (uint16_t)sym;
+			num_sorted += 1;
+		}
+	}
+
+	size_t table_end = (size_t)1 << table_bits;
+	SDL_assert(table_end <= table_size);
+	if (left > 0)
+	{
+		// Only incomplete codes leave holes in the table.
+		for (size_t i = 0; i < table_end; i += 1)
+		{
+			table[i] = INFLATE_ENTRY(InflateEntryKind_Invalid, 0, 0);
+		}
+	}
+
+	uint32_t remaining[INFLATE_MAX_CODE_LEN + 1];
+	SDL_memcpy(remaining, count, sizeof(remaining));
+
+	uint32_t sub_prefix = UINT32_MAX;
+	size_t sub_start = 0;
+	uint32_t sub_bits = 0;
+	for (size_t i = 0; i < num_sorted; i += 1)
+	{
+		uint16_t sym = sorted[i];
+		uint32_t len = lens[sym];
+		uint32_t code = InflateReverseBits(next_code[len]++, len);
+
+		if (len <= table_bits)
+		{
+			uint32_t entry = sym_entries[sym] | len;
+			for (size_t j = code; j < ((size_t)1 << table_bits); j += (size_t)1 << len)
+			{
+				table[j] = entry;
+			}
+		}
+		else
+		{
+			// Codes are sorted, so all of the codes that share a prefix come one after another.
+			uint32_t prefix = code & ((1u << table_bits) - 1);
+			if (prefix != sub_prefix)
+			{
+				// Make the subtable just big enough for the codes that are left with this prefix.
+				sub_prefix = prefix;
+				sub_bits = len - table_bits;
+				int32_t sub_left = 1 << sub_bits;
+				while (sub_bits + table_bits < max_len)
+				{
+					sub_left -= (int32_t)remaining[sub_bits + table_bits];
+					if (sub_left <= 0) break;
+					sub_bits += 1;
+					sub_left <<= 1;
+				}
+
+				sub_start = table_end;
+				table_end += (size_t)1 << sub_bits;
+				if (table_end > table_size || sub_start > UINT16_MAX) return false;
+				if (left > 0)
+				{
+					for (size_t j = sub_start; j < table_end; j += 1)
+					{
+						table[j] = INFLATE_ENTRY(InflateEntryKind_Invalid, 0, 0);
+					}
+				}
+				table[prefix] = INFLATE_ENTRY(InflateEntryKind_Subtable, sub_bits, sub_start) | table_bits;
+			}
+
+			uint32_t entry = sym_entries[sym] | (len - table_bits);
+			for (size_t j = code >> table_bits; j < ((size_t)1 << sub_bits); j += (size_t)1 << (len - table_bits))
+			{
+				table[sub_start + j] = entry;
+			}
+		}
+		remaining[len] -= 1;
+	}
+
+	return true;
+}
+
+static bool InflateBuildLitlenTable(uint32_t* table, const uint8_t* lens, size_t num_syms)
+{
+	static const uint16_t length_base[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+	static const uint8_t length_extra_bits[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+
+	uint32_t sym_entries[INFLATE_NUM_LITLEN_SYMS];
+	for (uint32_t sym = 0; sym < 256; sym += 1)
+	{
+		sym_entries[sym] = INFLATE_ENTRY(InflateEntryKind_Literal, sym, 0);
+	}
+	sym_entries[256] = INFLATE_ENTRY(InflateEntryKind_EndOfBlock, 0, 0);
+	for (uint32_t sym = 257; sym < 286; sym += 1)
+	{
+		sym_entries[sym] = INFLATE_ENTRY(InflateEntryKind_Value, length_extra_bits[sym - 257], length_base[sym - 257]);
+	}
+	// Length codes 286 and 287 must not appear in compressed data.
+	sym_entries[286] = sym_entries[287] = INFLATE_ENTRY(InflateEntryKind_Invalid, 0, 0);
+
+	if (!InflateBuildTable(table, INFLATE_LITLEN_TABLE_SIZE, INFLATE_LITLEN_TABLE_BITS, lens, num_syms, sym_entries)) return false;
+
+	// MergeLiterals
+	// Whatever follows a literal code of length n is in the next 10 - n bits of the same index.
+	// If that's a literal too and it fits, both of them go into one entry. Going backwards means
+	// that the entry we look at (at a smaller index) hasn't been merged yet.
+	for (uint32_t i = (1u << INFLATE_LITLEN_TABLE_BITS); i-- > 0;)
+	{
+		uint32_t entry = table[i];
+		if (INFLATE_ENTRY_KIND(entry) != InflateEntryKind_Literal) continue;
+
+		uint32_t len = INFLATE_ENTRY_BITS(entry);
+		uint32_t next = table[i >> len];
+		if (INFLATE_ENTRY_KIND(next) == InflateEntryKind_Literal && len + INFLATE_ENTRY_BITS(next) <= INFLATE_LITLEN_TABLE_BITS)
+		{
+			table[i] = INFLATE_ENTRY(InflateEntryKind_Literal2, INFLATE_ENTRY_LOW(entry), INFLATE_ENTRY_LOW(next)) | (len + INFLATE_ENTRY_BITS(next));
+		}
+	}
+
+	return true;
+}
+
+static bool InflateBuildDistTable(uint32_t* table, const uint8_t* lens, size_t num_syms)
+{
+	static const uint16_t dist_base[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+	static const uint8_t dist_extra_bits[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+	uint32_t sym_entries[INFLATE_NUM_DIST_SYMS];
+	for (uint32_t sym = 0; sym < 30; sym += 1)
+	{
+		sym_entries[sym] = INFLATE_ENTRY(InflateEntryKind_Value, dist_extra_bits[sym], dist_base[sym]);
+	}
+	// Distance codes 30 and 31 must not appear in compressed data.
+	sym_entries[30] = sym_entries[31] = INFLATE_ENTRY(InflateEntryKind_Invalid, 0, 0);
+
+	return InflateBuildTable(table, INFLATE_DIST_TABLE_SIZE, INFLATE_DIST_TABLE_BITS, lens, num_syms, sym_entries);
+}
+
+// The tables for fixed Huffman blocks never change, so they're only built once.
+static SDL_InitState inflate_fixed_tables_init;
+static uint32_t inflate_fixed_litlen[INFLATE_LITLEN_TABLE_SIZE];
+static uint32_t inflate_fixed_dist[INFLATE_DIST_TABLE_SIZE];
+
+static void InflateInitFixedTables(void)
+{
+	if (!SDL_ShouldInit(&inflate_fixed_tables_init)) return;
+
+	uint8_t lens[INFLATE_NUM_LITLEN_SYMS + INFLATE_NUM_DIST_SYMS];
+	SDL_memset(lens + 0, 8, 144);
+	SDL_memset(lens + 144, 9, 112);
+	SDL_memset(lens + 256, 7, 24);
+	SDL_memset(lens + 280, 8, 8);
+	SDL_memset(lens + INFLATE_NUM_LITLEN_SYMS, 5, INFLATE_NUM_DIST_SYMS);
+
+	bool ok = InflateBuildLitlenTable(inflate_fixed_litlen, lens, INFLATE_NUM_LITLEN_SYMS);
+	ok = ok && InflateBuildDistTable(inflate_fixed_dist, lens + INFLATE_NUM_LITLEN_SYMS, INFLATE_NUM_DIST_SYMS);
+	SDL_assert(ok);
+
+	SDL_SetInitialized(&inflate_fixed_tables_init, true);
+}
+
+// Writes one or two literals, depending on what kind of entry it is.
+SDL_FORCE_INLINE bool InflateWriteLiterals(uint8_t** dst, const uint8_t* out_end, uint32_t entry)
+{
+	uint8_t* p = *dst;
+	size_t num_literals = 1 + INFLATE_ENTRY_KIND(entry);
+	if (INFLATE_LIKELY(out_end - p >= 2))
+	{
+		// Writing the second byte unconditionally is fine, since it's either a literal or it's 
+		// going to be overwritten by whatever comes next.
+		p[0] = (uint8_t)INFLATE_ENTRY_LOW(entry);
+		p[1] = (uint8_t)INFLATE_ENTRY_HIGH(entry);
+	}
+	else if (num_literals == 1 && p < out_end)
+	{
+		p[0] = (uint8_t)INFLATE_ENTRY_LOW(entry);
+	}
+	else
+	{
+		return false;
+	}
+	*dst = p + num_literals;
+	return true;
+}
+
+SDL_FORCE_INLINE void InflateCopyMatch(uint8_t* dst, size_t offs, size_t len, const uint8_t* out_end)
+{
+	const uint8_t* src = dst - offs;
+	uint8_t* end = dst + len;
+
+	// Every fast path below is allowed to write up to 15 bytes past the end of the match.
+	if (INFLATE_LIKELY(out_end - end >= 16))
+	{
+#if INFLATE_SSE2
+		if (offs >= 16)
+		{
+			do
+			{
+				_mm_storeu_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+				dst += 16; src += 16;
+			} while (dst < end);
+			return;
+		}
+		if (offs == 1 || offs == 2 || offs == 4)
+		{
+			// The pattern repeats every offs bytes and offs divides 16, so every 16 bytes after
+			// dst look exactly the same.
+			__m128i pattern;
+			if (offs == 1)
+			{
+				pattern = _mm_set1_epi8((char)src[0]);
+			}
+			else if (offs == 2)
+			{
+				uint16_t v; SDL_memcpy(&v, src, sizeof(v));
+				pattern = _mm_set1_epi16((short)v);
+			}
+			else
+			{
+				uint32_t v; SDL_memcpy(&v, src, sizeof(v));
+				pattern = _mm_set1_epi32((int)v);
+			}
+			do
+			{
+				_mm_storeu_si128((__m128i*)dst, pattern);
+				dst += 16;
+			} while (dst < end);
+			return;
+		}
+#endif // INFLATE_SSE2
+		if (offs >= 8)
+		{
+			do
+			{
+				SDL_memcpy(dst, src, 8);
+				dst += 8; src += 8;
+			} while (dst < end);
+			return;
+		}
+	}
+
+	do *dst++ = *src++;
+	while (dst < end);
+}
+
+static uint32_t InflateAdler32(const uint8_t* buf, size_t buf_size)
+{
+	// The most bytes that can be summed up before s2 could overflow.
+	const size_t max_block_size = 5552;
+
+	uint32_t s1 = 1;
+	uint32_t s2 = 0;
+	while (buf_size > 0)
+	{
+		size_t block_size = SDL_min(buf_size, max_block_size);
+		buf_size -= block_size;
+
+		for (; block_size >= 8; block_size -= 8, buf += 8)
+		{
+			s1 += buf[0]; s2 += s1;
+			s1 += buf[1]; s2 += s1;
+			s1 += buf[2]; s2 += s1;
+			s1 += buf[3]; s2 += s1;
+			s1 += buf[4]; s2 += s1;
+			s1 += buf[5]; s2 += s1;
+			s1 += buf[6]; s2 += s1;
+			s1 += buf[7]; s2 += s1;
+		}
+		for (; block_size > 0; block_size -= 1, buf += 1)
+		{
+			s1 += buf[0]; s2 += s1;
+		}
+
+		s1 %= 65521u;
+		s2 %= 65521u;
+	}
+	return (s2 << 16) | s1;
+}
+
+// Raw DEFLATE data, without the zlib header or trailer.
+static uint64_t Inflate(void* out, uint64_t cap, const void* in, uint64_t size)
+{
+	static const uint8_t precode_order[INFLATE_NUM_PRECODE_SYMS] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+
+	uint8_t* out_start = out;
+	uint8_t* out_end = out_start + cap;
+	uint8_t* dst = out_start;
+
+	InflateBits bits =
+	{
+		.in = in,
+		.in_end = (const uint8_t*)in + size,
+	};
+
+	InflateTables tables_storage;
+	InflateTables* tables = &tables_storage;
+
+	bool last = false;
+	while (!last)
+	{
+		InflateRefill(&bits);
+		last = InflateGet(&bits, 1) != 0;
+		uint32_t type = InflateGet(&bits, 2);
+
+		const uint32_t* litlen = NULL;
+		const uint32_t* dist = NULL;
+
+		if (type == 0)
+		{
+			// StoredBlock
+			InflateConsume(&bits, bits.cnt & 7);
+			uint32_t len = InflateGet(&bits, 16);
+			uint32_t nlen = InflateGet(&bits, 16);
+			if (len != (~nlen & 0xFFFFu)) goto fail;
+
+			// Give back whatever whole bytes are left in the bit buffer.
+			size_t buffered = bits.cnt >> 3;
+			if (bits.overrun > buffered) goto fail;
+			bits.in -= buffered - bits.overrun;
+			bits.overrun = 0;
+			bits.buf = 0;
+			bits.cnt = 0;
+
+			if (len > (size_t)(bits.in_end - bits.in) || len > (size_t)(out_end - dst)) goto fail;
+			SDL_memcpy(dst, bits.in, len);
+			bits.in += len;
+			dst += len;
+			continue;
+		}
+		else if (type == 1)
+		{
+			// FixedHuffmanBlock
+			InflateInitFixedTables();
+			litlen = inflate_fixed_litlen;
+			dist = inflate_fixed_dist;
+		}
+		else if (type == 2)
+		{
+			// DynamicHuffmanBlock
+			InflateRefill(&bits);
+			uint32_t num_litlen = 257 + InflateGet(&bits, 5);
+			uint32_t num_dist = 1 + InflateGet(&bits, 5);
+			uint32_t num_precode = 4 + InflateGet(&bits, 4);
+
+			uint8_t precode_lens[INFLATE_NUM_PRECODE_SYMS] = {0};
+			for (uint32_t i = 0; i < num_precode; i += 1)
+			{
+				InflateRefill(&bits);
+				precode_lens[precode_order[i]] = (uint8_t)InflateGet(&bits, 3);
+			}
+
+			uint32_t precode_entries[INFLATE_NUM_PRECODE_SYMS];
+			for (uint32_t sym = 0; sym < INFLATE_NUM_PRECODE_SYMS; sym += 1)
+			{
+				precode_entries[sym] = INFLATE_ENTRY(InflateEntryKind_Literal, sym, 0);
+			}
+			if (!InflateBuildTable(tables->precode, INFLATE_PRECODE_TABLE_SIZE, INFLATE_PRECODE_TABLE_BITS, precode_lens, INFLATE_NUM_PRECODE_SYMS, precode_entries)) goto fail;
+
+			uint8_t lens[INFLATE_NUM_LITLEN_SYMS + INFLATE_NUM_DIST_SYMS];
+			uint32_t num_lens = num_litlen + num_dist;
+			for (uint32_t i = 0; i < num_lens;)
+			{
+				InflateRefill(&bits);
+				if (INFLATE_UNLIKELY(bits.overrun > sizeof(bits.buf))) goto fail;
+
+				uint32_t entry = tables->precode[InflatePeek(&bits, INFLATE_PRECODE_TABLE_BITS)];
+				if (INFLATE_ENTRY_KIND(entry) != InflateEntryKind_Literal) goto fail;
+				InflateConsume(&bits, INFLATE_ENTRY_BITS(entry));
+
+				uint32_t sym = INFLATE_ENTRY_LOW(entry);
+				if (sym < 16)
+				{
+					lens[i++] = (uint8_t)sym;
+					continue;
+				}
+
+				uint8_t repeat_len = 0;
+				uint32_t repeat_cnt;
+				if (sym == 16)
+				{
+					if (i == 0) goto fail;
+					repeat_len = lens[i - 1];
+					repeat_cnt = 3 + InflateGet(&bits, 2);
+				}
+				else if (sym == 17)
+				{
+					repeat_cnt = 3 + InflateGet(&bits, 3);
+				}
+				else
+				{
+					repeat_cnt = 11 + InflateGet(&bits, 7);
+				}
+				if (repeat_cnt > num_lens - i) goto fail;
+				SDL_memset(lens + i, repeat_len, repeat_cnt);
+				i += repeat_cnt;
+			}
+
+			// Without an end of block code, the block could never end.
+			if (lens[256] == 0) goto fail;
+			if (!InflateBuildLitlenTable(tables->litlen, lens, num_litlen)) goto fail;
+			if (!InflateBuildDistTable(tables->dist, lens + num_litlen, num_dist)) goto fail;
+			litlen = tables->litlen;
+			dist = tables->dist;
+		}
+		else
+		{
+			goto fail;
+		}
+
+		// HuffmanBlock
+		for (;;)
+		{
+			InflateRefill(&bits);
+			if (INFLATE_UNLIKELY(bits.overrun > sizeof(bits.buf))) goto fail;
+
+			uint32_t entry = InflateLookup(&bits, litlen, INFLATE_LITLEN_TABLE_BITS);
+			uint32_t kind = INFLATE_ENTRY_KIND(entry);
+
+			if (kind <= InflateEntryKind_Literal2)
+			{
+				if (!InflateWriteLiterals(&dst, out_end, entry)) goto fail;
+				InflateConsume(&bits, INFLATE_ENTRY_BITS(entry));
+
+				// There are still at least 41 bits left, which is plenty for another literal. Only the
+				// top level of the table is looked at, since a subtable lookup consumes bits before 
+				// we know what it is.
+				entry = litlen[InflatePeek(&bits, INFLATE_LITLEN_TABLE_BITS)];
+				if (INFLATE_ENTRY_KIND(entry) <= InflateEntryKind_Literal2)
+				{
+					if (!InflateWriteLiterals(&dst, out_end, entry)) goto fail;
+					InflateConsume(&bits, INFLATE_ENTRY_BITS(entry));
+				}
+				continue;
+			}
+			if (kind == InflateEntryKind_EndOfBlock)
+			{
+				InflateConsume(&bits, INFLATE_ENTRY_BITS(entry));
+				break;
+			}
+			if (kind != InflateEntryKind_Value) goto fail;
+
+			// Match
+			size_t len = InflateDecodeValue(&bits, entry);
+
+			entry = InflateLookup(&bits, dist, INFLATE_DIST_TABLE_BITS);
+			if (INFLATE_ENTRY_KIND(entry) != InflateEntryKind_Value) goto fail;
+			size_t offs = InflateDecodeValue(&bits, entry);
+
+			if (INFLATE_UNLIKELY(offs > (size_t)(dst - out_start) || len > (size_t)(out_end - dst))) goto fail;
+			InflateCopyMatch(dst, offs, len, out_end);
+			dst += len;
+		}
+	}
+
+	return (uint64_t)(dst - out_start);
+
+fail:
+	return INFLATE_ERROR;
+}
+
+// Same as INFL_ZInflate: zlib header, raw DEFLATE data, then the Adler-32 of the output.
+static uint64_t ZInflate(void* out, uint64_t cap, const void* in, uint64_t size)
+{
+	const uint8_t* src = in;
+	if (size < 6) return INFLATE_ERROR;
+
+	// Compression method 8 (DEFLATE), and the header has to be a multiple of 31.
+	if ((src[0] & 0x0F) != 8 || ((src[0] << 8) | src[1]) % 31 != 0) return INFLATE_ERROR;
+
+	uint64_t res = Inflate(out, cap, src + 2, size - 2);
+	if (res == INFLATE_ERROR) return INFLATE_ERROR;
+
+	const uint8_t* trailer = src + size - 4;
+	uint32_t adler32 = ((uint32_t)trailer[0] << 24) | ((uint32_t)trailer[1] << 16) | ((uint32_t)trailer[2] << 8) | (uint32_t)trailer[3];
+	return InflateAdler32(out, res) == adler32 ? res : INFLATE_ERROR;
+}
@@ -0,0 +1,214 @@
+/**
+ * Inflates every compressed cell of every .aseprite file under a directory with both ZInflate
+ * and INFL_ZInflate, checks that they agree byte for byte, and reports how fast each of them is.
+ *
+ * Usage: InflateBenchmark [directory] [iterations]
+ * The directory defaults to "assets" and the number of iterations to 20.
+ */
+
+#define TOGGLE_PROFILING 0
+
+#include "main.h"
+#include "aseprite.h"
+#include "inflate.c"
+
+typedef struct BenchmarkCell
+{
+	const void* src_buf;
+	size_t src_buf_size;
+	size_t dst_buf_size;
+} BenchmarkCell;
+
+typedef struct BenchmarkCorpus
+{
+	void** files; size_t num_files;
+	BenchmarkCell* cells; size_t num_cells;
+	size_t cap_cells;
+	size_t src_size;
+	size_t dst_size;
+	size_t max_dst_buf_size;
+} BenchmarkCorpus;
+
+typedef uint64_t (*InflateFunc)(void* out, uint64_t cap, const void* in, uint64_t size);
+
+static void AddBenchmarkCell(BenchmarkCorpus* corpus, BenchmarkCell cell)
+{
+	if (corpus->num_cells == corpus->cap_cells)
+	{
+		corpus->cap_cells = SDL_max(corpus->cap_cells*2, (size_t)256);
+		corpus->cells = SDL_realloc(corpus->cells, corpus->cap_cells*sizeof(BenchmarkCell)); SDL_CHECK(corpus->cells);
+	}
+	corpus->cells[corpus->num_cells++] = cell;
+	corpus->src_size += cell.src_buf_size;
+	corpus->dst_size += cell.dst_buf_size;
+	corpus->max_dst_buf_size = SDL_max(corpus->max_dst_buf_size, cell.dst_buf_size);
+}
+
+// Same walk as ParseSpriteAseprite, except that it only cares about compressed cells.
+static void AddBenchmarkFile(BenchmarkCorpus* corpus, const void* data, size_t data_size)
+{
+	const uint8_t* file_start = data;
+	const uint8_t* file_end = file_start + data_size;
+	if (data_size < sizeof(ASE_Header)) return;
+
+	const ASE_Header* header = data;
+	if (header->magic_number != 0xA5E0) return;
+	size_t bytes_per_pixel = header->color_depth/8;
+
+	const uint8_t* frame_start = file_start + sizeof(ASE_Header);
+	for (size_t frame_idx = 0; frame_idx < header->num_frames; frame_idx += 1)
+	{
+		if (frame_start + sizeof(ASE_Frame) > file_end) return;
+		const ASE_Frame* frame = (const ASE_Frame*)frame_start;
+		const uint8_t* frame_end = frame_start + frame->num_bytes;
+		if (frame->magic_number != 0xF1FA || frame_end > file_end) return;
+
+		const uint8_t* chunk_start = frame_start + sizeof(ASE_Frame);
+		for (size_t chunk_idx = 0; chunk_idx < frame->num_chunks; chunk_idx += 1)
+		{
+			const ASE_ChunkHeader* chunk_header = (const ASE_ChunkHeader*)chunk_start;
+			if (chunk_start + sizeof(ASE_ChunkHeader) > frame_end) break;
+			if (chunk_header->size < sizeof(ASE_ChunkHeader) || chunk_start + chunk_header->size > frame_end) break;
+			size_t chunk_size = chunk_header->size - sizeof(ASE_ChunkHeader);
+
+			if (chunk_header->type == ASE_ChunkType_Cell && chunk_size >= sizeof(ASE_CellChunk))
+			{
+				const ASE_CellChunk* cell = (const ASE_CellChunk*)(chunk_header + 1);
+				if (cell->type == ASE_CellType_CompressedImage)
+				{
+					AddBenchmarkCell(corpus, (BenchmarkCell)
+					{
+						.src_buf = cell + 1,
+						.src_buf_size = chunk_size - sizeof(ASE_CellChunk),
+						.dst_buf_size = (size_t)cell->w*(size_t)cell->h*bytes_per_pixel,
+					});
+				}
+			}
+
+			chunk_start += chunk_header->size;
+		}
+
+		frame_start = frame_end;
+	}
+}
+
+static double BenchmarkInflate(BenchmarkCorpus* corpus, InflateFunc inflate, void* dst_buf, size_t num_iterations)
+{
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (size_t iteration = 0; iteration < num_iterations; iteration += 1)
+	{
+		for (size_t cell_idx = 0; cell_idx < corpus->num_cells; cell_idx += 1)
+		{
+			BenchmarkCell* cell = &corpus->cells[cell_idx];
+			inflate(dst_buf, cell->dst_buf_size, cell->src_buf, cell->src_buf_size);
+		}
+	}
+	uint64_t end = SDL_GetPerformanceCounter();
+
+	double seconds = (double)(end - start)/(double)SDL_GetPerformanceFrequency();
+	return (double)(corpus->dst_size*num_iterations)/seconds/(1024.0*1024.0);
+}
+
+int32_t main(int32_t argc, char* argv[])
+{
+	const char* dir = argc > 1 ? argv[1] : "assets";
+	size_t num_iterations = argc > 2 ? (size_t)SDL_strtoul(argv[2], NULL, 10) : 20;
+	num_iterations = SDL_max(num_iterations, (size_t)1);
+
+	SDL_CHECK(SDL_Init(0));
+
+	BenchmarkCorpus corpus = {0};
+
+	// LoadCorpus
+	{
+		int32_t num_paths;
+		char** paths = SDL_GlobDirectory(dir, "*.aseprite", SDL_GLOB_CASEINSENSITIVE, &num_paths);
+		if (!paths || num_paths == 0)
+		{
+			SDL_Log("No .aseprite files found in \"%s\".", dir);
+			SDL_Quit();
+			return 1;
+		}
+
+		corpus.files = SDL_calloc((size_t)num_paths, sizeof(void*)); SDL_CHECK(corpus.files);
+		for (int32_t path_idx = 0; path_idx < num_paths; path_idx += 1)
+		{
+			char* path;
+			SDL_CHECK(SDL_asprintf(&path, "%s/%s", dir, paths[path_idx]) > 0);
+
+			size_t data_size;
+			void* data = SDL_LoadFile(path, &data_size);
+			if (data)
+			{
+				corpus.files[corpus.num_files++] = data;
+				AddBenchmarkFile(&corpus, data, data_size);
+			}
+			else
+			{
+				SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Failed to load %s: %s", path, SDL_GetError());
+			}
+			SDL_free(path);
+		}
+		SDL_free(paths);
+	}
+
+	SDL_Log("%llu files, %llu cells, %.2f MB compressed, %.2f MB inflated",
+		corpus.num_files, corpus.num_cells,
+		(double)corpus.src_size/(1024.0*1024.0),
+		(double)corpus.dst_size/(1024.0*1024.0));
+	if (corpus.num_cells == 0)
+	{
+		SDL_Quit();
+		return 1;
+	}
+
+	// The extra space is there because both decoders are allowed to write a little past the end
+	// of a match when there's room for it.
+	size_t buf_size = corpus.max_dst_buf_size + 64;
+	uint8_t* expected = SDL_malloc(buf_size); SDL_CHECK(expected);
+	uint8_t* actual = SDL_malloc(buf_size); SDL_CHECK(actual);
+
+	// Validate
+	size_t num_mismatches = 0;
+	for (size_t cell_idx = 0; cell_idx < corpus.num_cells; cell_idx += 1)
+	{
+		BenchmarkCell* cell = &corpus.cells[cell_idx];
+		uint64_t expected_res = INFL_ZInflate(expected, cell->dst_buf_size, cell->src_buf, cell->src_buf_size);
+		uint64_t actual_res = ZInflate(actual, cell->dst_buf_size, cell->src_buf, cell->src_buf_size);
+		if (expected_res != actual_res || (actual_res == cell->dst_buf_size && SDL_memcmp(expected, actual, cell->dst_buf_size) != 0))
+		{
+			SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "cells[%llu]: INFL_ZInflate returned %llu, ZInflate returned %llu",
+				cell_idx, expected_res, actual_res);
+			num_mismatches += 1;
+		}
+	}
+	if (num_mismatches > 0)
+	{
+		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%llu of %llu cells don't match.", num_mismatches, corpus.num_cells);
+	}
+	else
+	{
+		SDL_Log("All %llu cells match.", corpus.num_cells);
+	}
+
+	// Warm up the caches and the fixed Huffman tables before timing anything.
+	BenchmarkInflate(&corpus, INFL_ZInflate, actual, 1);
+	BenchmarkInflate(&corpus, ZInflate, actual, 1);
+
+	double infl_speed = BenchmarkInflate(&corpus, INFL_ZInflate, actual, num_iterations);
+	double speed = BenchmarkInflate(&corpus, ZInflate, actual, num_iterations);
+	SDL_Log("INFL_ZInflate: %.1f MB/s", infl_speed);
+	SDL_Log("ZInflate:      %.1f MB/s (%.2fx)", speed, speed/infl_speed);
+
+	SDL_free(actual);
+	SDL_free(expected);
+	for (size_t file_idx = 0; file_idx < corpus.num_files; file_idx += 1)
+	{
+		SDL_free(corpus.files[file_idx]);
+	}
+	SDL_free(corpus.files);
+	SDL_free(corpus.cells);
+	SDL_Quit();
+
+	return num_mismatches > 0 ? 1 : 0;
+}
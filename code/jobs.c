@@ -0,0 +1,153 @@
+/**
+ * A tiny fork-join job system. RunJobs hands out job indices from an atomic counter to every
+ * thread in the pool (including the calling thread, which is always thread 0) and returns once
+ * all of them have finished. Every thread owns an arena and a stack that nobody else touches,
+ * so jobs never have to go through ctx->arena or ctx->stack.
+ */
+
+static void RunJobsOnThread(JobPool* pool, JobThread* thread)
+{
+	for (;;)
+	{
+		size_t job_idx = (size_t)SDL_AddAtomicInt(&pool->next_job, 1);
+		if (job_idx >= pool->num_jobs) break;
+
+		pool->func(pool->user_data, job_idx, thread);
+
+		if ((size_t)SDL_AddAtomicInt(&pool->num_jobs_done, 1) + 1 == pool->num_jobs)
+		{
+			SDL_LockMutex(pool->mutex);
+			SDL_BroadcastCondition(pool->jobs_done);
+			SDL_UnlockMutex(pool->mutex);
+		}
+	}
+}
+
+static int32_t SDLCALL JobWorker(void* data)
+{
+	JobThread* thread = data;
+	JobPool* pool = thread->pool;
+
+	uint64_t generation = 0;
+	SDL_LockMutex(pool->mutex);
+	for (;;)
+	{
+		while (!pool->quit && pool->generation == generation)
+		{
+			SDL_WaitCondition(pool->jobs_available, pool->mutex);
+		}
+		if (pool->quit) break;
+		generation = pool->generation;
+		pool->num_active_workers += 1;
+
+		SDL_UnlockMutex(pool->mutex);
+		RunJobsOnThread(pool, thread);
+		SDL_LockMutex(pool->mutex);
+
+		pool->num_active_workers -= 1;
+		if (pool->num_active_workers == 0)
+		{
+			SDL_BroadcastCondition(pool->jobs_done);
+		}
+	}
+	SDL_UnlockMutex(pool->mutex);
+
+	return 0;
+}
+
+static void CreateJobPool(JobPool* pool, Arena* arena)
+{
+	SDL_assert(pool && arena);
+
+	pool->num_threads = (size_t)SDL_max(SDL_GetNumLogicalCPUCores(), 1);
+	pool->threads = ArenaAlloc(arena, pool->num_threads, JobThread);
+
+	pool->mutex = SDL_CreateMutex(); SDL_CHECK(pool->mutex);
+	pool->jobs_available = SDL_CreateCondition(); SDL_CHECK(pool->jobs_available);
+	pool->jobs_done = SDL_CreateCondition(); SDL_CHECK(pool->jobs_done);
+
+	for (size_t thread_idx = 0; thread_idx < pool->num_threads; thread_idx += 1)
+	{
+		JobThread* thread = &pool->threads[thread_idx];
+		thread->pool = pool;
+		thread->idx = thread_idx;
+
+		uint8_t* memory = SDL_malloc(JOB_THREAD_MEMORY_SIZE); SDL_CHECK(memory);
+		thread->arena.buf = memory;
+		thread->arena.buf_len = JOB_THREAD_MEMORY_SIZE/2;
+		thread->stack.buf = memory + thread->arena.buf_len;
+		thread->stack.buf_len = JOB_THREAD_MEMORY_SIZE - thread->arena.buf_len;
+
+		// Thread 0 is whoever calls RunJobs.
+		if (thread_idx != 0)
+		{
+			thread->handle = SDL_CreateThread(JobWorker, "JobWorker", thread);
+			SDL_CHECK(thread->handle);
+		}
+	}
+}
+
+// Stops every worker and waits for it to exit. Can't be called while RunJobs is running.
+static void DestroyJobPool(JobPool* pool)
+{
+	SDL_LockMutex(pool->mutex);
+	pool->quit = true;
+	SDL_BroadcastCondition(pool->jobs_available);
+	SDL_UnlockMutex(pool->mutex);
+
+	for (size_t thread_idx = 0; thread_idx < pool->num_threads; thread_idx += 1)
+	{
+		JobThread* thread = &pool->threads[thread_idx];
+		if (thread->handle)
+		{
+			SDL_WaitThread(thread->handle, NULL);
+			thread->handle = NULL;
+		}
+		SDL_free(thread->arena.buf);
+	}
+
+	SDL_DestroyCondition(pool->jobs_done);
+	SDL_DestroyCondition(pool->jobs_available);
+	SDL_DestroyMutex(pool->mutex);
+	*pool = (JobPool){0};
+}
+
+static void RunJobs(JobPool* pool, size_t num_jobs, JobFunc func, void* user_data)
+{
+	if (num_jobs == 0) return;
+
+	SDL_LockMutex(pool->mutex);
+	// A worker that woke up late for the previous batch might still be looking at it.
+	while (pool->num_active_workers > 0)
+	{
+		SDL_WaitCondition(pool->jobs_done, pool->mutex);
+	}
+	pool->func = func;
+	pool->user_data = user_data;
+	pool->num_jobs = num_jobs;
+	SDL_SetAtomicInt(&pool->num_jobs_done, 0);
+	SDL_SetAtomicInt(&pool->next_job, 0);
+	pool->generation += 1;
+	SDL_BroadcastCondition(pool->jobs_available);
+	SDL_UnlockMutex(pool->mutex);
+
+	RunJobsOnThread(pool, &pool->threads[0]);
+
+	SDL_LockMutex(pool->mutex);
+	while ((size_t)SDL_GetAtomicInt(&pool->num_jobs_done) < num_jobs || pool->num_active_workers > 0)
+	{
+		SDL_WaitCondition(pool->jobs_done, pool->mutex);
+	}
+	SDL_UnlockMutex(pool->mutex);
+}
+
+static void ResetJobArenas(JobPool* pool)
+{
+	for (size_t thread_idx = 0; thread_idx < pool->num_threads; thread_idx += 1)
+	{
+		JobThread* thread = &pool->threads[thread_idx];
+		thread->arena.prev_offset = 0;
+		thread->arena.curr_offset = 0;
+		StackFreeAll(&thread->stack);
+	}
+}
@@ -0,0 +1,484 @@
+/**
+ * A single-pass reader for the part of an LDtk project that the game actually uses: the size of a
+ * level, the gridTiles of its tile layers, the intGridCsv of its IntGrid layers and the position
+ * of every entity instance. Everything else gets skipped without being looked at too closely.
+ *
+ * Unlike cJSON, it never allocates. The caller hands LdtkReadLevel a block of memory, and every
+ * array gets written to the top of that block as it's being read. That works because the arrays
+ * never overlap in the file: a gridTiles array is always over before the next one starts, so
+ * whichever array is being read is always the last thing in the block and can keep growing
+ * without knowing its size up front. Strings aren't copied either. LdtkString points into the
+ * file, so the file has to stay around for as long as the strings are used.
+ *
+ * Levels are handed to a callback one at a time, and the block gets reused for the next one, so
+ * reading a whole world never takes more memory than its biggest level.
+ *
+ * It isn't a validating parser. It handles anything that's valid JSON, but it doesn't try very
+ * hard to reject things that aren't.
+ *
+ * This file doesn't depend on anything in main.c so that ldtk_benchmark.c can include it too.
+ */
+
+#define LDTK_MAX_LAYERS 16
+
+typedef struct LdtkString
+{
+	const char* str;
+	size_t len;
+} LdtkString;
+
+// Same layout as Tile, so that a level can point at these directly.
+typedef struct LdtkTile
+{
+	ivec2s src;
+	ivec2s dst; // "px"
+} LdtkTile;
+
+typedef struct LdtkEntity
+{
+	LdtkString identifier;
+	ivec2s world_pos; // "__worldX" and "__worldY"
+} LdtkEntity;
+
+typedef struct LdtkLayer
+{
+	LdtkString identifier;
+	LdtkString type;
+
+	LdtkTile* tiles; size_t num_tiles;
+	LdtkEntity* entities; size_t num_entities;
+
+	// Each value of intGridCsv is reduced to whether it's zero or not, since the game only cares
+	// about whether a tile is solid.
+	bool* int_grid; size_t num_int_grid;
+} LdtkLayer;
+
+typedef struct LdtkLevel
+{
+	LdtkString identifier;
+	ivec2s world_pos; // "worldX" and "worldY"
+	ivec2s px_size; // "pxWid" and "pxHei"
+	LdtkLayer layers[LDTK_MAX_LAYERS]; size_t num_layers;
+	size_t buf_used; // how much of the block passed to LdtkReadLevels the arrays take up
+} LdtkLevel;
+
+typedef struct LdtkReader
+{
+	const char* start;
+	const char* at;
+	const char* end;
+	bool failed;
+
+	uint8_t* buf;
+	size_t buf_len;
+	size_t buf_used;
+} LdtkReader;
+
+#define LDTK_STRING_IS(S, LIT) ((S).len == sizeof(LIT) - 1 && SDL_memcmp((S).str, LIT, sizeof(LIT) - 1) == 0)
+
+static bool LdtkFail(LdtkReader* r, const char* what)
+{
+	if (!r->failed)
+	{
+		SDL_SetError("Failed to read LDtk project: %s at byte %llu", what, (unsigned long long)(r->at - r->start));
+		r->failed = true;
+		r->at = r->end;
+	}
+	return false;
+}
+
+static void LdtkSkipWhitespace(LdtkReader* r)
+{
+	while (r->at < r->end && (*r->at == ' ' || *r->at == '\n' || *r->at == '\r' || *r->at == '\t'))
+	{
+		r->at += 1;
+	}
+}
+
+static bool LdtkExpect(LdtkReader* r, char c)
+{
+	LdtkSkipWhitespace(r);
+	if (r->at >= r->end || *r->at != c) return LdtkFail(r, "unexpected character");
+	r->at += 1;
+	return true;
+}
+
+// The returned string is still escaped. None of the strings the game compares against need
+// escaping, so it doesn't matter.
+static bool LdtkReadString(LdtkReader* r, LdtkString* out)
+{
+	if (!LdtkExpect(r, '"')) return false;
+	const char* str = r->at;
+	while (r->at < r->end && *r->at != '"')
+	{
+		r->at += *r->at == '\\' ? 2 : 1;
+	}
+	if (r->at >= r->end) return LdtkFail(r, "unterminated string");
+
+	*out = (LdtkString){str, (size_t)(r->at - str)};
+	r->at += 1;
+	return true;
+}
+
+static bool LdtkReadInt(LdtkReader* r, int32_t* out)
+{
+	LdtkSkipWhitespace(r);
+	const char* start = r->at;
+	bool negative = r->at < r->end && *r->at == '-';
+	if (negative) r->at += 1;
+
+	const char* digits = r->at;
+	int64_t val = 0;
+	while (r->at < r->end && (uint8_t)(*r->at - '0') < 10 && r->at - digits < 18)
+	{
+		val = val*10 + (*r->at - '0');
+		r->at += 1;
+	}
+	if (r->at == digits) return LdtkFail(r, "expected a number");
+
+	// Nothing the game reads has fractions or exponents in it, but it's still valid JSON, so
+	// those go through SDL_strtod and get truncated the same way cJSON_GetNumberValue would be.
+	if (r->at < r->end && (*r->at == '.' || *r->at == 'e' || *r->at == 'E' || (uint8_t)(*r->at - '0') < 10))
+	{
+		char num[64];
+		while (r->at < r->end && *r->at && SDL_strchr("0123456789+-.eE", *r->at) && r->at - start < (ssize_t)sizeof(num) - 1)
+		{
+			r->at += 1;
+		}
+		SDL_memcpy(num, start, (size_t)(r->at - start));
+		num[r->at - start] = 0;
+		double d = SDL_strtod(num, NULL);
+		*out = (int32_t)SDL_clamp(d, (double)SDL_MIN_SINT32, (double)SDL_MAX_SINT32);
+		return true;
+	}
+
+	val = negative ? -val : val;
+	*out = (int32_t)SDL_clamp(val, SDL_MIN_SINT32, SDL_MAX_SINT32);
+	return true;
+}
+
+/**
+ * Skips over a whole value, however deeply nested it is. This is where most of the time goes,
+ * since most of an LDtk project is stuff the game doesn't read, so it only looks at the
+ * characters that change the nesting depth.
+ */
+static bool LdtkSkipValue(LdtkReader* r)
+{
+	size_t depth = 0;
+	do
+	{
+		LdtkSkipWhitespace(r);
+		if (r->at >= r->end) return LdtkFail(r, "unexpected end of file");
+
+		switch (*r->at)
+		{
+		case '"':
+		{
+			LdtkString str;
+			if (!LdtkReadString(r, &str)) return false;
+		} break;
+		case '{':
+		case '[':
+		{
+			depth += 1;
+			r->at += 1;
+		} break;
+		case '}':
+		case ']':
+		{
+			if (depth == 0) return LdtkFail(r, "unexpected end of object or array");
+			depth -= 1;
+			r->at += 1;
+		} break;
+		case ',':
+		case ':':
+		{
+			if (depth == 0) return LdtkFail(r, "unexpected separator");
+			r->at += 1;
+		} break;
+		default:
+		{
+			// A number, true, false or null.
+			const char* start = r->at;
+			while (r->at < r->end &&
+				*r->at != ',' && *r->at != ':' && *r->at != ']' && *r->at != '}' &&
+				*r->at != ' ' && *r->at != '\n' && *r->at != '\r' && *r->at != '\t')
+			{
+				r->at += 1;
+			}
+			if (r->at == start) return LdtkFail(r, "unexpected character");
+		} break;
+		}
+	} while (depth > 0);
+
+	return true;
+}
+
+/**
+ * Used like this, which leaves r->failed set if the object was broken:
+ *
+ * LdtkString key;
+ * for (bool first = true; LdtkNextKey(r, &first, &key);) { ... read or skip the value ... }
+ */
+static bool LdtkNextKey(LdtkReader* r, bool* first, LdtkString* key)
+{
+	LdtkSkipWhitespace(r);
+	if (r->at < r->end && *r->at == '}')
+	{
+		r->at += 1;
+		return false;
+	}
+	if (!*first && !LdtkExpect(r, ',')) return false;
+	*first = false;
+	return LdtkReadString(r, key) && LdtkExpect(r, ':');
+}
+
+// Same as LdtkNextKey, except for arrays.
+static bool LdtkNextElement(LdtkReader* r, bool* first)
+{
+	LdtkSkipWhitespace(r);
+	if (r->at < r->end && *r->at == ']')
+	{
+		r->at += 1;
+		return false;
+	}
+	if (!*first && !LdtkExpect(r, ',')) return false;
+	*first = false;
+	return !r->failed;
+}
+
+// Returns where the next array will start, without reserving anything yet.
+static void* LdtkArrayStart(LdtkReader* r, size_t align)
+{
+	uintptr_t top = (uintptr_t)(r->buf + r->buf_used);
+	r->buf_used += (align - (top & (align - 1))) & (align - 1);
+	r->buf_used = SDL_min(r->buf_used, r->buf_len);
+	return r->buf + r->buf_used;
+}
+
+static void* LdtkPush(LdtkReader* r, size_t size)
+{
+	if (r->buf_len - r->buf_used < size)
+	{
+		LdtkFail(r, "out of memory");
+		return NULL;
+	}
+	void* res = r->buf + r->buf_used;
+	r->buf_used += size;
+	return res;
+}
+
+static bool LdtkReadIvec2(LdtkReader* r, ivec2s* out)
+{
+	return
+		LdtkExpect(r, '[') &&
+		LdtkReadInt(r, &out->x) && LdtkExpect(r, ',') &&
+		LdtkReadInt(r, &out->y) && LdtkExpect(r, ']');
+}
+
+static bool LdtkReadGridTiles(LdtkReader* r, LdtkLayer* layer)
+{
+	if (!LdtkExpect(r, '[')) return false;
+	layer->tiles = LdtkArrayStart(r, alignof(LdtkTile));
+	layer->num_tiles = 0;
+	for (bool first = true; LdtkNextElement(r, &first);)
+	{
+		LdtkTile* tile = LdtkPush(r, sizeof(LdtkTile));
+		if (!tile || !LdtkExpect(r, '{')) return false;
+		*tile = (LdtkTile){0};
+
+		LdtkString key;
+		for (bool first_key = true; LdtkNextKey(r, &first_key, &key);)
+		{
+			bool ok;
+			if (LDTK_STRING_IS(key, "px")) ok = LdtkReadIvec2(r, &tile->dst);
+			else if (LDTK_STRING_IS(key, "src")) ok = LdtkReadIvec2(r, &tile->src);
+			else ok = LdtkSkipValue(r);
+			if (!ok) return false;
+		}
+		layer->num_tiles += 1;
+	}
+	return !r->failed;
+}
+
+static bool LdtkReadEntityInstances(LdtkReader* r, LdtkLayer* layer)
+{
+	if (!LdtkExpect(r, '[')) return false;
+	layer->entities = LdtkArrayStart(r, alignof(LdtkEntity));
+	layer->num_entities = 0;
+	for (bool first = true; LdtkNextElement(r, &first);)
+	{
+		LdtkEntity* entity = LdtkPush(r, sizeof(LdtkEntity));
+		if (!entity || !LdtkExpect(r, '{')) return false;
+		*entity = (LdtkEntity){0};
+
+		LdtkString key;
+		for (bool first_key = true; LdtkNextKey(r, &first_key, &key);)
+		{
+			bool ok;
+			if (LDTK_STRING_IS(key, "__identifier")) ok = LdtkReadString(r, &entity->identifier);
+			else if (LDTK_STRING_IS(key, "__worldX")) ok = LdtkReadInt(r, &entity->world_pos.x);
+			else if (LDTK_STRING_IS(key, "__worldY")) ok = LdtkReadInt(r, &entity->world_pos.y);
+			else ok = LdtkSkipValue(r);
+			if (!ok) return false;
+		}
+		layer->num_entities += 1;
+	}
+	return !r->failed;
+}
+
+static bool LdtkReadIntGridCsv(LdtkReader* r, LdtkLayer* layer)
+{
+	if (!LdtkExpect(r, '[')) return false;
+	layer->int_grid = LdtkArrayStart(r, alignof(bool));
+	layer->num_int_grid = 0;
+	for (bool first = true; LdtkNextElement(r, &first);)
+	{
+		bool* val = LdtkPush(r, sizeof(bool));
+		int32_t i;
+		if (!val || !LdtkReadInt(r, &i)) return false;
+		*val = i != 0;
+		layer->num_int_grid += 1;
+	}
+	return !r->failed;
+}
+
+static bool LdtkReadLayerInstance(LdtkReader* r, LdtkLayer* layer)
+{
+	if (!LdtkExpect(r, '{')) return false;
+
+	LdtkString key;
+	for (bool first = true; LdtkNextKey(r, &first, &key);)
+	{
+		bool ok;
+		if (LDTK_STRING_IS(key, "__identifier")) ok = LdtkReadString(r, &layer->identifier);
+		else if (LDTK_STRING_IS(key, "__type")) ok = LdtkReadString(r, &layer->type);
+		else if (LDTK_STRING_IS(key, "gridTiles")) ok = LdtkReadGridTiles(r, layer);
+		else if (LDTK_STRING_IS(key, "entityInstances")) ok = LdtkReadEntityInstances(r, layer);
+		else if (LDTK_STRING_IS(key, "intGridCsv")) ok = LdtkReadIntGridCsv(r, layer);
+		else ok = LdtkSkipValue(r);
+		if (!ok) return false;
+	}
+	return !r->failed;
+}
+
+static bool LdtkReadLevelObject(LdtkReader* r, LdtkLevel* level)
+{
+	if (!LdtkExpect(r, '{')) return false;
+
+	LdtkString key;
+	for (bool first = true; LdtkNextKey(r, &first, &key);)
+	{
+		bool ok = true;
+		if (LDTK_STRING_IS(key, "identifier"))
+		{
+			ok = LdtkReadString(r, &level->identifier);
+		}
+		else if (LDTK_STRING_IS(key, "worldX"))
+		{
+			ok = LdtkReadInt(r, &level->world_pos.x);
+		}
+		else if (LDTK_STRING_IS(key, "worldY"))
+		{
+			ok = LdtkReadInt(r, &level->world_pos.y);
+		}
+		else if (LDTK_STRING_IS(key, "pxWid"))
+		{
+			ok = LdtkReadInt(r, &level->px_size.x);
+		}
+		else if (LDTK_STRING_IS(key, "pxHei"))
+		{
+			ok = LdtkReadInt(r, &level->px_size.y);
+		}
+		else if (LDTK_STRING_IS(key, "layerInstances"))
+		{
+			if (!LdtkExpect(r, '[')) return false;
+			for (bool first_layer = true; ok && LdtkNextElement(r, &first_layer);)
+			{
+				if (level->num_layers == LDTK_MAX_LAYERS) return LdtkFail(r, "too many layers");
+				ok = LdtkReadLayerInstance(r, &level->layers[level->num_layers++]);
+			}
+		}
+		else
+		{
+			ok = LdtkSkipValue(r);
+		}
+		if (!ok) return false;
+	}
+	return !r->failed;
+}
+
+// Returns false to stop reading. level and everything in it is only valid until it returns.
+typedef bool (*LdtkLevelFunc)(void* user_data, LdtkLevel* level);
+
+/**
+ * Calls func for every level of an LDtk project, in the order they're in the file. Every array 
+ * in a level ends up somewhere in buf, which gets reused for the next level. On failure, the 
+ * error can be retrieved with SDL_GetError.
+ */
+static bool LdtkReadLevels(const void* data, size_t data_size, void* buf, size_t buf_len, LdtkLevelFunc func, void* user_data)
+{
+	LdtkReader reader =
+	{
+		.start = data,
+		.at = data,
+		.end = (const char*)data + data_size,
+		.buf = buf,
+		.buf_len = buf_len,
+	};
+	LdtkReader* r = &reader;
+
+	if (!LdtkExpect(r, '{')) return false;
+	LdtkString key;
+	for (bool first = true; LdtkNextKey(r, &first, &key);)
+	{
+		if (LDTK_STRING_IS(key, "levels"))
+		{
+			if (!LdtkExpect(r, '[')) return false;
+			for (bool first_level = true; LdtkNextElement(r, &first_level);)
+			{
+				LdtkLevel level = {0};
+				r->buf_used = 0;
+				if (!LdtkReadLevelObject(r, &level)) return false;
+				level.buf_used = r->buf_used;
+				if (!func(user_data, &level)) return true;
+			}
+		}
+		else if (!LdtkSkipValue(r))
+		{
+			return false;
+		}
+	}
+	return !r->failed;
+}
+
+typedef struct LdtkFirstLevel
+{
+	LdtkLevel* level;
+	bool found;
+} LdtkFirstLevel;
+
+static bool LdtkCopyFirstLevel(void* user_data, LdtkLevel* level)
+{
+	LdtkFirstLevel* first = user_data;
+	*first->level = *level;
+	first->found = true;
+	return false;
+}
+
+/**
+ * Reads the first level of an LDtk project into level and stops there. out_buf_used is set to how
+ * much of buf it used, so that the caller can give back the rest.
+ */
+static bool LdtkReadLevel(LdtkLevel* level, const void* data, size_t data_size, void* buf, size_t buf_len, size_t* out_buf_used)
+{
+	*level = (LdtkLevel){0};
+	*out_buf_used = 0;
+
+	LdtkFirstLevel first = {level, false};
+	if (!LdtkReadLevels(data, data_size, buf, buf_len, LdtkCopyFirstLevel, &first)) return false;
+	if (!first.found) return SDL_SetError("Failed to read LDtk project: no levels");
+
+	*out_buf_used = level->buf_used;
+	return true;
+}
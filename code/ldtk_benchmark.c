@@ -0,0 +1,364 @@
+/**
+ * Reads the first level of an LDtk project with both LdtkReadLevel and cJSON, checks that they
+ * agree, and reports how fast each of them is and how many allocations cJSON needed.
+ *
+ * Usage: LdtkBenchmark [path or level size] [iterations]
+ * If the first argument is a number, a project is generated with a single level of that many by
+ * that many tiles, plus a second level and some definitions that have to be skipped. It defaults
+ * to 256, which comes out at about 17 MB. The number of iterations defaults to 10.
+ */
+
+#define TOGGLE_PROFILING 0
+
+#include "main.h"
+#include "ldtk.c"
+
+typedef struct BenchmarkText
+{
+	char* buf;
+	size_t len;
+	size_t cap;
+} BenchmarkText;
+
+static void Append(BenchmarkText* text, const char* fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	int32_t len = SDL_vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+	SDL_assert(len >= 0);
+
+	if (text->len + (size_t)len + 1 > text->cap)
+	{
+		text->cap = SDL_max(text->cap*2, text->len + (size_t)len + 1);
+		text->buf = SDL_realloc(text->buf, text->cap); SDL_CHECK(text->buf);
+	}
+
+	va_start(args, fmt);
+	SDL_vsnprintf(text->buf + text->len, text->cap - text->len, fmt, args);
+	va_end(args);
+	text->len += (size_t)len;
+}
+
+static void AppendTileLayer(BenchmarkText* text, const char* identifier, int32_t size, int32_t stride)
+{
+	Append(text, "\t\t\t\t{\n\t\t\t\t\t\"__identifier\": \"%s\",\n\t\t\t\t\t\"__type\": \"Tiles\",\n", identifier);
+	Append(text, "\t\t\t\t\t\"__cWid\": %d,\n\t\t\t\t\t\"__cHei\": %d,\n\t\t\t\t\t\"intGridCsv\": [],\n", size, size);
+	Append(text, "\t\t\t\t\t\"autoLayerTiles\": [],\n\t\t\t\t\t\"gridTiles\": [");
+	bool first = true;
+	for (int32_t y = 0; y < size; y += 1)
+	{
+		for (int32_t x = (y % stride); x < size; x += stride)
+		{
+			int32_t t = (x*7 + y*13) % 64;
+			Append(text, "%s\n\t\t\t\t\t\t{ \"px\": [%d,%d], \"src\": [%d,%d], \"f\": 0, \"t\": %d, \"d\": [%d], \"a\": 1 }",
+				first ? "" : ",", x*16, y*16, (t % 8)*16, (t/8)*16, t, x + y*size);
+			first = false;
+		}
+	}
+	Append(text, "\n\t\t\t\t\t],\n\t\t\t\t\t\"entityInstances\": []\n\t\t\t\t}");
+}
+
+static void AppendEntity(BenchmarkText* text, bool first, const char* identifier, int32_t x, int32_t y)
+{
+	Append(text, "%s\n\t\t\t\t\t\t{\n\t\t\t\t\t\t\t\"__identifier\": \"%s\",\n\t\t\t\t\t\t\t\"__grid\": [%d,%d],\n",
+		first ? "" : ",", identifier, x/16, y/16);
+	Append(text, "\t\t\t\t\t\t\t\"__tags\": [],\n\t\t\t\t\t\t\t\"px\": [%d,%d],\n", x, y);
+	Append(text, "\t\t\t\t\t\t\t\"fieldInstances\": [{ \"__identifier\": \"patrol\", \"__value\": [{ \"cx\": 1, \"cy\": 2 }, { \"cx\": 3, \"cy\": 4 }] }],\n");
+	Append(text, "\t\t\t\t\t\t\t\"__worldX\": %d,\n\t\t\t\t\t\t\t\"__worldY\": %d\n\t\t\t\t\t\t}", x, y);
+}
+
+/**
+ * Generates a project that looks like what LDtk writes: the same keys in the same order, tabs,
+ * one grid tile per line, and the 3 tile layers, 2 entity layers and IntGrid layer that the game
+ * expects. The second level is only there to be skipped.
+ */
+static void GenerateProject(BenchmarkText* text, int32_t size)
+{
+	Append(text, "{\n\t\"__header__\": { \"fileType\": \"LDtk Project JSON\", \"app\": \"LDtk\", \"doc\": \"https://ldtk.io/json\" },\n");
+	Append(text, "\t\"jsonVersion\": \"1.5.3\",\n\t\"defaultGridSize\": 16,\n\t\"defs\": {\n\t\t\"tilesets\": [{\n");
+	Append(text, "\t\t\t\"identifier\": \"Tiles\",\n\t\t\t\"relPath\": \"../sprites\\/tiles.aseprite\",\n\t\t\t\"enumTags\": [],\n\t\t\t\"cachedPixelData\": {\n\t\t\t\t\"opaqueTiles\": \"");
+	for (int32_t i = 0; i < 4096; i += 1)
+	{
+		Append(text, "%d", i & 1);
+	}
+	Append(text, "\",\n\t\t\t\t\"averageColors\": [");
+	for (int32_t i = 0; i < 4096; i += 1)
+	{
+		Append(text, "%s\"%04x\"", i ? "," : "", (i*2654435761u) & 0xFFFF);
+	}
+	Append(text, "]\n\t\t\t}\n\t\t}],\n\t\t\"enums\": [],\n\t\t\"externalEnums\": []\n\t},\n\t\"levels\": [");
+
+	for (int32_t level_idx = 0; level_idx < 2; level_idx += 1)
+	{
+		Append(text, "%s\n\t\t{\n\t\t\t\"identifier\": \"Level_%d\",\n\t\t\t\"worldX\": %d,\n\t\t\t\"worldY\": 0,\n",
+			level_idx ? "," : "", level_idx, level_idx*size*16);
+		Append(text, "\t\t\t\"pxWid\": %d,\n\t\t\t\"pxHei\": %d,\n\t\t\t\"__bgColor\": \"#40465B\",\n\t\t\t\"fieldInstances\": [],\n",
+			size*16, size*16);
+		Append(text, "\t\t\t\"layerInstances\": [\n");
+
+		Append(text, "\t\t\t\t{\n\t\t\t\t\t\"__identifier\": \"Player\",\n\t\t\t\t\t\"__type\": \"Entities\",\n");
+		Append(text, "\t\t\t\t\t\"intGridCsv\": [],\n\t\t\t\t\t\"gridTiles\": [],\n\t\t\t\t\t\"entityInstances\": [");
+		AppendEntity(text, true, "Player", 32, 32);
+		Append(text, "\n\t\t\t\t\t]\n\t\t\t\t},\n");
+
+		Append(text, "\t\t\t\t{\n\t\t\t\t\t\"__identifier\": \"Enemies\",\n\t\t\t\t\t\"__type\": \"Entities\",\n");
+		Append(text, "\t\t\t\t\t\"intGridCsv\": [],\n\t\t\t\t\t\"gridTiles\": [],\n\t\t\t\t\t\"entityInstances\": [");
+		for (int32_t enemy_idx = 0; enemy_idx < size; enemy_idx += 1)
+		{
+			AppendEntity(text, enemy_idx == 0, "Boar", (enemy_idx*37 % size)*16, (enemy_idx*11 % size)*16);
+		}
+		Append(text, "\n\t\t\t\t\t]\n\t\t\t\t},\n");
+
+		AppendTileLayer(text, "Grass", size, 4);
+		Append(text, ",\n");
+		AppendTileLayer(text, "Props", size, 3);
+		Append(text, ",\n");
+		AppendTileLayer(text, "Tiles", size, 1);
+		Append(text, ",\n");
+
+		Append(text, "\t\t\t\t{\n\t\t\t\t\t\"__identifier\": \"IntGrid\",\n\t\t\t\t\t\"__type\": \"IntGrid\",\n\t\t\t\t\t\"intGridCsv\": [");
+		for (int32_t y = 0; y < size; y += 1)
+		{
+			Append(text, "\n\t\t\t\t\t\t");
+			for (int32_t x = 0; x < size; x += 1)
+			{
+				Append(text, "%s%d", x + y ? "," : "", (x == 0 || y == size - 1 || (x*y) % 17 == 0) ? 1 : 0);
+			}
+		}
+		Append(text, "\n\t\t\t\t\t],\n\t\t\t\t\t\"autoLayerTiles\": [],\n\t\t\t\t\t\"gridTiles\": [],\n\t\t\t\t\t\"entityInstances\": []\n\t\t\t\t}\n");
+
+		Append(text, "\t\t\t],\n\t\t\t\"__neighbours\": []\n\t\t}");
+	}
+
+	Append(text, "\n\t],\n\t\"worlds\": []\n}\n");
+}
+
+static size_t num_cjson_allocs;
+
+static void* CountingMalloc(size_t size)
+{
+	num_cjson_allocs += 1;
+	return SDL_malloc(size);
+}
+
+static LdtkString GetCJSONString(cJSON* node, const char* name)
+{
+	char* str = cJSON_GetStringValue(cJSON_GetObjectItem(node, name));
+	return str ? (LdtkString){str, SDL_strlen(str)} : (LdtkString){0};
+}
+
+static ivec2s GetCJSONIvec2(cJSON* node, const char* name)
+{
+	cJSON* arr = cJSON_GetObjectItem(node, name);
+	return (ivec2s){(int32_t)cJSON_GetNumberValue(arr->child), (int32_t)cJSON_GetNumberValue(arr->child->next)};
+}
+
+/**
+ * Does the same thing as LdtkReadLevel, the same way ParseLevelLdtk used to: parse the whole
+ * project with cJSON, then walk the tree. The result is written into buf the same way, except
+ * that the strings point into the tree, which is why the caller deletes it afterwards.
+ */
+static cJSON* ReadLevelCJSON(LdtkLevel* level, const void* data, size_t data_size, void* buf, size_t buf_len)
+{
+	*level = (LdtkLevel){0};
+	cJSON* head = cJSON_ParseWithLength((const char*)data, data_size);
+	SDL_assert(head);
+
+	uint8_t* buf_top = buf;
+	uint8_t* buf_end = buf_top + buf_len;
+	cJSON* level_node = cJSON_GetObjectItem(head, "levels")->child;
+	level->px_size.x = (int32_t)cJSON_GetNumberValue(cJSON_GetObjectItem(level_node, "pxWid"));
+	level->px_size.y = (int32_t)cJSON_GetNumberValue(cJSON_GetObjectItem(level_node, "pxHei"));
+
+	cJSON* layer_node;
+	cJSON_ArrayForEach(layer_node, cJSON_GetObjectItem(level_node, "layerInstances"))
+	{
+		SDL_assert(level->num_layers < LDTK_MAX_LAYERS);
+		LdtkLayer* layer = &level->layers[level->num_layers++];
+		layer->identifier = GetCJSONString(layer_node, "__identifier");
+		layer->type = GetCJSONString(layer_node, "__type");
+
+		cJSON* grid_tiles = cJSON_GetObjectItem(layer_node, "gridTiles");
+		layer->num_tiles = (size_t)cJSON_GetArraySize(grid_tiles);
+		layer->tiles = (LdtkTile*)buf_top;
+		buf_top += layer->num_tiles*sizeof(LdtkTile); SDL_assert(buf_top <= buf_end);
+		size_t tile_idx = 0;
+		cJSON* node;
+		cJSON_ArrayForEach(node, grid_tiles)
+		{
+			layer->tiles[tile_idx++] = (LdtkTile){GetCJSONIvec2(node, "src"), GetCJSONIvec2(node, "px")};
+		}
+
+		cJSON* entity_instances = cJSON_GetObjectItem(layer_node, "entityInstances");
+		layer->num_entities = (size_t)cJSON_GetArraySize(entity_instances);
+		layer->entities = (LdtkEntity*)buf_top;
+		buf_top += layer->num_entities*sizeof(LdtkEntity); SDL_assert(buf_top <= buf_end);
+		size_t entity_idx = 0;
+		cJSON_ArrayForEach(node, entity_instances)
+		{
+			layer->entities[entity_idx++] = (LdtkEntity)
+			{
+				.identifier = GetCJSONString(node, "__identifier"),
+				.world_pos.x = (int32_t)cJSON_GetNumberValue(cJSON_GetObjectItem(node, "__worldX")),
+				.world_pos.y = (int32_t)cJSON_GetNumberValue(cJSON_GetObjectItem(node, "__worldY")),
+			};
+		}
+
+		cJSON* int_grid_csv = cJSON_GetObjectItem(layer_node, "intGridCsv");
+		layer->num_int_grid = (size_t)cJSON_GetArraySize(int_grid_csv);
+		layer->int_grid = (bool*)buf_top;
+		buf_top += layer->num_int_grid; SDL_assert(buf_top <= buf_end);
+		size_t int_grid_idx = 0;
+		cJSON_ArrayForEach(node, int_grid_csv)
+		{
+			layer->int_grid[int_grid_idx++] = (bool)cJSON_GetNumberValue(node);
+		}
+
+		// Keep the next layer's tiles aligned.
+		buf_top = (uint8_t*)SDL_min(((uintptr_t)buf_top + 7) & ~(uintptr_t)7, (uintptr_t)buf_end);
+	}
+
+	return head;
+}
+
+static bool LdtkStringsEqual(LdtkString a, LdtkString b)
+{
+	return a.len == b.len && SDL_memcmp(a.str, b.str, a.len) == 0;
+}
+
+static bool LevelsEqual(LdtkLevel* a, LdtkLevel* b)
+{
+	if (a->px_size.x != b->px_size.x || a->px_size.y != b->px_size.y || a->num_layers != b->num_layers) return false;
+	for (size_t layer_idx = 0; layer_idx < a->num_layers; layer_idx += 1)
+	{
+		LdtkLayer* la = &a->layers[layer_idx];
+		LdtkLayer* lb = &b->layers[layer_idx];
+		if (!LdtkStringsEqual(la->identifier, lb->identifier) || !LdtkStringsEqual(la->type, lb->type)) return false;
+		if (la->num_tiles != lb->num_tiles || la->num_entities != lb->num_entities || la->num_int_grid != lb->num_int_grid) return false;
+		if (la->num_tiles > 0 && SDL_memcmp(la->tiles, lb->tiles, la->num_tiles*sizeof(LdtkTile)) != 0) return false;
+		if (la->num_int_grid > 0 && SDL_memcmp(la->int_grid, lb->int_grid, la->num_int_grid) != 0) return false;
+		for (size_t entity_idx = 0; entity_idx < la->num_entities; entity_idx += 1)
+		{
+			LdtkEntity* ea = &la->entities[entity_idx];
+			LdtkEntity* eb = &lb->entities[entity_idx];
+			if (!LdtkStringsEqual(ea->identifier, eb->identifier)) return false;
+			if (ea->world_pos.x != eb->world_pos.x || ea->world_pos.y != eb->world_pos.y) return false;
+		}
+	}
+	return true;
+}
+
+int32_t main(int32_t argc, char* argv[])
+{
+	const char* arg = argc > 1 ? argv[1] : "256";
+	size_t num_iterations = argc > 2 ? (size_t)SDL_strtoul(argv[2], NULL, 10) : 10;
+	num_iterations = SDL_max(num_iterations, (size_t)1);
+
+	SDL_CHECK(SDL_Init(0));
+
+	void* data;
+	size_t data_size;
+
+	// LoadProject
+	{
+		char* arg_end;
+		long size = SDL_strtol(arg, &arg_end, 10);
+		if (*arg_end == 0 && size > 0)
+		{
+			BenchmarkText text = {0};
+			GenerateProject(&text, (int32_t)size);
+			data = text.buf;
+			data_size = text.len;
+			SDL_Log("Generated a project with a %ldx%ld level", size, size);
+		}
+		else
+		{
+			data = SDL_LoadFile(arg, &data_size);
+			if (!data)
+			{
+				SDL_Log("Failed to load %s: %s", arg, SDL_GetError());
+				SDL_Quit();
+				return 1;
+			}
+		}
+	}
+	SDL_Log("%.2f MB of JSON", (double)data_size/(1024.0*1024.0));
+
+	// The output can't be bigger than the input, since every tile, entity and IntGrid value takes
+	// up more bytes of JSON than it does once it's been read.
+	size_t buf_len = data_size + 4096;
+	uint8_t* expected_buf = SDL_malloc(buf_len); SDL_CHECK(expected_buf);
+	uint8_t* actual_buf = SDL_malloc(buf_len); SDL_CHECK(actual_buf);
+
+	// Validate
+	bool match;
+	{
+		cJSON_Hooks hooks = {CountingMalloc, SDL_free};
+		cJSON_InitHooks(&hooks);
+
+		LdtkLevel expected;
+		num_cjson_allocs = 0;
+		cJSON* head = ReadLevelCJSON(&expected, data, data_size, expected_buf, buf_len);
+
+		LdtkLevel actual;
+		size_t buf_used;
+		bool read = LdtkReadLevel(&actual, data, data_size, actual_buf, buf_len, &buf_used);
+		if (!read) SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s", SDL_GetError());
+
+		match = read && LevelsEqual(&expected, &actual);
+		size_t num_tiles = 0, num_entities = 0;
+		for (size_t layer_idx = 0; layer_idx < expected.num_layers; layer_idx += 1)
+		{
+			num_tiles += expected.layers[layer_idx].num_tiles;
+			num_entities += expected.layers[layer_idx].num_entities;
+		}
+		SDL_Log("%llu layers, %llu tiles, %llu entities, %.2f MB read",
+			expected.num_layers, num_tiles, num_entities, (double)buf_used/(1024.0*1024.0));
+		SDL_Log("cJSON: %llu allocations per parse", num_cjson_allocs);
+		if (match)
+		{
+			SDL_Log("Both readers agree.");
+		}
+		else
+		{
+			SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "LdtkReadLevel doesn't match cJSON.");
+		}
+
+		cJSON_Delete(head);
+		cJSON_InitHooks(NULL);
+	}
+
+	// Benchmark
+	{
+		uint64_t start = SDL_GetPerformanceCounter();
+		for (size_t iteration = 0; iteration < num_iterations; iteration += 1)
+		{
+			LdtkLevel level;
+			cJSON_Delete(ReadLevelCJSON(&level, data, data_size, expected_buf, buf_len));
+		}
+		uint64_t end = SDL_GetPerformanceCounter();
+		double cjson_seconds = (double)(end - start)/(double)SDL_GetPerformanceFrequency()/(double)num_iterations;
+
+		start = SDL_GetPerformanceCounter();
+		for (size_t iteration = 0; iteration < num_iterations; iteration += 1)
+		{
+			LdtkLevel level;
+			size_t buf_used;
+			LdtkReadLevel(&level, data, data_size, actual_buf, buf_len, &buf_used);
+		}
+		end = SDL_GetPerformanceCounter();
+		double seconds = (double)(end - start)/(double)SDL_GetPerformanceFrequency()/(double)num_iterations;
+
+		double mb = (double)data_size/(1024.0*1024.0);
+		SDL_Log("cJSON:         %8.2f ms, %7.1f MB/s", cjson_seconds*1000.0, mb/cjson_seconds);
+		SDL_Log("LdtkReadLevel: %8.2f ms, %7.1f MB/s (%.2fx)", seconds*1000.0, mb/seconds, cjson_seconds/seconds);
+	}
+
+	SDL_free(actual_buf);
+	SDL_free(expected_buf);
+	SDL_free(data);
+	SDL_Quit();
+
+	return match ? 0 : 1;
+}
@@ -2,11 +2,13 @@
 
 #include "main.h"
 #include "aseprite.h"
+#include "bake.h"
 
 #define TOGGLE_FULLSCREEN 1
 #define TOGGLE_REPLAY_FRAMES 0
 #define TOGGLE_TESTS 0
 #define TOGGLE_VULKAN_VALIDATION 0
+#define TOGGLE_GPU_ENTITIES 0
 
 #define GAMEPAD_THRESHOLD 0.1f
 
@@ -22,6 +24,10 @@
 #define TILE_SIZE 16
 #define GRAVITY 0.2f
 
+#define TICK_RATE 60 // per second, no matter the refresh rate of the display
+#define TICK_NS ((uint64_t)SDL_NS_PER_SECOND/TICK_RATE)
+#define MAX_TICKS_PER_FRAME 4 // past this, a slow frame slows the game down rather than piling up ticks
+
 #define MAX_SPRITES 256
 
 typedef struct Rect 
@@ -30,14 +36,51 @@ typedef struct Rect
 	ivec2s max;
 } Rect;
 
+typedef struct MappedFile
+{
+	void* data;
+	size_t size;
+} MappedFile;
+
+typedef uint32_t SpriteFormat;
+enum
+{
+	SpriteFormat_RGBA, // one uint32_t per pixel
+	SpriteFormat_Indexed, // one uint8_t per pixel, which indexes into SpriteDesc::palette
+	SpriteFormat_Count,
+};
+
 typedef struct SpriteCell 
 {
-	void* dst_buf; // invalid after VulkanCreateStaticStagingBuffer.
+	// Points into Context::sprite_pixels or, for baked sprites, into SpriteDesc::bake. NULL once the
+	// cell has been streamed to the GPU (see VulkanStreamSpriteCells).
+	void* dst_buf;
+
+	// The compressed pixels inside of the mapped .aseprite file. Only valid while loading.
+	const void* src_buf;
+	size_t src_buf_size;
 
 	ivec2s origin;
 	ivec2s size;
 	int32_t z_idx;
 	uint32_t layer_idx;
+	SpriteFormat format; // always the same as the format of the sprite
+
+	// XXH3 of the pixels in dst_buf.
+	uint64_t hash;
+
+	// Set if this cell has exactly the same pixels as another one, either because it's an
+	// Aseprite linked cell or because the pixels just happen to match. A duplicate has no
+	// dst_buf of its own, and it shares its place in the atlas with dup, which is never itself a
+	// duplicate by the time PackSpriteAtlas is done.
+	struct SpriteCell* dup;
+
+	// Set by PackSpriteAtlas. trim is the part of the cell that isn't fully transparent, relative
+	// to the cell itself, and it's the only part that makes it into the atlas for its format: 
+	// trim.min ends up at atlas_pos on layer atlas_page.
+	Rect trim;
+	ivec2s atlas_pos;
+	uint32_t atlas_page;
 } SpriteCell;
 
 typedef struct SpriteFrame 
@@ -47,22 +90,22 @@ typedef struct SpriteFrame
 	 * things. In Aseprite, a sprite is made up of an array of frames, and each frame is made up 
 	 * of an array of cells. Each cell contains its own compressed image data, which is what 
 	 * SpriteCell::dst_buf stores. When it comes time to actually render the sprite, we render 
-	 * each cell as its own texture. This is actually plenty fast, because we don't store a 
-	 * different texture for each cell; instead, we make each sprite have one texture array, 
-	 * where each cell is one element of the texture array.
+	 * each cell as its own quad. This is actually plenty fast, because we don't store a 
+	 * different texture for each cell; instead, every cell of every sprite gets trimmed and
+	 * packed into one shared atlas (see PackSpriteAtlas), so drawing a cell is just a matter of
+	 * pointing a quad at the right rectangle of it.
 	 * 
-	 * Now, you might ask: but why not merge the image data from each cell into one image before 
-	 * uploading to the GPU? That way, you don't have to render each cell separately, every single 
-	 * time; instead, you just do it all on the CPU beforehand. I'm sure this would be faster, but 
-	 * it would also be more complicated and less flexible. What if I wanted to apply a shader to 
-	 * just one cell? For example, a fire effect to just the player's sword. As it stands, this 
-	 * would be pretty trivial.
+	 * Sprites that are loaded with SpriteLoadRequest::flatten, which is every player and boar 
+	 * sprite, get the cells of each frame merged into one at load time (see FlattenSpriteFrames),
+	 * so those frames only ever have one cell and cost one quad to draw. Sprites that aren't, like 
+	 * the tiles, keep their cells as Aseprite has them. That's what you would want if you wanted 
+	 * to do something with just one cell, for example a fire effect on just the player's sword.
 	 */
 	SpriteCell* cells; size_t num_cells;
 
 	/**
 	 * Not every frame necessarily has a hitbox. If it exists, it is literally drawn inside of
-	 * Aseprite in a layer called "Hitbox". See GetEntityHitbox to find out how a hitbox is
+	 * Aseprite in a layer called "Hitbox". See BuildSpriteHitboxes to find out how a hitbox is
 	 * selected for an entity.
 	 */
 	Rect hitbox;
@@ -80,13 +123,38 @@ typedef struct SpriteDesc
 	ivec2s origin;
 	ivec2s size;
 	SpriteFrame* frames; size_t num_frames;
-	
-	VkImage vk_image;
-	VkImageView vk_image_view;
-	size_t vk_image_array_layers;
-	VkDescriptorSet vk_descriptor_set;
+
+	// Resolved by BuildSpriteHitboxes, relative to the origin. Look them up with GetFrameHitbox.
+	// NULL if no frame has a hitbox.
+	Rect* hitboxes; // [frame_idx*2 + (dir == -1)]
+
+	// Only for SpriteFormat_Indexed. Colors are packed the same way as RGBA pixels, and whichever
+	// color Aseprite considers transparent has an alpha of 0 no matter what the file says.
+	SpriteFormat format;
+	uint32_t* palette; size_t num_colors;
+	uint8_t transparent_idx;
+	size_t palette_idx; // which row of the palette texture this sprite's palette lives in
+
+	// Only mapped if the sprite was loaded from the bake cache. Unmapped by VulkanStreamSpriteCells
+	// once every cell has been streamed to the GPU.
+	MappedFile bake;
 } SpriteDesc;
 
+#define ATLAS_MIN_PAGE_SIZE 256
+#define ATLAS_MAX_PAGE_SIZE 2048
+#define ATLAS_PADDING 1 // transparent texels to the right of and below every cell
+
+#define PALETTE_SIZE 256 // colors per row of the palette texture
+
+// There's one of these for each SpriteFormat.
+typedef struct SpriteAtlas
+{
+	int32_t page_size; // every page is page_size*page_size texels
+	size_t num_pages; // one array layer per page
+	size_t num_cells; // not counting duplicates, which share a place with another cell
+	size_t num_dups;
+} SpriteAtlas;
+
 typedef struct Sprite 
 {
 	size_t idx;
@@ -105,6 +173,7 @@ enum
 {
 	EntityType_Player,
 	EntityType_Boar,
+	EntityType_Count,
 };
 
 typedef uint32_t EntityState;
@@ -121,8 +190,10 @@ enum
 
 typedef struct Instance 
 {
-	Rect rect;
-	int32_t anim_frame_idx;
+	Rect rect; // on screen
+	Rect src; // in atlas texels. min.x > max.x when the cell is flipped.
+	int32_t atlas_page;
+	int32_t palette; // row of the palette texture, or -1 if the cell lives in the RGBA atlas
 } Instance;
 
 typedef struct Entity 
@@ -130,6 +201,7 @@ typedef struct Entity
 	Anim anim;
 
 	ivec2s pos;
+	ivec2s prev_pos; // pos before the last tick, which frames get drawn in between of
 	ivec2s start_pos;
 	vec2s pos_remainder;
 	vec2s vel;
@@ -145,27 +217,144 @@ typedef struct Tile
 	ivec2s dst;
 } Tile;
 
-typedef struct TileLayer 
+typedef uint32_t LevelState;
+enum
+{
+	LevelState_Unloaded,
+	LevelState_Loading, // waiting for the world streamer
+	LevelState_Resident, // can be collided with, and drawn once its tiles have been uploaded
+};
+
+/**
+ * One bit per tile, set if the tile is solid. The grid is stored twice, once row by row and once
+ * column by column, so that a span of tiles in either direction is only ever a few masked words.
+ * Rows and columns are padded with zeros up to a whole word. See FindSolidInSpan.
+ */
+typedef struct CollisionGrid
 {
-	Tile* tiles;
-	size_t num_tiles;
-} TileLayer;
+	uint64_t* rows; size_t row_stride; // row y starts at rows[y*row_stride]
+	uint64_t* cols; size_t col_stride; // column x starts at cols[x*col_stride]
+} CollisionGrid;
 
 typedef struct Level 
 {
+	ivec2s pos; // in pixels, relative to the world
 	ivec2s size; // measured in tiles, not pixels
 
-	// NOTE: entities[0] is always the player.
-	Entity* entities; size_t num_entities;
+	// Both point into World::bake.
+	const Tile* bake_tiles; size_t num_tiles;
+	const uint8_t* bake_collision;
 
-	TileLayer* tile_layers; size_t num_tile_layers;
-	bool* tiles; // num_tiles = size.x*size.y
+	LevelState state;
+	size_t slot_idx; // only meaningful while the level isn't unloaded
+	CollisionGrid* collision; // NULL unless the level is resident
 } Level;
 
+#define WORLD_MAX_RESIDENT_LEVELS 9
+#define WORLD_LOAD_DISTANCE 1024 // pixels between the player and a level before it gets loaded
+#define WORLD_EVICT_DISTANCE 2048 // pixels between the player and a level before it gets evicted
+
+// Room for one resident level. Every slot is big enough for the biggest level in the world.
+typedef struct LevelSlot
+{
+	Level* level; // NULL if the slot is free
+	CollisionGrid collision; // room for World::max_collision_words
+	Tile* staging_tiles; // room for World::max_tiles_per_level, in Vulkan::world_staging_buffer
+
+	bool loaded; // set by the world streamer once collision and staging_tiles are filled in
+	bool needs_upload;
+	uint64_t reusable_frame; // Vulkan::frame_count from which staging_tiles are no longer read by the GPU
+} LevelSlot;
+
+#define BOAR_JOB_SIZE 1024 // fixed, so that how boars are split up doesn't depend on the number of threads
+
+#define ENTITY_GRID_CELL_SIZE (4*TILE_SIZE) // in pixels
+#define ENTITY_GRID_NUM_BUCKETS 4096 // must be a power of 2
+
+/**
+ * A spatial hash of every active entity, rebuilt at the start of each tick by RebuildEntityGrid.
+ * The world is split into cells of ENTITY_GRID_CELL_SIZE pixels, and each cell hashes into a
+ * bucket that lists the entities overlapping it, so finding what overlaps a rectangle only ever
+ * looks at the entities near it. See QueryEntityGrid.
+ */
+typedef struct EntityGrid
+{
+	// Bucket i is entries[bucket_starts[i]] up to entries[bucket_starts[i+1]].
+	uint32_t bucket_starts[ENTITY_GRID_NUM_BUCKETS + 1];
+	uint32_t* entries; size_t num_entries; size_t cap_entries; // indices into World::enemies
+
+	Rect* rects; // EntityStore::count of them, as of the last rebuild
+	uint32_t* query_marks; // EntityStore::count of them, so that a query never returns an entity twice
+	uint32_t query_mark;
+} EntityGrid;
+
+/**
+ * Entities as a structure of arrays, sorted by type, so that each type gets updated by its own
+ * loops over contiguous memory instead of one entity at a time (see UpdateBoars). Hot fields are 
+ * the ones every update touches, and are split into one array per component so that those loops 
+ * can be vectorized. Every array lives in one block, so copying the block copies every entity.
+ * 
+ * GetStoreEntity puts an entity back together for code that only ever looks at one at a time.
+ */
+typedef struct EntityStore
+{
+	size_t count;
+	size_t type_starts[EntityType_Count + 1]; // entities of type t are type_starts[t] up to type_starts[t+1]
+
+	// Hot
+	int32_t* pos_x; int32_t* pos_y;
+	float* vel_x; float* vel_y;
+	float* pos_remainder_x; float* pos_remainder_y;
+	EntityState* state;
+	float* anim_dt_accumulator;
+	uint32_t* anim_frame_idx;
+
+	// Cold
+	Sprite* anim_sprite;
+	bool* anim_ended;
+	int32_t* dir;
+	ivec2s* prev_pos;
+	ivec2s* start_pos;
+
+	void* block; size_t block_size;
+} EntityStore;
+
+/**
+ * Every level of the LDtk project, of which only the ones near the player are resident. See 
+ * UpdateWorld.
+ */
+typedef struct World
+{
+	Level* levels; size_t num_levels;
+
+	Entity player;
+	EntityStore enemies;
+	EntityGrid entity_grid; // of enemies
+
+	Rect bounds; // in pixels, around every level
+	size_t max_tiles_per_level;
+	size_t max_collision_words; // per level
+
+	LevelSlot slots[WORLD_MAX_RESIDENT_LEVELS];
+
+	// The world streamer is one thread that fills in slots, so that loading a level never holds up
+	// a frame. Everything below is protected by mutex.
+	SDL_Thread* streamer;
+	SDL_Mutex* mutex;
+	SDL_Condition* requests_available;
+	SDL_Condition* level_loaded;
+	size_t requests[WORLD_MAX_RESIDENT_LEVELS]; size_t num_requests; // slot indices
+	bool quit; // set once the game exits, see DestroyWorldStreamer
+
+	MappedFile bake;
+	void* bake_buf; // only set if the bake couldn't be written, in which case bake points at it
+} World;
+
 #if TOGGLE_REPLAY_FRAMES
 typedef struct ReplayFrame 
 {
-	Entity* entities; size_t num_entities;
+	Entity player;
+	void* enemies; // a copy of EntityStore::block
 } ReplayFrame;
 #endif // TOGGLE_REPLAY_FRAMES
 
@@ -187,16 +376,55 @@ typedef struct StackAllocHeader
 	size_t padding;
 } StackAllocHeader;
 
+#define JOB_THREAD_MEMORY_SIZE (1024ULL * 1024ULL * 8ULL)
+
+typedef struct JobPool JobPool;
+
+typedef struct JobThread
+{
+	SDL_Thread* handle; // NULL for thread 0, which is whoever calls RunJobs.
+	JobPool* pool;
+	size_t idx;
+
+	// Per-thread replacements for ctx->arena and ctx->stack. Whoever runs the jobs decides when
+	// to reset them (see ResetJobArenas).
+	Arena arena;
+	Stack stack;
+} JobThread;
+
+typedef void (*JobFunc)(void* user_data, size_t job_idx, JobThread* thread);
+
+struct JobPool
+{
+	JobThread* threads; size_t num_threads;
+
+	SDL_Mutex* mutex;
+	SDL_Condition* jobs_available;
+	SDL_Condition* jobs_done;
+	uint64_t generation;
+	size_t num_active_workers;
+	bool quit; // see DestroyJobPool
+
+	JobFunc func;
+	void* user_data;
+	size_t num_jobs;
+	SDL_AtomicInt next_job;
+	SDL_AtomicInt num_jobs_done;
+};
+
 typedef struct VulkanFrame 
 {
 	VkCommandBuffer command_buffer;
 	VkSemaphore sem_image_available;
 	VkSemaphore sem_render_finished;
 	VkFence fence_in_flight;
+	size_t upload_ring_head; // Vulkan::upload_ring_head as of when this frame was submitted
 } VulkanFrame;
 
 #define PIPELINE_COUNT 2
 
+#define UPLOAD_RING_SIZE (8*1024*1024)
+
 #if SDL_ASSERT_LEVEL >= 2
 typedef enum VulkanBufferMode
 {
@@ -206,26 +434,131 @@ typedef enum VulkanBufferMode
 } VulkanBufferMode;
 #endif
 
+#define VULKAN_MEMORY_BLOCK_SIZE (64ULL*1024ULL*1024ULL) // heaps of 1 GB or less get blocks of an eighth of the heap instead
+#define VULKAN_MAX_MEMORY_BLOCKS 32
+#define VULKAN_MAX_FREE_RANGES 64 // per VulkanAllocStrategy_FreeList block
+
+typedef uint32_t VulkanMemoryCategory;
+enum 
+{
+	VulkanMemoryCategory_Staging,
+	VulkanMemoryCategory_Vertex,
+	VulkanMemoryCategory_Uniform,
+	VulkanMemoryCategory_Storage,
+	VulkanMemoryCategory_Indirect,
+	VulkanMemoryCategory_Image,
+	VulkanMemoryCategory_Count,
+};
+
+typedef uint32_t VulkanAllocStrategy;
+enum 
+{
+	VulkanAllocStrategy_Linear, // bumps an offset, and only gets its space back once everything in the block has been freed
+	VulkanAllocStrategy_FreeList, // first fit, for whatever gets freed while the game runs
+	VulkanAllocStrategy_Count,
+};
+
+typedef struct VulkanFreeRange
+{
+	VkDeviceSize offset;
+	VkDeviceSize size;
+} VulkanFreeRange;
+
+/*
+One vkAllocateMemory, suballocated by VulkanAllocateMemory. A block of a HOST_VISIBLE memory type 
+stays mapped for as long as it lives, since a VkDeviceMemory can't be mapped twice at once and 
+several buffers share it.
+*/
+typedef struct VulkanMemoryBlock
+{
+	VkDeviceMemory memory; // VK_NULL_HANDLE if this slot of Vulkan::memory_blocks is unused
+	VkDeviceSize size;
+	uint32_t memory_type_idx;
+	VulkanAllocStrategy strategy;
+	void* mapped_memory;
+	VkDeviceSize used; // VulkanAllocStrategy_Linear: offset of the next allocation
+	VkDeviceSize allocated; // bytes handed out and not yet freed
+	size_t num_allocations;
+	VulkanFreeRange free_ranges[VULKAN_MAX_FREE_RANGES]; size_t num_free_ranges; // VulkanAllocStrategy_FreeList: sorted by offset, never adjacent
+} VulkanMemoryBlock;
+
+typedef struct VulkanAllocation
+{
+	uint32_t block_idx; // in Vulkan::memory_blocks
+	VkDeviceSize offset; // in the block
+	VkDeviceSize size; // 0 if nothing is allocated
+	VulkanMemoryCategory category;
+} VulkanAllocation;
+
 typedef struct VulkanBuffer 
 {
 	VkBuffer handle;
 	VkDeviceSize size;
 	VkDeviceSize offset;
 	VkDeviceSize start;
-	VkDeviceMemory memory;
+	VulkanAllocation allocation;
 	void* mapped_memory;
 #if SDL_ASSERT_LEVEL >= 2
 	VulkanBufferMode mode;
 #endif
 } VulkanBuffer;
 
+// Laid out so that it matches std140 without any padding.
 typedef struct Uniforms
 {
 	ivec2s viewport_size;
-	ivec2s tileset_size;
+	ivec2s tileset_pos; // where texel (0, 0) of the tileset would be in its atlas
+	int32_t tileset_page;
+	int32_t tileset_palette; // same as Instance::palette
 	int32_t tile_size;
 } Uniforms;
 
+// The rest are laid out so that they match std430 in entity.comp without any padding. 
+
+// What entity.comp needs to know about an entity to expand it into instances.
+typedef struct GpuEntity
+{
+	ivec2s pos;
+	ivec2s prev_pos;
+	uint32_t sprite;
+	uint32_t frame_idx;
+	int32_t dir;
+	int32_t active; // 0 for EntityState_Inactive
+} GpuEntity;
+
+typedef struct GpuSprite
+{
+	ivec2s origin;
+	ivec2s size;
+	uint32_t first_frame; // into the frames of the sprite table
+	int32_t palette; // same as Instance::palette
+} GpuSprite;
+
+typedef struct GpuSpriteFrame
+{
+	uint32_t first_cell; // into the cells of the sprite table
+	uint32_t num_cells;
+} GpuSpriteFrame;
+
+typedef struct GpuSpriteCell
+{
+	ivec2s pos; // origin + trim.min, relative to the sprite
+	ivec2s size; // of the trim
+	ivec2s atlas_pos;
+	int32_t atlas_page;
+	int32_t padding;
+} GpuSpriteCell;
+
+typedef struct GpuEntityPushConstants
+{
+	uint32_t num_entities;
+	uint32_t first_entity; // of this frame, in Vulkan::entity_buffer
+	uint32_t first_instance; // of this frame, in Vulkan::instance_buffer
+	uint32_t draw_idx; // of this frame, in Vulkan::draw_buffer
+	uint32_t max_cells_per_entity;
+	float alpha; // see InterpolatePos
+} GpuEntityPushConstants;
+
 typedef struct Vulkan 
 {
 	VkInstance instance;
@@ -257,11 +590,13 @@ typedef struct Vulkan
 	size_t num_swapchain_images;
 
 	VkDescriptorSetLayout descriptor_set_layout_uniforms;
-	VkDescriptorSetLayout descriptor_set_layout_sprites;
+	VkDescriptorSetLayout descriptor_set_layout_atlas;
 	VkPipelineLayout pipeline_layout;
 	VkDescriptorSet descriptor_set_uniforms;
+	VkDescriptorSet descriptor_set_atlas;
 	VkPipeline pipelines[PIPELINE_COUNT];
 	VkPipelineCache pipeline_cache;
+	bool pipeline_cache_warm; // loaded from PIPELINE_CACHE_PATH
 	VkRenderPass render_pass;
 	VkSampler sampler;
 
@@ -271,27 +606,80 @@ typedef struct Vulkan
 
 	VulkanFrame* frames; size_t num_frames;
 	size_t current_frame;
+	uint64_t frame_count; // frames submitted so far
 
 	/*
 	Memory layout:
-		uint32_t raw_image_data[][dst_buf_size];
+		uint32_t palettes[num_palettes][PALETTE_SIZE];
 		Uniforms uniforms;
-		Tile tiles[];
 	*/
 	VulkanBuffer static_staging_buffer;
+
+	/*
+	Memory layout:
+		uint8_t rows[upload_ring.size]; // trimmed rows of cells on their way into the atlases
+	Stays mapped until every cell has been streamed, and gets destroyed right after that. See 
+	VulkanStreamSpriteCells.
+	*/
+	VulkanBuffer upload_ring;
+	size_t upload_ring_head; // bytes ever written, so the next write goes at head % upload_ring.size
+	size_t upload_ring_tail; // bytes the GPU is known to be done with
+	SpriteCell** upload_cells; size_t num_upload_cells; // grouped by format
+	size_t upload_cell_idx;
+	int32_t upload_row; // relative to the trim of upload_cells[upload_cell_idx]
+	size_t num_upload_frames;
 	
 	/*
 	Memory layout:
-		EntityInstance entities[];
+		Instance instances[num_frames][max_instances_per_frame];
+	Stays mapped. Every frame in flight writes its entities straight into its own row, so neither 
+	a staging copy nor a barrier is needed, and no frame has to wait for another to be drawn. 
+	Device local as well, if the GPU has memory that's both.
+	*/
+	VulkanBuffer instance_buffer;
+	size_t max_instances_per_frame; // every entity times the most cells any sprite frame has
+
+#if TOGGLE_GPU_ENTITIES
+	/*
+	With TOGGLE_GPU_ENTITIES, the CPU never touches an instance. Instead, every frame writes one 
+	GpuEntity per entity, and entity.comp expands them into instance_buffer, which is then device 
+	local and not mapped. Entity i gets instances [i*max_cells_per_entity, (i+1)*max_cells_per_entity)
+	of its frame's row, and whichever of them its sprite frame doesn't need get an empty rect. That 
+	keeps entities drawn in the same order as without TOGGLE_GPU_ENTITIES, and the draw only covers 
+	up to the last active entity. See VulkanExpandEntities.
+
+	entity_buffer:
+		GpuEntity entities[num_frames][max_entities_per_frame];
+	Stays mapped, same as instance_buffer without TOGGLE_GPU_ENTITIES.
+
+	sprite_table_buffer:
+		GpuSprite sprites[MAX_SPRITES];
+		GpuSpriteFrame frames[]; // aligned to minStorageBufferOffsetAlignment
+		GpuSpriteCell cells[]; // aligned to minStorageBufferOffsetAlignment
+
+	draw_buffer:
+		VkDrawIndirectCommand draws[num_frames];
 	*/
-	VulkanBuffer dynamic_staging_buffer;
+	VulkanBuffer entity_buffer;
+	VulkanBuffer sprite_table_buffer;
+	VulkanBuffer draw_buffer;
+	size_t max_entities_per_frame;
+	size_t max_cells_per_entity;
+
+	VkDescriptorSetLayout descriptor_set_layout_entities;
+	VkDescriptorSet descriptor_set_entities;
+	VkPipelineLayout compute_pipeline_layout;
+	VkPipeline compute_pipeline;
+#endif // TOGGLE_GPU_ENTITIES
 
 	/*
 	Memory layout:
-		Tile tiles[];
-		EntityInstance entities[];
+		Tile tiles[WORLD_MAX_RESIDENT_LEVELS][World::max_tiles_per_level]; // one row per LevelSlot
+	Both are the same size. The staging buffer stays mapped, and gets written to by the world 
+	streamer. See VulkanUploadLevels.
 	*/
-	VulkanBuffer vertex_buffer;
+	VulkanBuffer world_staging_buffer;
+	VulkanBuffer world_tile_buffer;
 
 	/*
 	Memory layout:
@@ -299,11 +687,46 @@ typedef struct Vulkan
 	*/
 	VulkanBuffer uniform_buffer;
 
-	VkDeviceMemory image_memory;
+	VkImage atlas_images[SpriteFormat_Count];
+	VkImageView atlas_image_views[SpriteFormat_Count];
+	VkImage palette_image; // PALETTE_SIZE*num_palettes, one row per indexed sprite
+	VkImageView palette_image_view;
+	size_t num_palettes;
+	VulkanAllocation image_memory;
+
+	/*
+	Every buffer and image lives in one of these. See VulkanAllocateMemory, and VulkanLogMemoryUsage 
+	for a report.
+	*/
+	VulkanMemoryBlock memory_blocks[VULKAN_MAX_MEMORY_BLOCKS];
+	VkDeviceSize memory_category_sizes[VulkanMemoryCategory_Count];
+	size_t memory_category_counts[VulkanMemoryCategory_Count];
+	bool has_memory_budget; // VK_EXT_memory_budget
 
 	bool staged;
 } Vulkan;
 
+typedef struct SpriteLoadStats
+{
+	size_t num_cold; // parsed from .aseprite, then baked
+	size_t num_warm; // loaded from the bake cache
+	size_t num_cells_decoded;
+	size_t pixels_size; // of Context::sprite_pixels
+	uint64_t parse_ns;
+	uint64_t decode_ns;
+	uint64_t total_ns;
+} SpriteLoadStats;
+
+typedef struct SpriteLoadRequest
+{
+	Sprite* sprite;
+	char* path;
+
+	// Composite the cells of each frame into one at load time. Leave this off for sprites that
+	// need to do something with individual cells.
+	bool flatten;
+} SpriteLoadRequest;
+
 typedef struct Context 
 {
 #if TOGGLE_PROFILING
@@ -314,6 +737,8 @@ typedef struct Context
 	Arena arena;
 	Stack stack;
 
+	JobPool jobs;
+
 	SDL_Window* window;
 	ivec2s viewport_size;
 	bool vsync;
@@ -330,12 +755,22 @@ typedef struct Context
 
 	bool left_mouse_pressed;
 	vec2s mouse_pos;
+
+	// Time that has passed but hasn't been ticked yet. Always less than TICK_NS in between frames,
+	// and how far into it we are decides how far frames get drawn between prev_pos and pos.
+	uint64_t tick_accumulator_ns;
+	uint64_t last_frame_ns;
 	
-	Level level;
+	World world;
+	ivec2s camera_pos; // in pixels, relative to the world
 
 	// sprites is a hash map, not an array.
 	// When looping through sprites, please loop MAX_SPRITES times, not num_sprites times.
 	SpriteDesc sprites[MAX_SPRITES]; size_t num_sprites;
+	SpriteAtlas atlases[SpriteFormat_Count];
+	SpriteLoadStats sprite_load_stats;
+	uint8_t* sprite_pixels; // the pixels of every cell that was inflated, see LoadSprites
+	bool rebake; // ignore the bake cache and rebuild every sprite and level from source
 
 	Vulkan vk;
 
@@ -355,7 +790,19 @@ typedef struct VkImageMemoryRequirements
 } VkImageMemoryRequirements;
 
 #include "util.c"
+#include "inflate.c"
+#include "ldtk.c"
 #include "vk_util.c"
+#include "jobs.c"
+
+// SPIR-V, compiled by glslang into const uint32_t arrays named after the shader. See CMakeLists.txt.
+#include "tile_vert.h"
+#include "tile_frag.h"
+#include "entity_vert.h"
+#include "entity_frag.h"
+#if TOGGLE_GPU_ENTITIES
+#include "entity_comp.h"
+#endif // TOGGLE_GPU_ENTITIES
 
 static Sprite player_idle;
 static Sprite player_run;
@@ -371,7 +818,27 @@ static Sprite boar_hit;
 
 static Sprite spr_tiles;
 
-static float dt;
+// This is the only time that we set the sprite variables (see LoadSprites).
+// After that, they are effectively constants.
+static SpriteLoadRequest sprite_load_requests[] = 
+{
+	{ &player_idle, "assets\\legacy_fantasy_high_forest\\Character\\Idle\\Idle.aseprite", true },
+	{ &player_run, "assets\\legacy_fantasy_high_forest\\Character\\Run\\Run.aseprite", true },
+	{ &player_jump_start, "assets\\legacy_fantasy_high_forest\\Character\\Jump-Start\\Jump-Start.aseprite", true },
+	{ &player_jump_end, "assets\\legacy_fantasy_high_forest\\Character\\Jump-End\\Jump-End.aseprite", true },
+	{ &player_attack, "assets\\legacy_fantasy_high_forest\\Character\\Attack-01\\Attack-01.aseprite", true },
+	{ &player_die, "assets\\legacy_fantasy_high_forest\\Character\\Dead\\Dead.aseprite", true },
+
+	{ &boar_idle, "assets\\legacy_fantasy_high_forest\\Mob\\Boar\\Idle\\Idle.aseprite", true },
+	{ &boar_walk, "assets\\legacy_fantasy_high_forest\\Mob\\Boar\\Walk\\Walk-Base.aseprite", true },
+	{ &boar_run, "assets\\legacy_fantasy_high_forest\\Mob\\Boar\\Run\\Run.aseprite", true },
+	{ &boar_hit, "assets\\legacy_fantasy_high_forest\\Mob\\Boar\\Hit-Vanish\\Hit.aseprite", true },
+
+	{ &spr_tiles, "assets\\legacy_fantasy_high_forest\\Assets\\Tiles.aseprite" },
+};
+
+// The game was tuned for one tick per frame at 60 Hz, so that's one unit of time.
+static const float dt = 60.0f/TICK_RATE;
 
 static ivec2s GetSpriteOrigin(Context* ctx, Sprite sprite, int32_t dir) 
 {
@@ -434,44 +901,48 @@ static void UpdateAnim(Context* ctx, Anim* anim, bool loop)
 
 static void ResetGame(Context* ctx) 
 {
-	Entity* player = &ctx->level.entities[0];
+	Entity* player = GetPlayer(ctx);
 	
 	ResetAnim(&player->anim);
 	SetAnimSprite(&player->anim, player_idle);
 	player->pos = player->start_pos;
+	player->prev_pos = player->pos;
 	player->state = EntityState_Free;
 	player->vel = (vec2s){0.0f};
 	player->dir = 1;
 
-	for (size_t entity_idx = 1; entity_idx < ctx->level.num_entities; entity_idx += 1) 
+	EntityStore* enemies = &ctx->world.enemies;
+	for (size_t entity_idx = 0; entity_idx < enemies->count; entity_idx += 1) 
 	{
-		Entity* enemy = &ctx->level.entities[entity_idx];
+		Entity enemy = GetStoreEntity(enemies, entity_idx);
 
-		ResetAnim(&enemy->anim);
-		if (enemy->type == EntityType_Boar) 
+		ResetAnim(&enemy.anim);
+		if (enemy.type == EntityType_Boar) 
 		{
-			SetAnimSprite(&enemy->anim, boar_idle);
+			SetAnimSprite(&enemy.anim, boar_idle);
 		} 
 		// else if (entity->type == EntityType_) {}
-		enemy->pos = enemy->start_pos;
-		enemy->state = EntityState_Free;
-		enemy->vel = (vec2s){0.0f};
-		enemy->dir = 1;
+		enemy.pos = enemy.start_pos;
+		enemy.prev_pos = enemy.pos;
+		enemy.state = EntityState_Free;
+		enemy.vel = (vec2s){0.0f};
+		enemy.dir = 1;
+
+		SetStoreEntity(enemies, entity_idx, &enemy);
 	}	
 }
 
-static ivec2s GetTilesetDimensions(Context* ctx, Sprite tileset) 
+static SpriteCell* GetTilesetCell(Context* ctx, Sprite tileset) 
 {
 	SpriteDesc* sd = GetSpriteDesc(ctx, tileset);
 	SDL_assert(sd->num_frames == 1);
 	SDL_assert(sd->frames[0].num_cells == 1);
-	return sd->size;
+	return &sd->frames[0].cells[0];
 }
 
-static bool GetSpriteHitbox(Context* ctx, Sprite sprite, size_t frame_idx, int32_t dir, Rect* hitbox) 
+static bool GetSpriteHitbox(SpriteDesc* sd, size_t frame_idx, int32_t dir, Rect* hitbox) 
 {
 	bool res = false;
-	SpriteDesc* sd = GetSpriteDesc(ctx, sprite); SDL_assert(sd);
 	SDL_assert(frame_idx < sd->num_frames); 
 	SpriteFrame* frame = &sd->frames[frame_idx];
 	SDL_assert(hitbox);
@@ -488,49 +959,68 @@ static bool GetSpriteHitbox(Context* ctx, Sprite sprite, size_t frame_idx, int32
 	return res;
 }
 
-static Rect GetEntityHitbox(Context* ctx, Entity* entity) 
+/**
+ * Fills in SpriteDesc::hitboxes, so that finding an entity's hitbox during the game is a single 
+ * load instead of a search. For each frame and direction:
+ * First, try to find the hitbox at the frame index or earlier.
+ * If that doesn't work, try to find the hitbox at the frame index plus one or later.
+ * Then, make it relative to the origin of the sprite for that direction.
+ */
+static void BuildSpriteHitboxes(Arena* arena, SpriteDesc* sd) 
 {
-	SPALL_BUFFER_BEGIN();
-	Rect hitbox = {0};
-	SpriteDesc* sd = GetSpriteDesc(ctx, entity->anim.sprite);
-
-	/**
-	 * First, try to find the hitbox at the current frame index or earlier.
-	 * If that doesn't work, try to find the hitbox at the current frame index plus one or later.
-	 * If that doesn't work, trigger an assertion.
-	 */
-	bool res = false;
-	for (
-		ssize_t frame_idx = (ssize_t)entity->anim.frame_idx; 
-		frame_idx >= 0 && !res; 
-		frame_idx -= 1) 
+	bool any = false;
+	for (size_t frame_idx = 0; frame_idx < sd->num_frames && !any; frame_idx += 1) 
 	{
-		res = GetSpriteHitbox(ctx, entity->anim.sprite, (size_t)frame_idx, entity->dir, &hitbox); 
+		Rect hitbox;
+		any = GetSpriteHitbox(sd, frame_idx, 1, &hitbox);
 	}
-	if (!res) 
+	if (!any) 
 	{
-		for (
-			size_t frame_idx = entity->anim.frame_idx + 1; 
-			frame_idx < sd->num_frames && !res; 
-			frame_idx += 1) 
+		sd->hitboxes = NULL;
+		return;
+	}
+
+	sd->hitboxes = ArenaAlloc(arena, sd->num_frames*2, Rect);
+	for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1) 
+	{
+		for (int32_t dir = 1; dir >= -1; dir -= 2) 
 		{
-			res = GetSpriteHitbox(ctx, entity->anim.sprite, frame_idx, entity->dir, &hitbox);
+			Rect hitbox = {0};
+			bool res = false;
+			for (ssize_t i = (ssize_t)frame_idx; i >= 0 && !res; i -= 1) 
+			{
+				res = GetSpriteHitbox(sd, (size_t)i, dir, &hitbox); 
+			}
+			for (size_t i = frame_idx + 1; i < sd->num_frames && !res; i += 1) 
+			{
+				res = GetSpriteHitbox(sd, i, dir, &hitbox);
+			}
+			SDL_assert(res);
+
+			ivec2s origin = sd->origin;
+			if (dir == -1) 
+			{
+				origin.x = sd->size.x - origin.x;
+			}
+			hitbox.min = glms_ivec2_sub(hitbox.min, origin);
+			hitbox.max = glms_ivec2_sub(hitbox.max, origin);
+			sd->hitboxes[frame_idx*2 + (dir == -1)] = hitbox;
 		}
 	}
-	SDL_assert(res);
+}
 
-	SPALL_BUFFER_END();
-	return hitbox;
+// Relative to the origin of the sprite. Doesn't need a Context, so that physics can run without one.
+static Rect GetFrameHitbox(SpriteDesc* sd, size_t frame_idx, int32_t dir) 
+{
+	SDL_assert(sd->hitboxes && frame_idx < sd->num_frames);
+	return sd->hitboxes[frame_idx*2 + (dir == -1)];
 }
 
 static Rect GetEntityRect(Context* ctx, Entity* entity)
 {
-	Rect res = GetEntityHitbox(ctx, entity);
+	Rect res = GetFrameHitbox(GetSpriteDesc(ctx, entity->anim.sprite), entity->anim.frame_idx, entity->dir);
 	res.min = glms_ivec2_add(res.min, entity->pos); 
 	res.max = glms_ivec2_add(res.max, entity->pos);
-	ivec2s origin = GetEntityOrigin(ctx, entity); 
-	res.min = glms_ivec2_sub(res.min, origin); 
-	res.max = glms_ivec2_sub(res.max, origin); 
 	return res;
 }
 
@@ -550,214 +1040,1811 @@ static bool EntitiesIntersect(Context* ctx, Entity* a, Entity* b)
     return res;
 }
 
-static ASE_ChunkType ASE_ReadChunk(SDL_IOStream* fs, Stack* stack, void** out_raw_chunk, size_t* out_raw_chunk_size) 
+static uint32_t GetEntityGridBucket(int32_t cell_x, int32_t cell_y)
+{
+	uint32_t hash = ((uint32_t)cell_x*73856093u) ^ ((uint32_t)cell_y*19349663u);
+	return hash & (ENTITY_GRID_NUM_BUCKETS - 1);
+}
+
+// Cells are measured in ENTITY_GRID_CELL_SIZE, and both corners are inclusive.
+static Rect GetEntityGridCells(Rect rect)
+{
+	Rect res;
+	res.min.x = FloorDiv(rect.min.x, ENTITY_GRID_CELL_SIZE);
+	res.min.y = FloorDiv(rect.min.y, ENTITY_GRID_CELL_SIZE);
+	res.max.x = FloorDiv(rect.max.x, ENTITY_GRID_CELL_SIZE);
+	res.max.y = FloorDiv(rect.max.y, ENTITY_GRID_CELL_SIZE);
+	return res;
+}
+
+/**
+ * Puts every active enemy into the bucket of each cell it overlaps. This is a counting sort: one
+ * pass counts the entries of each bucket, and another fills them in, so it never allocates unless 
+ * there are more entries than the last time.
+ */
+static void RebuildEntityGrid(Context* ctx)
 {
-	ASE_ChunkHeader chunk_header = {0};
-	SDL_ReadStructChecked(fs, &chunk_header);
-	if (chunk_header.size != sizeof(ASE_ChunkHeader))
+	SPALL_BUFFER_BEGIN();
+
+	EntityStore* store = &ctx->world.enemies;
+	EntityGrid* grid = &ctx->world.entity_grid;
+	SDL_memset(grid->bucket_starts, 0, sizeof(grid->bucket_starts));
+
+	size_t num_entries = 0;
+	for (size_t entity_idx = 0; entity_idx < store->count; entity_idx += 1)
+	{
+		if (store->state[entity_idx] == EntityState_Inactive) continue;
+
+		SpriteDesc* sd = GetSpriteDesc(ctx, store->anim_sprite[entity_idx]);
+		Rect rect = GetFrameHitbox(sd, store->anim_frame_idx[entity_idx], store->dir[entity_idx]);
+		ivec2s pos = {store->pos_x[entity_idx], store->pos_y[entity_idx]};
+		rect.min = glms_ivec2_add(rect.min, pos);
+		rect.max = glms_ivec2_add(rect.max, pos);
+		grid->rects[entity_idx] = rect;
+		Rect cells = GetEntityGridCells(grid->rects[entity_idx]);
+		for (int32_t y = cells.min.y; y <= cells.max.y; y += 1)
+		{
+			for (int32_t x = cells.min.x; x <= cells.max.x; x += 1)
+			{
+				grid->bucket_starts[GetEntityGridBucket(x, y)] += 1;
+				num_entries += 1;
+			}
+		}
+	}
+
+	if (num_entries > grid->cap_entries)
+	{
+		grid->cap_entries = SDL_max(num_entries, grid->cap_entries*2);
+		grid->entries = SDL_realloc(grid->entries, grid->cap_entries*sizeof(uint32_t)); SDL_CHECK(grid->entries);
+	}
+	grid->num_entries = num_entries;
+
+	// After this, bucket_starts[i] is where bucket i ends. Filling each bucket in from its end
+	// moves it back to where the bucket starts.
+	for (size_t bucket_idx = 1; bucket_idx < ENTITY_GRID_NUM_BUCKETS; bucket_idx += 1)
 	{
-		*out_raw_chunk_size = chunk_header.size - sizeof(ASE_ChunkHeader);
-		*out_raw_chunk = StackAllocRaw(stack, *out_raw_chunk_size, alignof(ASE_ChunkHeader));
-		SDL_ReadIOChecked(fs, *out_raw_chunk, *out_raw_chunk_size);
+		grid->bucket_starts[bucket_idx] += grid->bucket_starts[bucket_idx - 1];
+	}
+	grid->bucket_starts[ENTITY_GRID_NUM_BUCKETS] = (uint32_t)num_entries;
+
+	for (size_t entity_idx = 0; entity_idx < store->count; entity_idx += 1)
+	{
+		if (store->state[entity_idx] == EntityState_Inactive) continue;
+
+		Rect cells = GetEntityGridCells(grid->rects[entity_idx]);
+		for (int32_t y = cells.min.y; y <= cells.max.y; y += 1)
+		{
+			for (int32_t x = cells.min.x; x <= cells.max.x; x += 1)
+			{
+				uint32_t* start = &grid->bucket_starts[GetEntityGridBucket(x, y)];
+				*start -= 1;
+				grid->entries[*start] = (uint32_t)entity_idx;
+			}
+		}
 	}
 
-	return chunk_header.type;
+	SPALL_BUFFER_END();
 }
 
-static Sprite LoadSprite(Context* ctx, char* path) 
+/**
+ * Returns the index into World::enemies of every enemy whose rectangle overlapped rect as of the
+ * last RebuildEntityGrid. The result is on the stack, so StackFree it once you're done with it.
+ */
+static size_t* QueryEntityGrid(Context* ctx, Rect rect, size_t* out_num_entities)
 {
 	SPALL_BUFFER_BEGIN();
 
-	SDL_CHECK(SDL_GetPathInfo(path, NULL));
+	EntityGrid* grid = &ctx->world.entity_grid;
+	Rect cells = GetEntityGridCells(rect);
 
-	Sprite sprite = GetSprite(path);
-	SpriteDesc* sd = GetSpriteDesc(ctx, sprite);
-	SDL_assert(!sd && "Collision");
-	sd = &ctx->sprites[sprite.idx];
+	size_t max_entities = 0;
+	for (int32_t y = cells.min.y; y <= cells.max.y; y += 1)
+	{
+		for (int32_t x = cells.min.x; x <= cells.max.x; x += 1)
+		{
+			uint32_t bucket_idx = GetEntityGridBucket(x, y);
+			max_entities += grid->bucket_starts[bucket_idx + 1] - grid->bucket_starts[bucket_idx];
+		}
+	}
+	size_t* res = StackAlloc(&ctx->stack, SDL_max(max_entities, (size_t)1), size_t);
 
-	// SetSpriteName (we need this for vkSetDebugUtilsObjectNameEXT)
+	// Marks only need to be cleared once every 2^32 queries.
+	grid->query_mark += 1;
+	if (grid->query_mark == 0)
 	{
-		size_t buf_size = SDL_strlen(path) + 1;
-		sd->name = ArenaAllocRaw(&ctx->arena, buf_size, 1);
-		SDL_strlcpy(sd->name, path, buf_size);
+		SDL_memset(grid->query_marks, 0, ctx->world.enemies.count*sizeof(uint32_t));
+		grid->query_mark = 1;
+	}
+
+	size_t num_entities = 0;
+	for (int32_t y = cells.min.y; y <= cells.max.y; y += 1)
+	{
+		for (int32_t x = cells.min.x; x <= cells.max.x; x += 1)
+		{
+			uint32_t bucket_idx = GetEntityGridBucket(x, y);
+			for (uint32_t entry_idx = grid->bucket_starts[bucket_idx]; entry_idx < grid->bucket_starts[bucket_idx + 1]; entry_idx += 1)
+			{
+				uint32_t entity_idx = grid->entries[entry_idx];
+				if (grid->query_marks[entity_idx] == grid->query_mark) continue;
+				grid->query_marks[entity_idx] = grid->query_mark;
+				if (RectsIntersect(grid->rects[entity_idx], rect))
+				{
+					res[num_entities++] = entity_idx;
+				}
+			}
+		}
 	}
 
-	SDL_IOStream* fs = SDL_IOFromFile(path, "r"); 
-	SDL_CHECK(fs);
+	*out_num_entities = num_entities;
+	SPALL_BUFFER_END();
+	return res;
+}
+
+static bool ASE_StringEquals(const ASE_String* str, const char* cstr)
+{
+	size_t len = SDL_strlen(cstr);
+	return str->len == len && SDL_memcmp(str + 1, cstr, len) == 0;
+}
+
+/**
+ * The whole file is already in memory (see LoadSprites), so the frames and chunks are walked in
+ * place. Each frame is swept exactly once: layer chunks are matched by name as they are found,
+ * and cell chunks are remembered by pointer. Once the sweep is done we know exactly how many
+ * cells the frame has, so the cells are allocated once and pointed straight at their compressed
+ * pixels in the file. Inflating them is left to DecodeSpriteCell, so that it can happen in 
+ * parallel with the cells of other sprites.
+ */
+static void ParseSpriteAseprite(Arena* arena, Stack* stack, SpriteDesc* sd, const void* data, size_t data_size) 
+{
+	const uint8_t* file_start = data;
+	const uint8_t* file_end = file_start + data_size;
+	SDL_assert(data_size >= sizeof(ASE_Header));
+
+	const ASE_Header* header = data;
+	SDL_assert(header->magic_number == 0xA5E0);
 
-	ASE_Header header; 
-	SDL_ReadStructChecked(fs, &header);
-	SDL_assert(header.magic_number == 0xA5E0);
+	SDL_assert(header->color_depth == 32 || header->color_depth == 8);
+	SDL_assert((header->pixel_w == 0 || header->pixel_w == 1) && (header->pixel_h == 0 || header->pixel_h == 1));
+	SDL_assert(header->grid_x == 0);
+	SDL_assert(header->grid_y == 0);
+	SDL_assert(header->grid_w == 0 || header->grid_w == 16);
+	SDL_assert(header->grid_h == 0 || header->grid_h == 16);
 
-	SDL_assert(header.color_depth == 32);
-	SDL_assert((header.pixel_w == 0 || header.pixel_w == 1) && (header.pixel_h == 0 || header.pixel_h == 1));
-	SDL_assert(header.grid_x == 0);
-	SDL_assert(header.grid_y == 0);
-	SDL_assert(header.grid_w == 0 || header.grid_w == 16);
-	SDL_assert(header.grid_h == 0 || header.grid_h == 16);
+	sd->size.x = (int32_t)header->w;
+	sd->size.y = (int32_t)header->h;
 
-	sd->size.x = (int32_t)header.w;
-	sd->size.y = (int32_t)header.h;
+	if (header->color_depth == 8)
+	{
+		sd->format = SpriteFormat_Indexed;
+		sd->palette = ArenaAlloc(arena, PALETTE_SIZE, uint32_t);
+		sd->transparent_idx = header->transparent_color_entry;
+	}
 
-	sd->num_frames = header.num_frames;
-	sd->frames = ArenaAlloc(&ctx->arena, sd->num_frames, SpriteFrame);
+	sd->num_frames = header->num_frames;
+	sd->frames = ArenaAlloc(arena, sd->num_frames, SpriteFrame);
 
 	uint16_t hitbox_layer_idx = UINT16_MAX;
 	uint16_t origin_layer_idx = UINT16_MAX;
+	uint16_t num_layers = 0;
 
+	const uint8_t* frame_start = file_start + sizeof(ASE_Header);
 	for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1) 
 	{
-		ASE_Frame frame;
-		SDL_ReadStructChecked(fs, &frame);
-		SDL_assert(frame.magic_number == 0xF1FA);
+		SDL_assert(frame_start + sizeof(ASE_Frame) <= file_end);
+		const ASE_Frame* frame = (const ASE_Frame*)frame_start;
+		SDL_assert(frame->magic_number == 0xF1FA);
 
 		// Would mean this aseprite file is very old.
-		SDL_assert(frame.num_chunks != 0);
+		SDL_assert(frame->num_chunks != 0);
 
-		sd->frames[frame_idx].dur = ((float)frame.frame_dur)/(1000.0f/60.0f);
+		const uint8_t* frame_end = frame_start + frame->num_bytes;
+		SDL_assert(frame_end <= file_end);
 
-		int64_t fs_pos = SDL_TellIO(fs);
+		SpriteFrame* sf = &sd->frames[frame_idx];
+		sf->dur = ((float)frame->frame_dur)/(1000.0f/60.0f);
 
-		// NOTE: According to the Aseprite spec, all layer chunks are found in the first frame, but not necessarily before everything else in that frame.
-		// https://github.com/aseprite/aseprite/blob/main/docs/ase-file-specs.md#layer-chunk-0x2004
-		if (frame_idx == 0) 
+		const ASE_CellChunk** cell_chunks = StackAlloc(stack, frame->num_chunks, const ASE_CellChunk*);
+		size_t* cell_chunk_sizes = StackAlloc(stack, frame->num_chunks, size_t);
+		size_t num_cell_chunks = 0;
+
+		const uint8_t* chunk_start = frame_start + sizeof(ASE_Frame);
+		for (size_t chunk_idx = 0; chunk_idx < frame->num_chunks; chunk_idx += 1)
 		{
-			for (size_t chunk_idx = 0, layer_idx = 0; chunk_idx < frame.num_chunks; chunk_idx += 1) 
+			const ASE_ChunkHeader* chunk_header = (const ASE_ChunkHeader*)chunk_start;
+			SDL_assert(chunk_start + sizeof(ASE_ChunkHeader) <= frame_end);
+			SDL_assert(chunk_header->size >= sizeof(ASE_ChunkHeader) && chunk_start + chunk_header->size <= frame_end);
+			const void* chunk = chunk_header + 1;
+			size_t chunk_size = chunk_header->size - sizeof(ASE_ChunkHeader);
+
+			// NOTE: According to the Aseprite spec, all layer chunks are found in the first frame, but not necessarily before everything else in that frame.
+			// https://github.com/aseprite/aseprite/blob/main/docs/ase-file-specs.md#layer-chunk-0x2004
+			if (chunk_header->type == ASE_ChunkType_Layer)
 			{
-				void* raw_chunk; 
-				size_t raw_chunk_size;
-				ASE_ChunkType chunk_type = ASE_ReadChunk(fs, &ctx->stack, &raw_chunk, &raw_chunk_size);
-				if (chunk_type == ASE_ChunkType_Layer) 
-				{
-					ASE_LayerChunk* chunk = raw_chunk;
-					SDL_assert(chunk->layer_name.len > 0);
+				SDL_assert(frame_idx == 0);
+				const ASE_LayerChunk* layer = chunk;
+				SDL_assert(layer->layer_name.len > 0);
 
-					char* layer_name = StackAlloc(&ctx->stack, chunk->layer_name.len + 1, char);
-
-					SDL_strlcpy(layer_name, (const char*)(chunk+1), chunk->layer_name.len + 1);
-
-					if (SDL_strcmp(layer_name, "Hitbox") == 0) 
-					{
-						SDL_assert(hitbox_layer_idx == UINT16_MAX);
-						hitbox_layer_idx = (uint16_t)layer_idx;
-					} 
-					else if (SDL_strcmp(layer_name, "Origin") == 0) 
+				if (ASE_StringEquals(&layer->layer_name, "Hitbox")) 
+				{
+					SDL_assert(hitbox_layer_idx == UINT16_MAX);
+					hitbox_layer_idx = num_layers;
+				} 
+				else if (ASE_StringEquals(&layer->layer_name, "Origin")) 
+				{
+					SDL_assert(origin_layer_idx == UINT16_MAX);
+					origin_layer_idx = num_layers;
+				}
+				num_layers += 1;
+			}
+			else if (chunk_header->type == ASE_ChunkType_Palette && sd->format == SpriteFormat_Indexed)
+			{
+				SDL_assert(chunk_size >= sizeof(ASE_PaletteChunk));
+				const ASE_PaletteChunk* palette = chunk;
+				SDL_assert(palette->first_color_idx_to_change <= palette->last_color_idx_to_change);
+				SDL_assert(palette->last_color_idx_to_change < PALETTE_SIZE);
+
+				// Entries are variable-sized, since each of them might have a name.
+				const uint8_t* entry_start = (const uint8_t*)(palette + 1);
+				for (uint32_t color_idx = palette->first_color_idx_to_change; color_idx <= palette->last_color_idx_to_change; color_idx += 1)
+				{
+					const ASE_PaletteEntry* entry = (const ASE_PaletteEntry*)entry_start;
+					SDL_assert(entry_start + sizeof(ASE_PaletteEntry) <= chunk_start + chunk_header->size);
+					sd->palette[color_idx] = (uint32_t)entry->r | ((uint32_t)entry->g << 8) | ((uint32_t)entry->b << 16) | ((uint32_t)entry->a << 24);
+					entry_start += sizeof(ASE_PaletteEntry);
+					if (entry->flags & ASE_PaletteEntryFlags_HasName)
 					{
-						SDL_assert(origin_layer_idx == UINT16_MAX);
-						origin_layer_idx = (uint16_t)layer_idx;					
+						entry_start += sizeof(uint16_t) + ((const ASE_String*)entry_start)->len;
 					}
-					layer_idx += 1;
-
-					StackFree(&ctx->stack, layer_name);
 				}
-
-				StackFree(&ctx->stack, raw_chunk);
+				sd->num_colors = SDL_max(sd->num_colors, (size_t)palette->last_color_idx_to_change + 1);
+			}
+			else if (chunk_header->type == ASE_ChunkType_Cell)
+			{
+				SDL_assert(chunk_size >= sizeof(ASE_LinkedCellChunk));
+				SDL_assert(((const ASE_CellChunk*)chunk)->type == ASE_CellType_Linked || chunk_size >= sizeof(ASE_CellChunk));
+				cell_chunks[num_cell_chunks] = chunk;
+				cell_chunk_sizes[num_cell_chunks] = chunk_size;
+				num_cell_chunks += 1;
 			}
 
-			SDL_SeekIO(fs, fs_pos, SDL_IO_SEEK_SET);
+			chunk_start += chunk_header->size;
 		}
-		
-		for (size_t chunk_idx = 0; chunk_idx < frame.num_chunks; chunk_idx += 1)
+
+		for (size_t i = 0; i < num_cell_chunks; i += 1)
+		{
+			const ASE_CellChunk* chunk = cell_chunks[i];
+			if (chunk->layer_idx != hitbox_layer_idx && chunk->layer_idx != origin_layer_idx)
+			{
+				sf->num_cells += 1;
+			}
+		}
+#if TOGGLE_TESTS
+		SDL_Log("sprites[%s].frames[%llu].num_cells = %llu", sd->name, frame_idx, sf->num_cells);
+#endif
+		if (sf->num_cells > 0)
+		{
+			sf->cells = ArenaAlloc(arena, sf->num_cells, SpriteCell);
+		}
+
+		size_t cell_idx = 0;
+		for (size_t i = 0; i < num_cell_chunks; i += 1)
 		{
-			void* raw_chunk;
-			size_t raw_chunk_size;
-			ASE_ChunkType chunk_type = ASE_ReadChunk(fs, &ctx->stack, &raw_chunk, &raw_chunk_size);
+			const ASE_CellChunk* chunk = cell_chunks[i];
+
+			// A linked cell points at a frame that has already been parsed.
+			const SpriteFrame* linked_frame = NULL;
+			if (chunk->type == ASE_CellType_Linked)
+			{
+				size_t linked_frame_idx = ((const ASE_LinkedCellChunk*)chunk)->frame_idx;
+				SDL_assert(linked_frame_idx < frame_idx);
+				linked_frame = &sd->frames[linked_frame_idx];
+			}
 
-			if (chunk_type == ASE_ChunkType_Cell)
+			if (chunk->layer_idx == hitbox_layer_idx)
 			{
-				ASE_CellChunk* chunk = raw_chunk;
-				if (chunk->layer_idx == hitbox_layer_idx)
+				if (linked_frame)
+				{
+					sf->hitbox = linked_frame->hitbox;
+				}
+				else
 				{
-					sd->frames[frame_idx].hitbox = (Rect)
+					sf->hitbox = (Rect)
 					{
 						.min.x = (int32_t)chunk->x,
 						.min.y = (int32_t)chunk->y,
 						.max.x = (int32_t)(chunk->x + chunk->w),
 						.max.y = (int32_t)(chunk->y + chunk->h),
 					};
-				} 
-				else if (chunk->layer_idx == origin_layer_idx) 
+				}
+			} 
+			else if (chunk->layer_idx == origin_layer_idx) 
+			{
+				if (frame_idx == 0)
+				{
+					sd->origin = (ivec2s){(int32_t)chunk->x, (int32_t)chunk->y};
+				}
+			} 
+			else 
+			{
+				SpriteCell cell = 
 				{
-					if (frame_idx == 0)
+					.origin.x = (int32_t)chunk->x,
+					.origin.y = (int32_t)chunk->y,
+					.z_idx = chunk->z_idx,
+					.layer_idx = (uint32_t)chunk->layer_idx,
+					.format = sd->format,
+				};
+
+				if (linked_frame)
+				{
+					// Sharing src_buf is what lets LinkSpriteCells find the cell this one is linked to.
+					const SpriteCell* linked_cell = NULL;
+					for (size_t linked_cell_idx = 0; linked_cell_idx < linked_frame->num_cells; linked_cell_idx += 1)
 					{
-						sd->origin = (ivec2s){(int32_t)chunk->x, (int32_t)chunk->y};
+						if (linked_frame->cells[linked_cell_idx].layer_idx == cell.layer_idx)
+						{
+							linked_cell = &linked_frame->cells[linked_cell_idx];
+							break;
+						}
 					}
-				} 
-				else 
+					SDL_assert(linked_cell);
+					cell.size = linked_cell->size;
+					cell.src_buf = linked_cell->src_buf;
+					cell.src_buf_size = linked_cell->src_buf_size;
+				}
+				else
 				{
-					sd->frames[frame_idx].num_cells += 1;
 					SDL_assert(chunk->type == ASE_CellType_CompressedImage);
+					cell.size.x = (int32_t)chunk->w;
+					cell.size.y = (int32_t)chunk->h;
+
+					// It's the zero-sized array at the end of ASE_CellChunk.
+					cell.src_buf = chunk + 1;
+					cell.src_buf_size = cell_chunk_sizes[i] - sizeof(ASE_CellChunk);
 				}
-			}
 
-			StackFree(&ctx->stack, raw_chunk);
-		}
-#if TOGGLE_TESTS
-		SDL_Log("sprites[%s].frames[%llu].num_cells = %llu", sd->name, frame_idx, sd->frames[frame_idx].num_cells);
-#endif
+				SDL_assert(cell.size.x != 0 && cell.size.y != 0);
 
-		if (sd->frames[frame_idx].num_cells > 0) 
-		{
-			sd->frames[frame_idx].cells = ArenaAlloc(&ctx->arena, sd->frames[frame_idx].num_cells, SpriteCell);
-			size_t cell_idx = 0;
+				SDL_assert(cell_idx < sf->num_cells);
+				sf->cells[cell_idx++] = cell;
+			}
+		}
+		SDL_assert(cell_idx == sf->num_cells);
 
-			SDL_SeekIO(fs, fs_pos, SDL_IO_SEEK_SET);
+		StackFree(stack, cell_chunk_sizes);
+		StackFree(stack, cell_chunks);
 
-			for (size_t chunk_idx = 0; chunk_idx < frame.num_chunks; chunk_idx += 1) 
-			{
-				void* raw_chunk; 
-				size_t raw_chunk_size;
-				ASE_ChunkType chunk_type = ASE_ReadChunk(fs, &ctx->stack, &raw_chunk, &raw_chunk_size);
+		// Makes the cells draw in the correct order.
+		SDL_qsort(sf->cells, sf->num_cells, sizeof(SpriteCell), (SDL_CompareCallback)CompareSpriteCells);
 
-				ASE_CellChunk* chunk = raw_chunk;
-				if (chunk_type == ASE_ChunkType_Cell && 
-					chunk->layer_idx != hitbox_layer_idx && 
-					chunk->layer_idx != origin_layer_idx) 
-				{
+		frame_start = frame_end;
+	}
 
-					SpriteCell cell = 
+	// NOTE: Aseprite treats the transparent index as an opaque color inside of background layers.
+	// None of our sprites have one, so it's always transparent here.
+	if (sd->format == SpriteFormat_Indexed)
+	{
+		sd->palette[sd->transparent_idx] &= 0x00FFFFFFu;
+		sd->num_colors = SDL_max(sd->num_colors, (size_t)sd->transparent_idx + 1);
+	}
+}
+
+static void DecodeSpriteCell(SpriteCell* cell)
+{
+	SDL_assert(cell->src_buf);
+	size_t dst_buf_size = GetSpriteCellBufSize(cell);
+	if (!cell->dst_buf)
+	{
+		cell->dst_buf = SDL_malloc(dst_buf_size); SDL_CHECK(cell->dst_buf);
+	}
+
+	size_t res = ZInflate(cell->dst_buf, dst_buf_size, cell->src_buf, cell->src_buf_size);
+	SDL_assert(res == dst_buf_size);
+	cell->hash = XXH3_64bits(cell->dst_buf, dst_buf_size);
+
+#if TOGGLE_TESTS
+	// ZInflate has to match the decoder it replaced byte for byte.
+	{
+		void* expected = SDL_malloc(dst_buf_size); SDL_CHECK(expected);
+		size_t expected_res = INFL_ZInflate(expected, dst_buf_size, cell->src_buf, cell->src_buf_size);
+		SDL_assert(expected_res == res);
+		SDL_assert(SDL_memcmp(expected, cell->dst_buf, dst_buf_size) == 0);
+		SDL_free(expected);
+	}
+#endif // TOGGLE_TESTS
+
+	cell->src_buf = NULL;
+	cell->src_buf_size = 0;
+}
+
+static void GetSpriteBakePath(char* path, char* buf, size_t buf_size)
+{
+	SDL_snprintf(buf, buf_size, BAKE_CACHE_DIR "/%016llx.sprite", (unsigned long long)HashString(path, 0));
+}
+
+static bool LoadSpriteBake(Arena* arena, SpriteDesc* sd, const char* bake_path, uint64_t source_hash, SpriteBakeFlags flags)
+{
+	MappedFile file;
+	if (!MapFile(bake_path, &file)) return false;
+
+	// Validate everything before touching the arena, so that a stale or truncated file can 
+	// just be rebuilt from source.
+	bool valid = file.size >= sizeof(SpriteBakeHeader);
+	SpriteBakeHeader* header = file.data;
+	SpriteBakeFrame* frames = NULL;
+	SpriteBakeCell* cells = NULL;
+	uint32_t* palette = NULL;
+	uint8_t* pixels = NULL;
+	size_t bytes_per_pixel = sizeof(uint32_t);
+	if (valid)
+	{
+		valid = 
+			header->magic == SPRITE_BAKE_MAGIC && 
+			header->version == SPRITE_BAKE_VERSION && 
+			header->source_hash == source_hash &&
+			header->flags == flags &&
+			header->num_frames > 0 &&
+			header->num_colors <= PALETTE_SIZE;
+	}
+	if (valid)
+	{
+		size_t tables_end = sizeof(SpriteBakeHeader) + header->num_frames*sizeof(SpriteBakeFrame) + header->num_cells*sizeof(SpriteBakeCell) + header->num_colors*sizeof(uint32_t);
+		valid = 
+			tables_end <= header->pixels_offset && 
+			header->pixels_offset % SPRITE_BAKE_PIXELS_ALIGN == 0 &&
+			header->pixels_offset + header->pixels_size <= file.size;
+	}
+	if (valid)
+	{
+		frames = (SpriteBakeFrame*)(header + 1);
+		cells = (SpriteBakeCell*)(frames + header->num_frames);
+		palette = (uint32_t*)(cells + header->num_cells);
+		pixels = (uint8_t*)file.data + header->pixels_offset;
+		if (header->num_colors > 0) bytes_per_pixel = sizeof(uint8_t);
+
+		size_t num_cells = 0;
+		for (size_t frame_idx = 0; frame_idx < header->num_frames; frame_idx += 1)
+		{
+			num_cells += frames[frame_idx].num_cells;
+		}
+		valid = num_cells == header->num_cells;
+
+		for (size_t cell_idx = 0; cell_idx < header->num_cells && valid; cell_idx += 1)
+		{
+			SpriteBakeCell* cell = &cells[cell_idx];
+			valid = 
+				cell->size.x > 0 && cell->size.y > 0 &&
+				cell->pixels_offset + (uint64_t)cell->size.x*cell->size.y*bytes_per_pixel <= header->pixels_size;
+		}
+	}
+	if (!valid)
+	{
+		UnmapFile(&file);
+		return false;
+	}
+
+	sd->origin = header->origin;
+	sd->size = header->size;
+	if (header->num_colors > 0)
+	{
+		// Copied rather than pointed to, since the mapping goes away long before the palette does.
+		sd->format = SpriteFormat_Indexed;
+		sd->palette = ArenaAlloc(arena, PALETTE_SIZE, uint32_t);
+		sd->num_colors = header->num_colors;
+		SDL_memcpy(sd->palette, palette, sd->num_colors*sizeof(uint32_t));
+	}
+	sd->num_frames = header->num_frames;
+	sd->frames = ArenaAlloc(arena, sd->num_frames, SpriteFrame);
+	for (size_t frame_idx = 0, cell_base = 0; frame_idx < sd->num_frames; frame_idx += 1)
+	{
+		SpriteFrame* frame = &sd->frames[frame_idx];
+		frame->hitbox = (Rect){frames[frame_idx].hitbox_min, frames[frame_idx].hitbox_max};
+		frame->dur = frames[frame_idx].dur;
+		frame->num_cells = frames[frame_idx].num_cells;
+		if (frame->num_cells > 0)
+		{
+			frame->cells = ArenaAlloc(arena, frame->num_cells, SpriteCell);
+		}
+		for (size_t cell_idx = 0; cell_idx < frame->num_cells; cell_idx += 1)
+		{
+			SpriteBakeCell* src = &cells[cell_base + cell_idx];
+			frame->cells[cell_idx] = (SpriteCell)
+			{
+				.dst_buf = pixels + src->pixels_offset,
+				.hash = src->hash,
+				.origin = src->origin,
+				.size = src->size,
+				.z_idx = src->z_idx,
+				.layer_idx = src->layer_idx,
+				.format = sd->format,
+			};
+		}
+		cell_base += frame->num_cells;
+	}
+
+	// The mapping stays open, since the pixels get streamed straight out of it into the upload ring 
+	// (see VulkanStreamSpriteCells).
+	sd->bake = file;
+
+	return true;
+}
+
+static void SaveSpriteBake(SpriteDesc* sd, const char* bake_path, uint64_t source_hash, SpriteBakeFlags flags)
+{
+	SpriteBakeHeader header = 
+	{
+		.magic = SPRITE_BAKE_MAGIC,
+		.version = SPRITE_BAKE_VERSION,
+		.source_hash = source_hash,
+		.flags = flags,
+		.num_colors = (uint32_t)sd->num_colors,
+		.origin = sd->origin,
+		.size = sd->size,
+		.num_frames = (uint32_t)sd->num_frames,
+	};
+	for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1)
+	{
+		header.num_cells += (uint32_t)sd->frames[frame_idx].num_cells;
+	}
+
+	// Lay out the pixels first, so that cells with the same pixels can share them.
+	SpriteBakeCell* cells = SDL_calloc(SDL_max(header.num_cells, 1u), sizeof(SpriteBakeCell)); SDL_CHECK(cells);
+	const void** cell_pixels = SDL_calloc(SDL_max(header.num_cells, 1u), sizeof(void*)); SDL_CHECK(cell_pixels);
+	for (size_t frame_idx = 0, i = 0; frame_idx < sd->num_frames; frame_idx += 1)
+	{
+		SpriteFrame* frame = &sd->frames[frame_idx];
+		for (size_t cell_idx = 0; cell_idx < frame->num_cells; cell_idx += 1, i += 1)
+		{
+			SpriteCell* cell = &frame->cells[cell_idx];
+			SpriteCell* pixels_cell = cell->dup ? cell->dup : cell;
+			size_t cell_size = GetSpriteCellBufSize(cell);
+
+			cells[i] = (SpriteBakeCell)
+			{
+				.origin = cell->origin,
+				.size = cell->size,
+				.z_idx = cell->z_idx,
+				.layer_idx = cell->layer_idx,
+				.pixels_offset = header.pixels_size,
+				.hash = pixels_cell->hash,
+			};
+			cell_pixels[i] = pixels_cell->dst_buf;
+
+			bool shared = false;
+			for (size_t j = 0; j < i && !shared; j += 1)
+			{
+				if (cell_pixels[j] && 
+					cells[j].hash == cells[i].hash && 
+					cells[j].size.x == cells[i].size.x && cells[j].size.y == cells[i].size.y &&
+					SDL_memcmp(cell_pixels[j], cell_pixels[i], cell_size) == 0)
+				{
+					cells[i].pixels_offset = cells[j].pixels_offset;
+					shared = true;
+				}
+			}
+
+			if (shared)
+			{
+				cell_pixels[i] = NULL;
+			}
+			else
+			{
+				header.pixels_size += cell_size;
+			}
+		}
+	}
+	size_t tables_end = sizeof(SpriteBakeHeader) + header.num_frames*sizeof(SpriteBakeFrame) + header.num_cells*sizeof(SpriteBakeCell) + header.num_colors*sizeof(uint32_t);
+	header.pixels_offset = AlignForward(tables_end, SPRITE_BAKE_PIXELS_ALIGN);
+
+	size_t file_size = header.pixels_offset + header.pixels_size;
+	uint8_t* buf = SDL_calloc(1, file_size); SDL_CHECK(buf);
+	SDL_memcpy(buf, &header, sizeof(header));
+
+	SpriteBakeFrame* frames = (SpriteBakeFrame*)(buf + sizeof(SpriteBakeHeader));
+	for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1)
+	{
+		SpriteFrame* frame = &sd->frames[frame_idx];
+		frames[frame_idx] = (SpriteBakeFrame)
+		{
+			.hitbox_min = frame->hitbox.min,
+			.hitbox_max = frame->hitbox.max,
+			.dur = frame->dur,
+			.num_cells = (uint32_t)frame->num_cells,
+		};
+	}
+	SDL_memcpy(frames + header.num_frames, cells, header.num_cells*sizeof(SpriteBakeCell));
+	if (header.num_colors > 0)
+	{
+		SDL_memcpy((SpriteBakeCell*)(frames + header.num_frames) + header.num_cells, sd->palette, header.num_colors*sizeof(uint32_t));
+	}
+
+	uint8_t* pixels = buf + header.pixels_offset;
+	for (size_t i = 0; i < header.num_cells; i += 1)
+	{
+		if (cell_pixels[i])
+		{
+			SDL_memcpy(pixels + cells[i].pixels_offset, cell_pixels[i], (size_t)cells[i].size.x*cells[i].size.y*(header.num_colors > 0 ? sizeof(uint8_t) : sizeof(uint32_t)));
+		}
+	}
+
+	SDL_free(cell_pixels);
+	SDL_free(cells);
+
+	// The bake cache is only an optimization, so failing to write it isn't fatal.
+	if (!SDL_CreateDirectory(BAKE_CACHE_DIR) || !SDL_SaveFile(bake_path, buf, file_size))
+	{
+		SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Failed to write %s: %s", bake_path, SDL_GetError());
+	}
+
+	SDL_free(buf);
+}
+
+/**
+ * Linked cells point at the same compressed pixels as the cell they're linked to, and cells of
+ * a baked sprite point at the same pixels if SaveSpriteBake found that they were identical. 
+ * Either way, each of them becomes a duplicate of the first cell with those pixels, so that the
+ * pixels only get inflated once.
+ */
+static void LinkSpriteCells(SpriteDesc* sd)
+{
+	for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1)
+	{
+		SpriteFrame* frame = &sd->frames[frame_idx];
+		for (size_t cell_idx = 0; cell_idx < frame->num_cells; cell_idx += 1)
+		{
+			SpriteCell* cell = &frame->cells[cell_idx];
+			const void* pixels = cell->src_buf ? cell->src_buf : cell->dst_buf;
+			for (size_t prev_frame_idx = 0; prev_frame_idx <= frame_idx && !cell->dup; prev_frame_idx += 1)
+			{
+				SpriteFrame* prev_frame = &sd->frames[prev_frame_idx];
+				size_t num_prev_cells = prev_frame_idx == frame_idx ? cell_idx : prev_frame->num_cells;
+				for (size_t prev_cell_idx = 0; prev_cell_idx < num_prev_cells; prev_cell_idx += 1)
+				{
+					SpriteCell* prev = &prev_frame->cells[prev_cell_idx];
+					if (!prev->dup && (prev->src_buf ? prev->src_buf : prev->dst_buf) == pixels)
+					{
+						cell->dup = prev;
+						break;
+					}
+				}
+			}
+
+			if (cell->dup)
+			{
+				cell->src_buf = NULL;
+				cell->src_buf_size = 0;
+				cell->dst_buf = NULL;
+			}
+		}
+	}
+}
+
+// Straight alpha "over", the same blend the entity pipeline does.
+static uint32_t BlendPixel(uint32_t dst, uint32_t src)
+{
+	uint32_t src_a = src >> 24;
+	uint32_t dst_a = dst >> 24;
+	if (src_a == 255 || dst_a == 0) return src;
+	if (src_a == 0) return dst;
+
+	uint32_t dst_weight = dst_a*(255 - src_a)/255;
+	uint32_t out_a = src_a + dst_weight;
+	uint32_t res = out_a << 24;
+	for (uint32_t shift = 0; shift < 24; shift += 8)
+	{
+		uint32_t src_c = (src >> shift) & 0xFF;
+		uint32_t dst_c = (dst >> shift) & 0xFF;
+		res |= ((src_c*src_a + dst_c*dst_weight + out_a/2)/out_a) << shift;
+	}
+	return res;
+}
+
+// The cell that FlattenSpriteFrames turns a frame into, minus the pixels.
+static SpriteCell GetFlattenedSpriteFrame(SpriteDesc* sd, SpriteFrame* frame)
+{
+	SDL_assert(frame->num_cells > 0);
+	Rect bounds = {.min = {INT32_MAX, INT32_MAX}, .max = {INT32_MIN, INT32_MIN}};
+	for (size_t cell_idx = 0; cell_idx < frame->num_cells; cell_idx += 1)
+	{
+		SpriteCell* cell = &frame->cells[cell_idx];
+		bounds.min = glms_ivec2_minv(bounds.min, cell->origin);
+		bounds.max = glms_ivec2_maxv(bounds.max, glms_ivec2_add(cell->origin, cell->size));
+	}
+
+	return (SpriteCell)
+	{
+		.origin = bounds.min,
+		.size = glms_ivec2_sub(bounds.max, bounds.min),
+		.format = sd->format,
+	};
+}
+
+/**
+ * Composites the cells of each frame, in the order they would have been drawn in, into a single
+ * cell that covers all of them. After this, each frame costs one instance to draw instead of one 
+ * per cell, and overlapping cells don't get filled more than once. 
+ * 
+ * Only ever called on sprites that were just parsed, so every cell has either its own dst_buf 
+ * from SDL_malloc or a dup within the same sprite.
+ * 
+ * If pixels isn't NULL, the flattened frames go there one after the other, each one starting
+ * on a 4-byte boundary, instead of into buffers of their own. GetSpritePixelsSize says how big
+ * that has to be.
+ */
+static void FlattenSpriteFrames(SpriteDesc* sd, uint8_t* pixels)
+{
+	// Every frame has to be composited before any cell gets replaced, since a duplicate might 
+	// point at a cell of any other frame.
+	SpriteCell* flat_cells = SDL_calloc(sd->num_frames, sizeof(SpriteCell)); SDL_CHECK(flat_cells);
+	for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1)
+	{
+		SpriteFrame* frame = &sd->frames[frame_idx];
+		if (frame->num_cells == 0) continue;
+
+		SpriteCell* flat = &flat_cells[frame_idx];
+		*flat = GetFlattenedSpriteFrame(sd, frame);
+		Rect bounds = {flat->origin, glms_ivec2_add(flat->origin, flat->size)};
+		size_t dst_buf_size = GetSpriteCellBufSize(flat);
+		if (pixels)
+		{
+			flat->dst_buf = pixels;
+			pixels += AlignForward(dst_buf_size, 4);
+		}
+		else
+		{
+			flat->dst_buf = SDL_malloc(dst_buf_size); SDL_CHECK(flat->dst_buf);
+		}
+		SDL_memset(flat->dst_buf, sd->format == SpriteFormat_Indexed ? sd->transparent_idx : 0, dst_buf_size);
+
+		// The cells are already sorted with CompareSpriteCells.
+		for (size_t cell_idx = 0; cell_idx < frame->num_cells; cell_idx += 1)
+		{
+			SpriteCell* cell = &frame->cells[cell_idx];
+			const void* src = cell->dup ? cell->dup->dst_buf : cell->dst_buf;
+			SDL_assert(src);
+			ivec2s offset = glms_ivec2_sub(cell->origin, bounds.min);
+			for (int32_t y = 0; y < cell->size.y; y += 1)
+			{
+				size_t dst_row_start = (size_t)(offset.y + y)*flat->size.x + offset.x;
+				size_t src_row_start = (size_t)y*cell->size.x;
+				if (sd->format == SpriteFormat_Indexed)
+				{
+					// A blend of two palette colors usually isn't a palette color, so the cell on top
+					// just wins wherever it isn't transparent.
+					uint8_t* dst_row = (uint8_t*)flat->dst_buf + dst_row_start;
+					const uint8_t* src_row = (const uint8_t*)src + src_row_start;
+					for (int32_t x = 0; x < cell->size.x; x += 1)
+					{
+						if (sd->palette[src_row[x]] >> 24) dst_row[x] = src_row[x];
+					}
+				}
+				else
+				{
+					uint32_t* dst_row = (uint32_t*)flat->dst_buf + dst_row_start;
+					const uint32_t* src_row = (const uint32_t*)src + src_row_start;
+					for (int32_t x = 0; x < cell->size.x; x += 1)
+					{
+						dst_row[x] = BlendPixel(dst_row[x], src_row[x]);
+					}
+				}
+			}
+		}
+
+		flat->hash = XXH3_64bits(flat->dst_buf, dst_buf_size);
+	}
+
+	for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1)
+	{
+		SpriteFrame* frame = &sd->frames[frame_idx];
+		if (frame->num_cells == 0) continue;
+		for (size_t cell_idx = 0; cell_idx < frame->num_cells; cell_idx += 1)
+		{
+			SDL_free(frame->cells[cell_idx].dst_buf); // NULL for duplicates
+		}
+		frame->cells[0] = flat_cells[frame_idx];
+		frame->num_cells = 1;
+	}
+	SDL_free(flat_cells);
+}
+
+// How much of Context::sprite_pixels a sprite needs once LinkSpriteCells has run. A sprite that's 
+// about to be flattened only needs room for the flattened frames.
+static size_t GetSpritePixelsSize(SpriteDesc* sd, bool flatten)
+{
+	size_t res = 0;
+	for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1)
+	{
+		SpriteFrame* frame = &sd->frames[frame_idx];
+		if (flatten)
+		{
+			if (frame->num_cells == 0) continue;
+			SpriteCell flat = GetFlattenedSpriteFrame(sd, frame);
+			res += AlignForward(GetSpriteCellBufSize(&flat), 4);
+		}
+		else
+		{
+			for (size_t cell_idx = 0; cell_idx < frame->num_cells; cell_idx += 1)
+			{
+				SpriteCell* cell = &frame->cells[cell_idx];
+				if (!cell->dup) res += AlignForward(GetSpriteCellBufSize(cell), 4);
+			}
+		}
+	}
+	return res;
+}
+
+typedef struct SpriteLoadTask
+{
+	char* path;
+	SpriteDesc* sd;
+	char bake_path[64];
+	SpriteBakeFlags bake_flags;
+
+	MappedFile source; // only kept mapped if the sprite has to be parsed
+	uint64_t source_hash;
+	bool warm;
+
+	// Where FlattenSpriteFrames puts its output, if the sprite has to be flattened.
+	uint8_t* pixels;
+
+	// Filled in by LoadSpriteJob, inside the arena of whichever thread ran it.
+	SpriteDesc parsed;
+} SpriteLoadTask;
+
+typedef struct SpriteLoad
+{
+	SpriteLoadTask* tasks; size_t num_tasks;
+	SpriteCell** cells; size_t num_cells; // the cells that still need to be inflated
+	bool rebake;
+} SpriteLoad;
+
+static void LoadSpriteJob(void* user_data, size_t job_idx, JobThread* thread)
+{
+	SpriteLoad* load = user_data;
+	SpriteLoadTask* task = &load->tasks[job_idx];
+
+	// The bake cache is keyed on the contents of the source file rather than its timestamp, 
+	// so a stale entry gets rebuilt no matter how the .aseprite file was changed.
+	// The same mapping is then parsed in place if the bake turns out to be stale.
+	bool mapped = MapFile(task->path, &task->source); SDL_assert(mapped);
+	task->source_hash = XXH3_64bits(task->source.data, task->source.size);
+
+	task->warm = !load->rebake && LoadSpriteBake(&thread->arena, &task->parsed, task->bake_path, task->source_hash, task->bake_flags);
+	if (task->warm)
+	{
+		UnmapFile(&task->source);
+	}
+	else
+	{
+		ParseSpriteAseprite(&thread->arena, &thread->stack, &task->parsed, task->source.data, task->source.size);
+	}
+}
+
+static void DecodeSpriteCellJob(void* user_data, size_t job_idx, JobThread* thread)
+{
+	UNUSED(thread);
+	SpriteLoad* load = user_data;
+	DecodeSpriteCell(load->cells[job_idx]);
+}
+
+static void SaveSpriteBakeJob(void* user_data, size_t job_idx, JobThread* thread)
+{
+	UNUSED(thread);
+	SpriteLoad* load = user_data;
+	SpriteLoadTask* task = &load->tasks[job_idx];
+	if (!task->warm)
+	{
+		if (task->bake_flags & SpriteBakeFlags_Flattened)
+		{
+			FlattenSpriteFrames(task->sd, task->pixels);
+		}
+		SaveSpriteBake(task->sd, task->bake_path, task->source_hash, task->bake_flags);
+	}
+}
+
+/**
+ * Sprites are loaded in three parallel passes over ctx->jobs:
+ * 
+ * 1. LoadSpriteJob, one job per sprite: map the source, then either map the bake or parse the 
+ *    .aseprite file. Frames and cells go into the arena of the thread that ran the job.
+ * 2. DecodeSpriteCellJob, one job per cell: inflate every cell of every sprite that was parsed,
+ *    except for the ones LinkSpriteCells found to be duplicates. Cells get inflated straight into
+ *    their final place in ctx->sprite_pixels, which gets sized from the cell headers alone. The
+ *    only exception is the layers of a sprite that's about to be flattened: those go into 
+ *    scratch buffers, and the flattened frames go into ctx->sprite_pixels instead. Baked sprites
+ *    need no room at all, since their pixels stay in the mapped bake until they're streamed.
+ * 3. SaveSpriteBakeJob, one job per sprite: flatten (if requested) and write the bake for every
+ *    sprite that was parsed. Flattened sprites are baked flattened, so a warm load skips that too.
+ * 
+ * In between the first two passes, the results are copied into ctx->arena and ctx->sprites on 
+ * the calling thread, in the order the sprites were requested. That way, the final layout of
+ * everything doesn't depend on which thread happened to load what.
+ */
+static void LoadSprites(Context* ctx, SpriteLoadRequest* requests, size_t num_requests)
+{
+	SPALL_BUFFER_BEGIN();
+	uint64_t start_ns = SDL_GetTicksNS();
+
+	SpriteLoad load = 
+	{
+		.tasks = StackAlloc(&ctx->stack, num_requests, SpriteLoadTask),
+		.num_tasks = num_requests,
+		.rebake = ctx->rebake,
+	};
+
+	for (size_t request_idx = 0; request_idx < num_requests; request_idx += 1)
+	{
+		char* path = requests[request_idx].path;
+		SDL_CHECK(SDL_GetPathInfo(path, NULL));
+
+		Sprite sprite = GetSprite(path);
+		SpriteDesc* sd = GetSpriteDesc(ctx, sprite);
+		SDL_assert(!sd && "Collision");
+		sd = &ctx->sprites[sprite.idx];
+		*requests[request_idx].sprite = sprite;
+
+		// SetSpriteName (we need this for vkSetDebugUtilsObjectNameEXT)
+		{
+			size_t buf_size = SDL_strlen(path) + 1;
+			sd->name = ArenaAllocRaw(&ctx->arena, buf_size, 1);
+			SDL_strlcpy(sd->name, path, buf_size);
+		}
+
+		SpriteLoadTask* task = &load.tasks[request_idx];
+		task->path = path;
+		task->sd = sd;
+		task->parsed.name = sd->name;
+		task->bake_flags = requests[request_idx].flatten ? SpriteBakeFlags_Flattened : 0;
+		GetSpriteBakePath(path, task->bake_path, sizeof(task->bake_path));
+	}
+
+	SPALL_BUFFER_BEGIN_NAME("LoadSpriteJob");
+	RunJobs(&ctx->jobs, load.num_tasks, LoadSpriteJob, &load);
+	SPALL_BUFFER_END();
+	uint64_t parse_end_ns = SDL_GetTicksNS();
+
+	// MergeSprites
+	for (size_t task_idx = 0; task_idx < load.num_tasks; task_idx += 1)
+	{
+		SpriteLoadTask* task = &load.tasks[task_idx];
+		SpriteDesc* sd = task->sd;
+		sd->origin = task->parsed.origin;
+		sd->size = task->parsed.size;
+		sd->bake = task->parsed.bake;
+		sd->format = task->parsed.format;
+		sd->transparent_idx = task->parsed.transparent_idx;
+		if (sd->format == SpriteFormat_Indexed)
+		{
+			sd->palette = ArenaAlloc(&ctx->arena, PALETTE_SIZE, uint32_t);
+			sd->num_colors = task->parsed.num_colors;
+			SDL_memcpy(sd->palette, task->parsed.palette, PALETTE_SIZE*sizeof(uint32_t));
+		}
+		sd->num_frames = task->parsed.num_frames;
+		sd->frames = ArenaAlloc(&ctx->arena, sd->num_frames, SpriteFrame);
+		for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1)
+		{
+			SpriteFrame* frame = &sd->frames[frame_idx];
+			*frame = task->parsed.frames[frame_idx];
+			if (frame->num_cells > 0)
+			{
+				frame->cells = ArenaAlloc(&ctx->arena, frame->num_cells, SpriteCell);
+				SDL_memcpy(frame->cells, task->parsed.frames[frame_idx].cells, frame->num_cells*sizeof(SpriteCell));
+			}
+		}
+
+		// Only now that the cells have reached their final address can they point at each other.
+		LinkSpriteCells(sd);
+		BuildSpriteHitboxes(&ctx->arena, sd);
+		for (size_t frame_idx = 0; frame_idx < sd->num_frames && !task->warm; frame_idx += 1)
+		{
+			SpriteFrame* frame = &sd->frames[frame_idx];
+			for (size_t cell_idx = 0; cell_idx < frame->num_cells; cell_idx += 1)
+			{
+				if (!frame->cells[cell_idx].dup) load.num_cells += 1;
+			}
+		}
+
+		if (task->warm) ctx->sprite_load_stats.num_warm += 1;
+		else ctx->sprite_load_stats.num_cold += 1;
+		ctx->num_sprites += 1;
+	}
+	ResetJobArenas(&ctx->jobs);
+
+	// AllocateSpritePixels
+	{
+		SDL_assert(!ctx->sprite_pixels);
+
+		size_t pixels_size = 0;
+		for (size_t task_idx = 0; task_idx < load.num_tasks; task_idx += 1)
+		{
+			SpriteLoadTask* task = &load.tasks[task_idx];
+			if (task->warm) continue;
+			pixels_size += GetSpritePixelsSize(task->sd, task->bake_flags & SpriteBakeFlags_Flattened);
+		}
+		ctx->sprite_pixels = SDL_malloc(SDL_max(pixels_size, (size_t)1)); SDL_CHECK(ctx->sprite_pixels);
+
+		uint8_t* pixels = ctx->sprite_pixels;
+		for (size_t task_idx = 0; task_idx < load.num_tasks; task_idx += 1)
+		{
+			SpriteLoadTask* task = &load.tasks[task_idx];
+			SpriteDesc* sd = task->sd;
+			if (task->warm) continue;
+			if (task->bake_flags & SpriteBakeFlags_Flattened)
+			{
+				task->pixels = pixels;
+				pixels += GetSpritePixelsSize(sd, true);
+				continue;
+			}
+
+			for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1)
+			{
+				SpriteFrame* frame = &sd->frames[frame_idx];
+				for (size_t cell_idx = 0; cell_idx < frame->num_cells; cell_idx += 1)
+				{
+					SpriteCell* cell = &frame->cells[cell_idx];
+					if (cell->dup) continue;
+					cell->dst_buf = pixels;
+					pixels += AlignForward(GetSpriteCellBufSize(cell), 4);
+				}
+			}
+		}
+		SDL_assert(pixels == ctx->sprite_pixels + pixels_size);
+		ctx->sprite_load_stats.pixels_size += pixels_size;
+	}
+
+	load.cells = StackAlloc(&ctx->stack, load.num_cells, SpriteCell*);
+	for (size_t task_idx = 0, cell_idx = 0; task_idx < load.num_tasks; task_idx += 1)
+	{
+		SpriteLoadTask* task = &load.tasks[task_idx];
+		if (task->warm) continue;
+		for (size_t frame_idx = 0; frame_idx < task->sd->num_frames; frame_idx += 1)
+		{
+			SpriteFrame* frame = &task->sd->frames[frame_idx];
+			for (size_t i = 0; i < frame->num_cells; i += 1)
+			{
+				if (!frame->cells[i].dup) load.cells[cell_idx++] = &frame->cells[i];
+			}
+		}
+	}
+
+	SPALL_BUFFER_BEGIN_NAME("DecodeSpriteCellJob");
+	RunJobs(&ctx->jobs, load.num_cells, DecodeSpriteCellJob, &load);
+	SPALL_BUFFER_END();
+	uint64_t decode_end_ns = SDL_GetTicksNS();
+
+	SPALL_BUFFER_BEGIN_NAME("SaveSpriteBakeJob");
+	RunJobs(&ctx->jobs, load.num_tasks, SaveSpriteBakeJob, &load);
+	SPALL_BUFFER_END();
+
+	for (size_t task_idx = 0; task_idx < load.num_tasks; task_idx += 1)
+	{
+		UnmapFile(&load.tasks[task_idx].source);
+	}
+
+	ctx->sprite_load_stats.num_cells_decoded += load.num_cells;
+	ctx->sprite_load_stats.parse_ns += parse_end_ns - start_ns;
+	ctx->sprite_load_stats.decode_ns += decode_end_ns - parse_end_ns;
+	ctx->sprite_load_stats.total_ns += SDL_GetTicksNS() - start_ns;
+
+	StackFree(&ctx->stack, load.cells);
+	StackFree(&ctx->stack, load.tasks);
+	SPALL_BUFFER_END();
+}
+
+static bool SpriteCellPixelsEqual(SpriteCell* a, SpriteCell* b)
+{
+	return 
+		a->hash == b->hash && 
+		a->format == b->format &&
+		a->size.x == b->size.x && a->size.y == b->size.y &&
+		SDL_memcmp(a->dst_buf, b->dst_buf, GetSpriteCellBufSize(a)) == 0;
+}
+
+// Smallest rectangle that contains every pixel of the cell that isn't fully transparent.
+static Rect GetSpriteCellTrim(SpriteDesc* sd, SpriteCell* cell)
+{
+	SDL_assert(cell->dst_buf);
+	Rect res = {.min = cell->size, .max = {0, 0}};
+	for (int32_t y = 0; y < cell->size.y; y += 1)
+	{
+		for (int32_t x = 0; x < cell->size.x; x += 1)
+		{
+			size_t pixel_idx = (size_t)y*cell->size.x + x;
+			uint32_t color = cell->format == SpriteFormat_Indexed ? 
+				sd->palette[((const uint8_t*)cell->dst_buf)[pixel_idx]] : 
+				((const uint32_t*)cell->dst_buf)[pixel_idx];
+			if (color >> 24) 
+			{
+				res.min.x = SDL_min(res.min.x, x);
+				res.min.y = SDL_min(res.min.y, y);
+				res.max.x = SDL_max(res.max.x, x + 1);
+				res.max.y = SDL_max(res.max.y, y + 1);
+			}
+		}
+	}
+
+	// Keep one texel of a cell that's completely empty so that it still has somewhere to live.
+	if (res.max.x <= res.min.x || res.max.y <= res.min.y)
+	{
+		res = (Rect){.min = {0, 0}, .max = {1, 1}};
+	}
+	return res;
+}
+
+// Shelf packing: cells go left to right along a shelf, and once a shelf is full a new one starts
+// below it. Returns the number of pages it took.
+static size_t PackSpriteCells(SpriteCell** cells, size_t num_cells, int32_t page_size)
+{
+	size_t page = 0;
+	ivec2s pos = {0, 0};
+	int32_t shelf_height = 0;
+	for (size_t cell_idx = 0; cell_idx < num_cells; cell_idx += 1)
+	{
+		SpriteCell* cell = cells[cell_idx];
+		ivec2s size = glms_ivec2_adds(glms_ivec2_sub(cell->trim.max, cell->trim.min), ATLAS_PADDING);
+		SDL_assert(size.x <= page_size && size.y <= page_size);
+
+		if (pos.x + size.x > page_size)
+		{
+			pos.x = 0;
+			pos.y += shelf_height;
+			shelf_height = 0;
+		}
+		if (pos.y + size.y > page_size)
+		{
+			page += 1;
+			pos = (ivec2s){0, 0};
+			shelf_height = 0;
+		}
+
+		cell->atlas_pos = pos;
+		cell->atlas_page = (uint32_t)page;
+		pos.x += size.x;
+		shelf_height = SDL_max(shelf_height, size.y);
+	}
+	return page + 1;
+}
+
+/**
+ * Trims every cell down to its non-transparent pixels and packs all of them into ctx->atlas, a
+ * texture array whose layers are the pages. The page size is the smallest power of two that
+ * fits everything onto one page, up to ATLAS_MAX_PAGE_SIZE; past that, we just add more pages.
+ * The tileset doesn't get trimmed, since tiles can point anywhere inside of it.
+ * 
+ * Before any of that, cells with the same pixels (across every sprite, not just within one) are
+ * found by their hash, and only the first of them gets packed. The rest become duplicates of it.
+ */
+static void PackSpriteAtlas(Context* ctx)
+{
+	SPALL_BUFFER_BEGIN();
+
+	size_t num_cells = 0;
+	for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
+	{
+		SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
+		if (!sd) continue;
+		for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1) 
+		{
+			num_cells += sd->frames[frame_idx].num_cells;
+		}
+	}
+
+	SpriteCell** cells = StackAlloc(&ctx->stack, num_cells, SpriteCell*);
+
+	// Open addressing, keyed on SpriteCell::hash.
+	size_t table_size = 1;
+	while (table_size < num_cells*2) table_size *= 2;
+	SpriteCell** table = StackAlloc(&ctx->stack, table_size, SpriteCell*);
+
+	int64_t area[SpriteFormat_Count] = {0};
+	int32_t max_size[SpriteFormat_Count] = {0};
+	size_t num_dups[SpriteFormat_Count] = {0};
+	size_t i = 0;
+	for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
+	{
+		SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
+		if (!sd) continue;
+		for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1) 
+		{
+			SpriteFrame* sf = &sd->frames[frame_idx];
+			for (size_t cell_idx = 0; cell_idx < sf->num_cells; cell_idx += 1) 
+			{
+				SpriteCell* cell = &sf->cells[cell_idx];
+				if (cell->dup)
+				{
+					num_dups[cell->format] += 1;
+					continue;
+				}
+
+				if (sprite_idx == spr_tiles.idx)
+				{
+					cell->trim = (Rect){.min = {0, 0}, .max = cell->size};
+				}
+				else
+				{
+					cell->trim = GetSpriteCellTrim(sd, cell);
+				}
+
+				// The tileset isn't allowed to share, since it doesn't get trimmed. The trims have
+				// to match too, since indexed cells with the same pixels might not have the same
+				// palette.
+				if (sprite_idx != spr_tiles.idx)
+				{
+					size_t slot = (size_t)cell->hash & (table_size - 1);
+					while (table[slot] && 
+						!(SpriteCellPixelsEqual(table[slot], cell) && SDL_memcmp(&table[slot]->trim, &cell->trim, sizeof(Rect)) == 0))
+					{
+						slot = (slot + 1) & (table_size - 1);
+					}
+					if (table[slot])
+					{
+						cell->dup = table[slot];
+						cell->dst_buf = NULL; // its place in ctx->sprite_pixels just goes unused
+						num_dups[cell->format] += 1;
+						continue;
+					}
+					table[slot] = cell;
+				}
+
+				ivec2s size = glms_ivec2_adds(glms_ivec2_sub(cell->trim.max, cell->trim.min), ATLAS_PADDING);
+				area[cell->format] += (int64_t)size.x*size.y;
+				max_size[cell->format] = SDL_max(max_size[cell->format], SDL_max(size.x, size.y));
+				cells[i++] = cell;
+			}
+		}
+	}
+	num_cells = i;
+
+	SDL_qsort(cells, num_cells, sizeof(SpriteCell*), (SDL_CompareCallback)CompareSpriteCellsBySize);
+
+	// The cells are now grouped by format, and each format gets packed into its own atlas.
+	size_t first_cell = 0;
+	for (SpriteFormat format = 0; format < SpriteFormat_Count; format += 1)
+	{
+		size_t num_format_cells = 0;
+		while (first_cell + num_format_cells < num_cells && cells[first_cell + num_format_cells]->format == format) 
+		{
+			num_format_cells += 1;
+		}
+
+		// An empty atlas still needs an image to bind, so it gets a single texel.
+		int32_t page_size = 1;
+		size_t num_pages = 1;
+		if (num_format_cells > 0)
+		{
+			// No point in trying a page size that can't possibly fit everything.
+			page_size = ATLAS_MIN_PAGE_SIZE;
+			while (page_size < max_size[format]) page_size *= 2;
+			while (page_size < ATLAS_MAX_PAGE_SIZE && (int64_t)page_size*page_size < area[format]) page_size *= 2;
+
+			for (;;)
+			{
+				num_pages = PackSpriteCells(&cells[first_cell], num_format_cells, page_size);
+				if (num_pages == 1 || page_size >= ATLAS_MAX_PAGE_SIZE) break;
+				page_size *= 2;
+			}
+		}
+
+		ctx->atlases[format] = (SpriteAtlas)
+		{
+			.page_size = page_size,
+			.num_pages = num_pages,
+			.num_cells = num_format_cells,
+			.num_dups = num_dups[format],
+		};
+		first_cell += num_format_cells;
+	}
+
+	// Every indexed sprite gets its own row in the palette texture.
+	for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
+	{
+		SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
+		if (sd && sd->format == SpriteFormat_Indexed)
+		{
+			sd->palette_idx = ctx->vk.num_palettes++;
+		}
+	}
+
+	// A linked cell might have been linked to a cell that has since turned out to be a duplicate.
+	for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
+	{
+		SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
+		if (!sd) continue;
+		for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1) 
+		{
+			SpriteFrame* sf = &sd->frames[frame_idx];
+			for (size_t cell_idx = 0; cell_idx < sf->num_cells; cell_idx += 1) 
+			{
+				SpriteCell* cell = &sf->cells[cell_idx];
+				if (!cell->dup) continue;
+				while (cell->dup->dup) cell->dup = cell->dup->dup;
+				cell->trim = cell->dup->trim;
+				cell->atlas_pos = cell->dup->atlas_pos;
+				cell->atlas_page = cell->dup->atlas_page;
+			}
+		}
+	}
+
+	StackFree(&ctx->stack, table);
+	StackFree(&ctx->stack, cells);
+	SPALL_BUFFER_END();
+}
+
+typedef struct WorldBakeBuilder
+{
+	uint8_t* buf; size_t size; size_t cap;
+	LevelBakeLevel* levels; size_t num_levels; size_t cap_levels;
+	LevelBakeEntity* entities; size_t num_entities; size_t cap_entities;
+	bool found_player;
+} WorldBakeBuilder;
+
+// Returns size zeroed bytes at the end of the bake. Only valid until the next call.
+static void* ReserveWorldBake(WorldBakeBuilder* builder, size_t size)
+{
+	if (builder->size + size > builder->cap)
+	{
+		builder->cap = SDL_max(builder->cap*2, builder->size + size);
+		builder->buf = SDL_realloc(builder->buf, builder->cap); SDL_CHECK(builder->buf);
+	}
+	void* res = builder->buf + builder->size;
+	SDL_memset(res, 0, size);
+	builder->size += size;
+	return res;
+}
+
+static LevelBakeEntity* AddWorldBakeEntity(WorldBakeBuilder* builder)
+{
+	if (builder->num_entities == builder->cap_entities)
+	{
+		builder->cap_entities = SDL_max(builder->cap_entities*2, (size_t)64);
+		builder->entities = SDL_realloc(builder->entities, builder->cap_entities*sizeof(LevelBakeEntity)); SDL_CHECK(builder->entities);
+	}
+	LevelBakeEntity* res = &builder->entities[builder->num_entities++];
+	*res = (LevelBakeEntity){0};
+	return res;
+}
+
+// Called by LdtkReadLevels for every level of the project.
+static bool BakeWorldLevel(void* user_data, LdtkLevel* ldtk)
+{
+	WorldBakeBuilder* builder = user_data;
+
+	ivec2s size = {ldtk->px_size.x/TILE_SIZE, ldtk->px_size.y/TILE_SIZE};
+	SDL_assert(size.x > 0 && size.y > 0);
+	SDL_assert(ldtk->world_pos.x % TILE_SIZE == 0 && ldtk->world_pos.y % TILE_SIZE == 0);
+
+	// Tile layers get drawn in this order.
+	LdtkLayer* tile_layers[3] = {0};
+	LdtkLayer* collision_layer = NULL;
+	for (size_t layer_idx = 0; layer_idx < ldtk->num_layers; layer_idx += 1)
+	{
+		LdtkLayer* layer = &ldtk->layers[layer_idx];
+		if (LDTK_STRING_IS(layer->type, "Tiles"))
+		{
+			if (LDTK_STRING_IS(layer->identifier, "Tiles")) 
+			{
+				tile_layers[0] = layer;
+			} 
+			else if (LDTK_STRING_IS(layer->identifier, "Props")) 
+			{
+				tile_layers[1] = layer;
+			} 
+			else if (LDTK_STRING_IS(layer->identifier, "Grass")) 
+			{
+				tile_layers[2] = layer;
+			} 
+			else 
+			{
+				SDL_assert(!"Invalid layer!");
+			}
+		}
+		else if (LDTK_STRING_IS(layer->identifier, "Player"))
+		{
+			if (!builder->found_player && layer->num_entities > 0)
+			{
+				builder->entities[0].start_pos = layer->entities[0].world_pos;
+				builder->entities[0].type = EntityType_Player;
+				builder->found_player = true;
+			}
+		}
+		else if (LDTK_STRING_IS(layer->identifier, "Enemies"))
+		{
+			for (size_t entity_idx = 0; entity_idx < layer->num_entities; entity_idx += 1)
+			{
+				LdtkEntity* src = &layer->entities[entity_idx];
+				LevelBakeEntity* enemy = AddWorldBakeEntity(builder);
+				enemy->start_pos = src->world_pos;
+				if (LDTK_STRING_IS(src->identifier, "Boar")) 
+				{
+					enemy->type = EntityType_Boar;
+				} // else if (LDTK_STRING_IS(src->identifier, "")) {}
+			}
+		}
+		else if (LDTK_STRING_IS(layer->identifier, "IntGrid"))
+		{
+			collision_layer = layer;
+		}
+	}
+
+	if (builder->num_levels == builder->cap_levels)
+	{
+		builder->cap_levels = SDL_max(builder->cap_levels*2, (size_t)16);
+		builder->levels = SDL_realloc(builder->levels, builder->cap_levels*sizeof(LevelBakeLevel)); SDL_CHECK(builder->levels);
+	}
+	LevelBakeLevel* level = &builder->levels[builder->num_levels++];
+	*level = (LevelBakeLevel)
+	{
+		.pos = ldtk->world_pos,
+		.size = size,
+		.offset = builder->size,
+	};
+
+	for (size_t tile_layer_idx = 0; tile_layer_idx < SDL_arraysize(tile_layers); tile_layer_idx += 1)
+	{
+		LdtkLayer* layer = tile_layers[tile_layer_idx];
+		if (!layer || layer->num_tiles == 0) continue;
+
+		static_assert(sizeof(LdtkTile) == sizeof(Tile));
+		Tile* tiles = ReserveWorldBake(builder, layer->num_tiles*sizeof(Tile));
+		for (size_t tile_idx = 0; tile_idx < layer->num_tiles; tile_idx += 1)
+		{
+			tiles[tile_idx].src = layer->tiles[tile_idx].src;
+			tiles[tile_idx].dst = glms_ivec2_add(layer->tiles[tile_idx].dst, ldtk->world_pos);
+		}
+		level->num_tiles += (uint32_t)layer->num_tiles;
+	}
+
+	size_t num_cells = (size_t)size.x*size.y;
+	uint8_t* collision = ReserveWorldBake(builder, num_cells);
+	if (collision_layer)
+	{
+		SDL_assert(collision_layer->num_int_grid == num_cells);
+		SDL_memcpy(collision, collision_layer->int_grid, SDL_min(num_cells, collision_layer->num_int_grid));
+	}
+	ReserveWorldBake(builder, AlignForward(builder->size, 16) - builder->size);
+
+	return true;
+}
+
+/**
+ * Bakes every level of an LDtk project into one buffer with the layout in bake.h. This only runs 
+ * when the bake is missing or stale, see LoadWorldBake. The project is read one level at a time, 
+ * so the bake itself is the only thing that ever holds more than one level.
+ */
+static void* BakeWorldLdtk(const void* data, size_t data_size, uint64_t source_hash, size_t* out_size)
+{
+	WorldBakeBuilder builder = {0};
+	ReserveWorldBake(&builder, sizeof(LevelBakeHeader));
+	AddWorldBakeEntity(&builder); // the player
+
+	// Once it has been read, a level never takes up more memory than its JSON did, so this is 
+	// always enough. The extra space is for padding between arrays.
+	size_t scratch_size = data_size + 4096;
+	void* scratch = SDL_malloc(scratch_size); SDL_CHECK(scratch);
+	bool read = LdtkReadLevels(data, data_size, scratch, scratch_size, BakeWorldLevel, &builder);
+	if (!read) SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s", SDL_GetError());
+	SDL_assert(read);
+	SDL_free(scratch);
+	SDL_assert(builder.num_levels > 0 && builder.found_player);
+
+	ReserveWorldBake(&builder, AlignForward(builder.size, 8) - builder.size);
+	uint64_t levels_offset = builder.size;
+	SDL_memcpy(ReserveWorldBake(&builder, builder.num_levels*sizeof(LevelBakeLevel)), builder.levels, builder.num_levels*sizeof(LevelBakeLevel));
+	uint64_t entities_offset = builder.size;
+	SDL_memcpy(ReserveWorldBake(&builder, builder.num_entities*sizeof(LevelBakeEntity)), builder.entities, builder.num_entities*sizeof(LevelBakeEntity));
+
+	LevelBakeHeader header = 
+	{
+		.magic = LEVEL_BAKE_MAGIC,
+		.version = LEVEL_BAKE_VERSION,
+		.source_hash = source_hash,
+		.num_levels = (uint32_t)builder.num_levels,
+		.num_entities = (uint32_t)builder.num_entities,
+		.levels_offset = levels_offset,
+		.entities_offset = entities_offset,
+	};
+	SDL_memcpy(builder.buf, &header, sizeof(header));
+
+	SDL_free(builder.levels);
+	SDL_free(builder.entities);
+	*out_size = builder.size;
+	return builder.buf;
+}
+
+static void GetLevelBakePath(char* path, char* buf, size_t buf_size)
+{
+	SDL_snprintf(buf, buf_size, BAKE_CACHE_DIR "/%016llx.level", (unsigned long long)HashString(path, 0));
+}
+
+/**
+ * Sets up the world from a bake made by BakeWorldLdtk. Nothing gets loaded yet: every level
+ * points into the bake, which is why it stays around for as long as the world does, and only gets
+ * copied out of it once the level is needed (see LoadLevelIntoSlot). Only the entities get copied
+ * right away, since those change as the game runs.
+ */
+static bool LoadWorldBake(Arena* arena, World* world, MappedFile bake, uint64_t source_hash)
+{
+	bool valid = bake.size >= sizeof(LevelBakeHeader);
+	LevelBakeHeader* header = bake.data;
+	LevelBakeLevel* levels = NULL;
+	LevelBakeEntity* entities = NULL;
+	if (valid)
+	{
+		valid = 
+			header->magic == LEVEL_BAKE_MAGIC && 
+			header->version == LEVEL_BAKE_VERSION && 
+			header->source_hash == source_hash &&
+			header->num_levels > 0 && header->num_entities > 0 &&
+			header->levels_offset % alignof(LevelBakeLevel) == 0 &&
+			header->levels_offset + header->num_levels*sizeof(LevelBakeLevel) <= bake.size &&
+			header->entities_offset % alignof(LevelBakeEntity) == 0 &&
+			header->entities_offset + header->num_entities*sizeof(LevelBakeEntity) <= bake.size;
+	}
+	if (valid)
+	{
+		levels = (LevelBakeLevel*)((uint8_t*)bake.data + header->levels_offset);
+		entities = (LevelBakeEntity*)((uint8_t*)bake.data + header->entities_offset);
+		for (size_t level_idx = 0; level_idx < header->num_levels && valid; level_idx += 1)
+		{
+			LevelBakeLevel* level = &levels[level_idx];
+			valid = 
+				level->size.x > 0 && level->size.y > 0 && 
+				level->offset % alignof(Tile) == 0 &&
+				level->offset + level->num_tiles*sizeof(Tile) + (uint64_t)level->size.x*level->size.y <= bake.size;
+		}
+	}
+	if (!valid) return false;
+
+	world->num_levels = header->num_levels;
+	world->levels = ArenaAlloc(arena, world->num_levels, Level);
+	world->bounds = (Rect){levels[0].pos, levels[0].pos};
+	for (size_t level_idx = 0; level_idx < world->num_levels; level_idx += 1)
+	{
+		LevelBakeLevel* src = &levels[level_idx];
+		Level* level = &world->levels[level_idx];
+		level->pos = src->pos;
+		level->size = src->size;
+		level->bake_tiles = (Tile*)((uint8_t*)bake.data + src->offset);
+		level->num_tiles = src->num_tiles;
+		level->bake_collision = (uint8_t*)(level->bake_tiles + level->num_tiles);
+
+		world->bounds.min = glms_ivec2_minv(world->bounds.min, level->pos);
+		world->bounds.max = glms_ivec2_maxv(world->bounds.max, glms_ivec2_add(level->pos, glms_ivec2_scale(level->size, TILE_SIZE)));
+		world->max_tiles_per_level = SDL_max(world->max_tiles_per_level, level->num_tiles);
+		world->max_collision_words = SDL_max(world->max_collision_words, GetCollisionGridWords(level->size));
+	}
+
+	for (size_t entity_idx = 0; entity_idx < header->num_entities; entity_idx += 1)
+	{
+		if (entities[entity_idx].type >= EntityType_Count) return false;
+	}
+
+	// entities[0] is the player, and the rest get sorted by type.
+	world->player.start_pos = entities[0].start_pos;
+	world->player.type = EntityType_Player;
+
+	EntityStore* store = &world->enemies;
+	AllocEntityStore(store, header->num_entities - 1);
+	for (size_t entity_idx = 1; entity_idx < header->num_entities; entity_idx += 1)
+	{
+		store->type_starts[entities[entity_idx].type + 1] += 1;
+	}
+	for (EntityType type = 0; type < EntityType_Count; type += 1)
+	{
+		store->type_starts[type + 1] += store->type_starts[type];
+	}
+	size_t type_ends[EntityType_Count];
+	SDL_memcpy(type_ends, store->type_starts, sizeof(type_ends));
+	for (size_t entity_idx = 1; entity_idx < header->num_entities; entity_idx += 1)
+	{
+		store->start_pos[type_ends[entities[entity_idx].type]++] = entities[entity_idx].start_pos;
+	}
+
+	world->entity_grid.rects = SDL_malloc(SDL_max(store->count, (size_t)1)*sizeof(Rect)); SDL_CHECK(world->entity_grid.rects);
+	world->entity_grid.query_marks = SDL_calloc(SDL_max(store->count, (size_t)1), sizeof(uint32_t)); SDL_CHECK(world->entity_grid.query_marks);
+	world->bake = bake;
+
+	return true;
+}
+
+// Runs on the world streamer.
+static void LoadLevelIntoSlot(LevelSlot* slot)
+{
+	Level* level = slot->level;
+	if (level->num_tiles > 0)
+	{
+		SDL_memcpy(slot->staging_tiles, level->bake_tiles, level->num_tiles*sizeof(Tile));
+	}
+
+	CollisionGrid* grid = &slot->collision;
+	grid->row_stride = ((size_t)level->size.x + 63)/64;
+	grid->col_stride = ((size_t)level->size.y + 63)/64;
+	grid->cols = grid->rows + (size_t)level->size.y*grid->row_stride;
+	SDL_memset(grid->rows, 0, GetCollisionGridWords(level->size)*sizeof(uint64_t));
+	for (size_t y = 0; y < (size_t)level->size.y; y += 1)
+	{
+		for (size_t x = 0; x < (size_t)level->size.x; x += 1)
+		{
+			if (level->bake_collision[x + y*(size_t)level->size.x])
+			{
+				grid->rows[y*grid->row_stride + x/64] |= 1ULL << (x%64);
+				grid->cols[x*grid->col_stride + y/64] |= 1ULL << (y%64);
+			}
+		}
+	}
+}
+
+static int32_t SDLCALL WorldStreamer(void* data)
+{
+	World* world = data;
+
+	SDL_LockMutex(world->mutex);
+	for (;;)
+	{
+		while (!world->quit && world->num_requests == 0)
+		{
+			SDL_WaitCondition(world->requests_available, world->mutex);
+		}
+		if (world->quit) break;
+		LevelSlot* slot = &world->slots[world->requests[0]];
+		world->num_requests -= 1;
+		SDL_memmove(&world->requests[0], &world->requests[1], world->num_requests*sizeof(size_t));
+
+		SDL_UnlockMutex(world->mutex);
+		LoadLevelIntoSlot(slot);
+		SDL_LockMutex(world->mutex);
+
+		slot->loaded = true;
+		SDL_BroadcastCondition(world->level_loaded);
+	}
+	SDL_UnlockMutex(world->mutex);
+
+	return 0;
+}
+
+// Chebyshev distance between a point and the closest pixel of a level, both relative to the world.
+static int32_t GetDistanceToLevel(Level* level, ivec2s pos)
+{
+	ivec2s min = level->pos;
+	ivec2s max = glms_ivec2_add(level->pos, glms_ivec2_scale(level->size, TILE_SIZE));
+	int32_t dx = SDL_max(SDL_max(min.x - pos.x, pos.x - max.x), 0);
+	int32_t dy = SDL_max(SDL_max(min.y - pos.y, pos.y - max.y), 0);
+	return SDL_max(dx, dy);
+}
+
+static void EvictLevel(World* world, Level* level)
+{
+	SDL_assert(level->state == LevelState_Resident);
+	LevelSlot* slot = &world->slots[level->slot_idx];
+	slot->level = NULL;
+	slot->needs_upload = false;
+	level->state = LevelState_Unloaded;
+	level->collision = NULL;
+}
+
+/**
+ * Hands a level to the world streamer. Returns false if every slot is taken, or if the only free 
+ * ones are still being copied out of by the GPU. If the player is in the level, neither of those 
+ * is allowed to stop it, so the farthest level gets evicted and the GPU gets waited on instead.
+ * 
+ * The caller has to be holding World::mutex.
+ */
+static bool RequestLevel(Context* ctx, Level* level, bool urgent)
+{
+	World* world = &ctx->world;
+	SDL_assert(level->state == LevelState_Unloaded);
+
+	LevelSlot* slot = NULL;
+	LevelSlot* busy_slot = NULL; // free, but the GPU might still be reading its staging tiles
+	for (size_t slot_idx = 0; slot_idx < WORLD_MAX_RESIDENT_LEVELS && !slot; slot_idx += 1)
+	{
+		LevelSlot* s = &world->slots[slot_idx];
+		if (s->level) continue;
+		if (ctx->vk.frame_count >= s->reusable_frame) slot = s;
+		else busy_slot = s;
+	}
+	if (!slot && urgent)
+	{
+		if (!busy_slot)
+		{
+			Entity* player = GetPlayer(ctx);
+			Level* farthest = NULL;
+			for (size_t slot_idx = 0; slot_idx < WORLD_MAX_RESIDENT_LEVELS; slot_idx += 1)
+			{
+				Level* l = world->slots[slot_idx].level;
+				if (l && l->state == LevelState_Resident && 
+					(!farthest || GetDistanceToLevel(l, player->pos) > GetDistanceToLevel(farthest, player->pos)))
 				{
-						.origin.x = (int32_t)chunk->x,
-						.origin.y = (int32_t)chunk->y,
-						.z_idx = chunk->z_idx,
-						.layer_idx = (uint32_t)chunk->layer_idx,
-						.size.x = (int32_t)chunk->w,
-						.size.y = (int32_t)chunk->h,
-					};
+					farthest = l;
+				}
+			}
+			SDL_assert(farthest);
+			busy_slot = &world->slots[farthest->slot_idx];
+			EvictLevel(world, farthest);
+		}
+		VK_CHECK(vkDeviceWaitIdle(ctx->vk.device));
+		slot = busy_slot;
+	}
+	if (!slot) return false;
 
-					SDL_assert(cell.size.x != 0 && cell.size.y != 0);
-					size_t dst_buf_size = cell.size.x*cell.size.y * sizeof(uint32_t);
-					cell.dst_buf = SDL_malloc(dst_buf_size); SDL_CHECK(cell.dst_buf);
+	slot->level = level;
+	slot->loaded = false;
+	slot->needs_upload = false;
+	level->state = LevelState_Loading;
+	level->slot_idx = (size_t)(slot - world->slots);
 
-					// It's the zero-sized array at the end of ASE_CellChunk.
-					size_t src_buf_size = raw_chunk_size - sizeof(ASE_CellChunk) - 2;
-					void* src_buf = (void*)((&chunk->h)+1);
+	SDL_assert(world->num_requests < WORLD_MAX_RESIDENT_LEVELS);
+	world->requests[world->num_requests++] = level->slot_idx;
+	SDL_SignalCondition(world->requests_available);
 
-					SPALL_BUFFER_BEGIN_NAME("INFL_ZInflate");
-					size_t res = INFL_ZInflate(cell.dst_buf, dst_buf_size, src_buf, src_buf_size);
-					SPALL_BUFFER_END();
-					SDL_assert(res > 0);
+	return true;
+}
 
-					SDL_assert(cell_idx < sd->frames[frame_idx].num_cells);
-					sd->frames[frame_idx].cells[cell_idx++] = cell;
-				}
+/**
+ * Decides which levels should be resident, based on how far away from the player they are. 
+ * Levels within WORLD_LOAD_DISTANCE get loaded by the world streamer and levels farther than 
+ * WORLD_EVICT_DISTANCE give up their slot, so memory only ever depends on how big the levels 
+ * around the player are, and not on how big the world is.
+ *
+ * The level the player is in has to be resident before anything moves, so if it isn't, this waits
+ * for it. That only happens when streaming can't keep up, or when the player has just respawned.
+ */
+static void UpdateWorld(Context* ctx)
+{
+	SPALL_BUFFER_BEGIN();
 
-				StackFree(&ctx->stack, raw_chunk);
-			}
+	World* world = &ctx->world;
+	ivec2s player_pos = GetPlayer(ctx)->pos;
+
+	SDL_LockMutex(world->mutex);
+
+	for (size_t slot_idx = 0; slot_idx < WORLD_MAX_RESIDENT_LEVELS; slot_idx += 1)
+	{
+		Level* level = world->slots[slot_idx].level;
+		if (level && level->state == LevelState_Resident && GetDistanceToLevel(level, player_pos) > WORLD_EVICT_DISTANCE)
+		{
+			EvictLevel(world, level);
+		}
+	}
+
+	Level* player_level = GetLevelAt(world, player_pos);
+	if (player_level && player_level->state == LevelState_Unloaded)
+	{
+		RequestLevel(ctx, player_level, true);
+	}
+	for (size_t level_idx = 0; level_idx < world->num_levels; level_idx += 1)
+	{
+		Level* level = &world->levels[level_idx];
+		if (level->state == LevelState_Unloaded && GetDistanceToLevel(level, player_pos) <= WORLD_LOAD_DISTANCE)
+		{
+			if (!RequestLevel(ctx, level, false)) break;
+		}
+	}
+
+	if (player_level)
+	{
+		SPALL_BUFFER_BEGIN_NAME("WaitForLevel");
+		while (player_level->state == LevelState_Loading && !world->slots[player_level->slot_idx].loaded)
+		{
+			SDL_WaitCondition(world->level_loaded, world->mutex);
+		}
+		SPALL_BUFFER_END();
+	}
 
-			// Makes the cells draw in the correct order.
-			SDL_assert(frame_idx < sd->num_frames);
-			SDL_qsort(
-				sd->frames[frame_idx].cells, 
-				sd->frames[frame_idx].num_cells, 
-				sizeof(SpriteCell), 
-				(SDL_CompareCallback)CompareSpriteCells);
+	for (size_t slot_idx = 0; slot_idx < WORLD_MAX_RESIDENT_LEVELS; slot_idx += 1)
+	{
+		LevelSlot* slot = &world->slots[slot_idx];
+		if (slot->level && slot->level->state == LevelState_Loading && slot->loaded)
+		{
+			slot->level->state = LevelState_Resident;
+			slot->level->collision = &slot->collision;
+			slot->needs_upload = slot->level->num_tiles > 0;
 		}
 	}
 
-	SDL_CloseIO(fs);
+	SDL_UnlockMutex(world->mutex);
+
 	SPALL_BUFFER_END();
-	return sprite;
 }
 
 /**
@@ -767,11 +2854,11 @@ static Sprite LoadSprite(Context* ctx, char* path)
  * overlapping the level in each direction. If a direction is true, then that entity should not
  * move in that direction, although its velocity should be preserved unless the direction is down.
  * 
- * Secondly, RectOverlappingLevel is called twice, once for horizontal movement and once for
- * vertical movement. For each overlapped tile, the entity is moved just enough in the opposite 
- * direction so that it no longer overlaps the tile.
+ * Secondly, MoveEntityX and MoveEntityY sweep the entity's rectangle along each axis with 
+ * SweepRectX and SweepRectY, which stop it at the exact pixel where it would first overlap a 
+ * solid tile. Nothing gets allocated, and how fast the entity moves makes no difference to what
+ * it costs.
  */
-
 static bool RectTouchingLevel(
 	Context* ctx, 
 	Rect rect, 
@@ -784,98 +2871,69 @@ static bool RectTouchingLevel(
 	*out_right = false;
 	*out_down = false;
 
-	if (rect.min.x % TILE_SIZE == 0) 
+	// FloorDiv and FloorMod rather than / and %, since levels can sit left of or above the origin.
+	int32_t min_y = FloorDiv(rect.min.y, TILE_SIZE);
+	int32_t max_y = FloorDiv(rect.max.y+1, TILE_SIZE);
+	if (FloorMod(rect.min.x, TILE_SIZE) == 0 && FindSolidInColumn(&ctx->world, FloorDiv(rect.min.x, TILE_SIZE) - 1, min_y, max_y, NULL)) 
 	{
-		ivec2s tile_pos; // measured in tiles, not pixels
-		tile_pos.x = rect.min.x/TILE_SIZE;
-		for (
-			tile_pos.y = rect.min.y/TILE_SIZE; 
-			tile_pos.y <= (rect.max.y+1)/TILE_SIZE; 
-			tile_pos.y += 1) 
-		{
-			if (TileIsSolid(&ctx->level, tile_pos)) 
-			{
-				res = true;
-				*out_left = true;
-				break;
-			}
-		}
+		res = true;
+		*out_left = true;
 	}
-	if ((rect.max.x+1) % TILE_SIZE == 0) 
+	if (FloorMod(rect.max.x+1, TILE_SIZE) == 0 && FindSolidInColumn(&ctx->world, FloorDiv(rect.max.x+1, TILE_SIZE), min_y, max_y, NULL)) 
 	{
-		ivec2s tile_pos; // measured in tiles, not pixels
-		tile_pos.x = (rect.max.x+1)/TILE_SIZE;
-		for (
-			tile_pos.y = rect.min.y/TILE_SIZE; 
-			tile_pos.y <= (rect.max.y+1)/TILE_SIZE; 
-			tile_pos.y += 1) 
-		{
-			if (TileIsSolid(&ctx->level, tile_pos)) 
-			{
-				res = true;
-				*out_right = true;
-				break;
-			}
-		}
+		res = true;
+		*out_right = true;
 	}
-	if ((rect.max.y+1) % TILE_SIZE == 0)
+	if (FloorMod(rect.max.y+1, TILE_SIZE) == 0 && FindSolidInRow(&ctx->world, FloorDiv(rect.max.y+1, TILE_SIZE), FloorDiv(rect.min.x, TILE_SIZE), FloorDiv(rect.max.x+1, TILE_SIZE), NULL))
 	{
-		ivec2s tile_pos; // measured in tiles, not pixels
-		tile_pos.y = (rect.max.y+1)/TILE_SIZE;
-		for (
-			tile_pos.x = rect.min.x/TILE_SIZE; 
-			tile_pos.x <= (rect.max.x+1)/TILE_SIZE; 
-			tile_pos.x += 1) 
-		{
-			if (TileIsSolid(&ctx->level, tile_pos)) 
-			{
-				res = true;
-				*out_down = true;
-				break;
-			}
-		}
+		res = true;
+		*out_down = true;
 	}
 	return res;
 }
 
-static bool RectOverlappingLevel(
-	Context* ctx, 
-	Rect rect, 
-	size_t* out_num_tiles_overlapping, ivec2s** out_tiles_overlapping)
+/**
+ * Returns how far rect can move along x, out of delta pixels, before it runs into a solid tile. 
+ * The tiles in its way are found with one span query per row of tiles the rect covers, so this 
+ * costs the same no matter how far it moves. If the rect already overlaps a tile, the result 
+ * pushes it back out the opposite way of dir.
+ */
+static int32_t SweepRectX(Context* ctx, Rect rect, int32_t delta, int32_t dir)
 {
-	bool res = false;
-
-	ivec2s* _tiles_overlapping = StackAlloc(&ctx->stack, 32, ivec2s);
-	
-	ivec2s tile;
-	size_t i = 0;
-	for (tile.y = rect.min.y/TILE_SIZE; tile.y <= (rect.max.y+1)/TILE_SIZE; tile.y += 1)
+	SDL_assert(dir == 1 || dir == -1);
+	int32_t res = delta;
+	for (int32_t y = FloorDiv(rect.min.y, TILE_SIZE); y <= FloorDiv(rect.max.y, TILE_SIZE); y += 1)
 	{
-		for (tile.x = rect.min.x/TILE_SIZE; tile.x <= (rect.max.x+1)/TILE_SIZE; tile.x += 1)
+		int32_t x;
+		if (dir == 1 && FindSolidInRow(&ctx->world, y, FloorDiv(rect.min.x, TILE_SIZE), FloorDiv(rect.max.x + SDL_max(delta, 0), TILE_SIZE), &x))
 		{
-			Rect tile_rect = TileToRect(tile);
-
-			if (TileIsSolid(&ctx->level, tile) && RectsIntersect(rect, tile_rect))
-			{
-				SDL_assert(i < 32);
-				_tiles_overlapping[i++] = tile;
-				res = true;
-			}
+			res = SDL_min(res, x*TILE_SIZE - 1 - rect.max.x);
+		}
+		else if (dir == -1 && FindLastSolidInRow(&ctx->world, y, FloorDiv(rect.min.x + SDL_min(delta, 0), TILE_SIZE), FloorDiv(rect.max.x, TILE_SIZE), &x))
+		{
+			res = SDL_max(res, (x + 1)*TILE_SIZE - rect.min.x);
 		}
 	}
+	return res;
+}
 
-	if (!res)
-	{
-		StackFree(&ctx->stack, _tiles_overlapping);
-		*out_num_tiles_overlapping = 0;
-		*out_tiles_overlapping = NULL;
-	}
-	else
+// Same as SweepRectX, but along y.
+static int32_t SweepRectY(Context* ctx, Rect rect, int32_t delta, int32_t dir)
+{
+	SDL_assert(dir == 1 || dir == -1);
+	int32_t res = delta;
+	for (int32_t x = FloorDiv(rect.min.x, TILE_SIZE); x <= FloorDiv(rect.max.x, TILE_SIZE); x += 1)
 	{
-		*out_num_tiles_overlapping = i;
-		*out_tiles_overlapping = _tiles_overlapping;
+		int32_t y;
+		if (dir == 1 && FindSolidInColumn(&ctx->world, x, FloorDiv(rect.min.y, TILE_SIZE), FloorDiv(rect.max.y + SDL_max(delta, 0), TILE_SIZE), &y))
+		{
+			res = SDL_min(res, y*TILE_SIZE - 1 - rect.max.y);
+		}
+		else if (dir == -1 && FindLastSolidInColumn(&ctx->world, x, FloorDiv(rect.min.y + SDL_min(delta, 0), TILE_SIZE), FloorDiv(rect.max.y, TILE_SIZE), &y))
+		{
+			res = SDL_max(res, (y + 1)*TILE_SIZE - rect.min.y);
+		}
 	}
-
 	return res;
 }
 
@@ -884,7 +2942,7 @@ static void MoveEntityX(Context* ctx, Entity* entity, float acc, float fric, flo
 	entity->vel.x += acc*dt;
 
 	entity->pos_remainder.x += entity->vel.x*dt;
-	entity->pos.x += (int32_t)SDL_roundf(entity->pos_remainder.x);
+	int32_t delta = (int32_t)SDL_roundf(entity->pos_remainder.x);
 	entity->pos_remainder.x -= SDL_roundf(entity->pos_remainder.x);
 	
 	if (fric != 0.0f)
@@ -898,30 +2956,13 @@ static void MoveEntityX(Context* ctx, Entity* entity, float acc, float fric, flo
 		entity->vel.x = SDL_clamp(entity->vel.x, -max_vel, max_vel);
 	}
 
-	Rect rect = GetEntityRect(ctx, entity); 
-	size_t num_tiles_overlapping; 
-	ivec2s* tiles_overlapping;
-	if (RectOverlappingLevel(ctx, rect, &num_tiles_overlapping, &tiles_overlapping))
+	int32_t dir = delta > 0 ? 1 : delta < 0 ? -1 : entity->dir;
+	int32_t moved = SweepRectX(ctx, GetEntityRect(ctx, entity), delta, dir);
+	if (moved != delta)
 	{
 		entity->pos_remainder.x = 0.0f;
-		int32_t amount = 0;
-		for (size_t i = 0; i < num_tiles_overlapping; i += 1)
-		{
-			if (TileIsSolid(&ctx->level, tiles_overlapping[i]))
-			{
-				Rect tile_rect = TileToRect(tiles_overlapping[i]);
-				while (RectsIntersect(rect, tile_rect))
-				{
-					rect.min.x -= entity->dir;
-					rect.max.x -= entity->dir;
-					amount -= entity->dir;
-				}
-			}
-		}
-		entity->pos.x += amount;		
-
-		StackFree(&ctx->stack, tiles_overlapping);
 	}
+	entity->pos.x += moved;
 }
 
 static void MoveEntityY(Context* ctx, Entity* entity, float acc)
@@ -929,33 +2970,20 @@ static void MoveEntityY(Context* ctx, Entity* entity, float acc)
 	entity->vel.y += acc*dt;
 
 	entity->pos_remainder.y += entity->vel.y*dt;
-	entity->pos.y += (int32_t)SDL_roundf(entity->pos_remainder.y);
+	int32_t delta = (int32_t)SDL_roundf(entity->pos_remainder.y);
 	entity->pos_remainder.y -= SDL_roundf(entity->pos_remainder.y);
 
+	// Only falling collides: jumping goes straight through tiles.
+	int32_t moved = delta;
 	if (entity->vel.y > 0.0f)
 	{
-		Rect rect = GetEntityRect(ctx, entity); 
-		size_t num_tiles_overlapping;
-		ivec2s* tiles_overlapping;
-		if (RectOverlappingLevel(ctx, rect, &num_tiles_overlapping, &tiles_overlapping))
+		moved = SweepRectY(ctx, GetEntityRect(ctx, entity), delta, 1);
+		if (moved != delta)
 		{
 			entity->pos_remainder.y = 0.0f;
-			int32_t amount = 0;
-			for (size_t i = 0; i < num_tiles_overlapping; i += 1)
-			{
-				Rect tile_rect = TileToRect(tiles_overlapping[i]);
-				while (RectsIntersect(rect, tile_rect))
-				{
-					rect.min.y -= 1;
-					rect.max.y -= 1;
-					amount -= 1;
-				}
-			}
-			entity->pos.y += amount;
-
-			StackFree(&ctx->stack, tiles_overlapping);
 		}
 	}
+	entity->pos.y += moved;
 }
 
 static void UpdatePlayer(Context* ctx) 
@@ -1031,7 +3059,7 @@ static void UpdatePlayer(Context* ctx)
 		} break;
 	}
 
-	if (player->pos.y > (float)(ctx->level.size.y*TILE_SIZE)) 
+	if (player->pos.y > ctx->world.bounds.max.y) 
 	{
 		ResetGame(ctx);
 	} 
@@ -1091,22 +3119,21 @@ static void UpdatePlayer(Context* ctx)
 	    {
 			SetAnimSprite(&player->anim, player_attack);
 
-			size_t num_enemies; Entity* enemies = GetEnemies(ctx, &num_enemies);
-			for (size_t enemy_idx = 0; enemy_idx < num_enemies; enemy_idx += 1) 
+			// Enemies haven't moved since RebuildEntityGrid, so the grid is still exact.
+			EntityStore* enemies = &ctx->world.enemies;
+			size_t num_hits; size_t* hits = QueryEntityGrid(ctx, GetEntityRect(ctx, player), &num_hits);
+			for (size_t hit_idx = 0; hit_idx < num_hits; hit_idx += 1) 
 			{
-				Entity* enemy = &enemies[enemy_idx];
-				if (EntitiesIntersect(ctx, player, enemy)) 
+				size_t enemy_idx = hits[hit_idx];
+				if (enemies->state[enemy_idx] != EntityState_Inactive) 
 				{
-					switch (enemy->type)
+					if (enemy_idx >= enemies->type_starts[EntityType_Boar] && enemy_idx < enemies->type_starts[EntityType_Boar + 1])
 					{
-					case EntityType_Boar:
-						enemy->state = EntityState_Hurt;
-						break;
-					default:
-						break;
+						enemies->state[enemy_idx] = EntityState_Hurt;
 					}
 				}
 			}
+			StackFree(&ctx->stack, hits);
 			
 			bool loop = false;
 			UpdateAnim(ctx, &player->anim, loop);
@@ -1178,105 +3205,415 @@ static void UpdatePlayer(Context* ctx)
 				player->vel.y = player_y.vel.y;
 			}
 
-			bool loop = false;
-	    	UpdateAnim(ctx, &player->anim, loop);
-		} break;
+			bool loop = false;
+	    	UpdateAnim(ctx, &player->anim, loop);
+		} break;
+
+		default: 
+		{
+			// TODO?
+		} break;
+	}
+
+	SPALL_BUFFER_END();
+}
+
+// One boar at a time, the way boars were updated before enemies moved into an EntityStore. 
+// Only kept around as the reference that --bench-boars checks UpdateBoars against.
+static void UpdateBoarAoS(Context* ctx, Entity* boar) 
+{
+	SPALL_BUFFER_BEGIN();
+
+	bool touching_left, touching_right, touching_down;
+	RectTouchingLevel(ctx, GetEntityRect(ctx, boar), 
+		&touching_left, &touching_right, &touching_down);
+	switch (boar->state)
+	{
+		case EntityState_Fall:
+		{
+			if (touching_down)
+			{
+				boar->state = EntityState_Free;
+				boar->vel.y = 0.0f;
+			}
+		} break;
+		case EntityState_Jump:
+		{
+			if (boar->vel.y > 0.0f)
+			{
+				boar->state = EntityState_Fall;
+			}
+		} break;
+		case EntityState_Free:
+		{
+			if (!touching_down)
+			{
+				boar->pos.x += boar->dir*(TILE_SIZE-1);
+				boar->state = EntityState_Fall;
+			}
+		} break;
+	}
+
+	switch (boar->state) 
+	{
+		case EntityState_Hurt: 
+		{
+			SetAnimSprite(&boar->anim, boar_hit);
+
+			bool loop = false;
+			UpdateAnim(ctx, &boar->anim, loop);
+
+			if (boar->anim.ended) 
+			{
+				boar->state = EntityState_Inactive;
+			}
+		} break;
+
+		case EntityState_Fall: 
+		{
+			SetAnimSprite(&boar->anim, boar_idle);
+
+			Entity boar_x = *boar;
+			Entity boar_y = *boar;
+			if (boar->vel.x != 0.0f || boar->pos_remainder.x != 0.0f)
+			{
+				MoveEntityX(ctx, &boar_x, 0.0f, 0.0f, 0.0f);
+				boar->pos.x = boar_x.pos.x;
+				boar->pos_remainder.x = boar_x.pos_remainder.x;
+				boar->vel.x = boar_x.vel.x;
+			}
+			MoveEntityY(ctx, &boar_y, GRAVITY);
+			boar->pos.y = boar_y.pos.y;
+			boar->pos_remainder.y = boar_y.pos_remainder.y;
+			boar->vel.y = boar_y.vel.y;
+			
+			bool loop = true;
+			UpdateAnim(ctx, &boar->anim, loop);
+		} break;
+
+		case EntityState_Free: 
+		{
+			SetAnimSprite(&boar->anim, boar_idle);
+
+			bool loop = true;
+			UpdateAnim(ctx, &boar->anim, loop);
+		} break;
+
+		default: 
+		{
+			// TODO?
+		} break;
+	}
+
+	SPALL_BUFFER_END();
+}
+
+/**
+ * Does the same as UpdateBoarAoS for num_boars boars of the store, starting at first, but one step 
+ * at a time across all of them instead of one boar at a time: state changes, then integrating the 
+ * falling ones, then sweeping them against the level, then animating. The integration loops only 
+ * touch the hot arrays and pick their results with selects rather than branches, so the compiler 
+ * can vectorize them. Only ever writes to the boars it was given, and only ever allocates from 
+ * stack, so that it can run on any thread (see UpdateBoarsJob).
+ */
+static void UpdateBoarRange(Context* ctx, Stack* stack, EntityStore* store, size_t first, size_t num_boars)
+{
+	int32_t* pos_x = store->pos_x + first; int32_t* pos_y = store->pos_y + first;
+	float* vel_x = store->vel_x + first; float* vel_y = store->vel_y + first;
+	float* rem_x = store->pos_remainder_x + first; float* rem_y = store->pos_remainder_y + first;
+	EntityState* state = store->state + first;
+	float* anim_dt_accumulator = store->anim_dt_accumulator + first;
+	uint32_t* anim_frame_idx = store->anim_frame_idx + first;
+	Sprite* anim_sprite = store->anim_sprite + first;
+	bool* anim_ended = store->anim_ended + first;
+	int32_t* dir = store->dir + first;
+
+	// One allocation rather than five, since StackFree only ever gives back the last one.
+	int32_t* scratch = StackAlloc(stack, 5*num_boars, int32_t);
+	int32_t* awake = scratch; // 0 for boars that sit still this tick, including the ones frozen with their level unloaded
+	int32_t* falling = awake + num_boars;
+	int32_t* moving_x = falling + num_boars;
+	int32_t* delta_x = moving_x + num_boars;
+	int32_t* delta_y = delta_x + num_boars;
+
+	// BoarStates
+	for (size_t boar_idx = 0; boar_idx < num_boars; boar_idx += 1)
+	{
+		// Without their level, boars would have nothing to stand on.
+		ivec2s pos = {pos_x[boar_idx], pos_y[boar_idx]};
+		if (!LevelIsResidentAt(&ctx->world, pos)) continue;
+
+		if (state[boar_idx] == EntityState_Fall || state[boar_idx] == EntityState_Free)
+		{
+			SpriteDesc* sd = GetSpriteDesc(ctx, anim_sprite[boar_idx]);
+			Rect rect = GetFrameHitbox(sd, anim_frame_idx[boar_idx], dir[boar_idx]);
+			rect.min = glms_ivec2_add(rect.min, pos);
+			rect.max = glms_ivec2_add(rect.max, pos);
+			bool touching_left, touching_right, touching_down;
+			RectTouchingLevel(ctx, rect, &touching_left, &touching_right, &touching_down);
+			if (state[boar_idx] == EntityState_Fall && touching_down)
+			{
+				state[boar_idx] = EntityState_Free;
+				vel_y[boar_idx] = 0.0f;
+			}
+			else if (state[boar_idx] == EntityState_Free && !touching_down)
+			{
+				pos_x[boar_idx] += dir[boar_idx]*(TILE_SIZE-1);
+				state[boar_idx] = EntityState_Fall;
+			}
+		}
+		else if (state[boar_idx] == EntityState_Jump && vel_y[boar_idx] > 0.0f)
+		{
+			state[boar_idx] = EntityState_Fall;
+		}
+
+		awake[boar_idx] = 
+			state[boar_idx] == EntityState_Hurt || 
+			state[boar_idx] == EntityState_Fall || 
+			state[boar_idx] == EntityState_Free;
+		Sprite sprite = state[boar_idx] == EntityState_Hurt ? boar_hit : boar_idle;
+		if (awake[boar_idx] && !SpritesEqual(anim_sprite[boar_idx], sprite))
+		{
+			anim_sprite[boar_idx] = sprite;
+			anim_frame_idx[boar_idx] = 0;
+			anim_dt_accumulator[boar_idx] = 0.0f;
+			anim_ended[boar_idx] = false;
+		}
+
+		falling[boar_idx] = state[boar_idx] == EntityState_Fall;
+		moving_x[boar_idx] = falling[boar_idx] && (vel_x[boar_idx] != 0.0f || rem_x[boar_idx] != 0.0f);
+	}
+
+	// IntegrateBoars
+	for (size_t boar_idx = 0; boar_idx < num_boars; boar_idx += 1)
+	{
+		vel_y[boar_idx] = falling[boar_idx] ? vel_y[boar_idx] + GRAVITY*dt : vel_y[boar_idx];
+	}
+	for (size_t boar_idx = 0; boar_idx < num_boars; boar_idx += 1)
+	{
+		rem_x[boar_idx] = moving_x[boar_idx] ? rem_x[boar_idx] + vel_x[boar_idx]*dt : rem_x[boar_idx];
+		rem_y[boar_idx] = falling[boar_idx] ? rem_y[boar_idx] + vel_y[boar_idx]*dt : rem_y[boar_idx];
+	}
+	for (size_t boar_idx = 0; boar_idx < num_boars; boar_idx += 1)
+	{
+		float round_x = SDL_roundf(rem_x[boar_idx]);
+		float round_y = SDL_roundf(rem_y[boar_idx]);
+		delta_x[boar_idx] = moving_x[boar_idx] ? (int32_t)round_x : 0;
+		delta_y[boar_idx] = falling[boar_idx] ? (int32_t)round_y : 0;
+		rem_x[boar_idx] = moving_x[boar_idx] ? rem_x[boar_idx] - round_x : rem_x[boar_idx];
+		rem_y[boar_idx] = falling[boar_idx] ? rem_y[boar_idx] - round_y : rem_y[boar_idx];
+	}
+
+	// SweepBoars
+	for (size_t boar_idx = 0; boar_idx < num_boars; boar_idx += 1)
+	{
+		if (!falling[boar_idx]) continue;
+
+		// Both axes sweep from where the boar was, same as MoveEntityX and MoveEntityY.
+		SpriteDesc* sd = GetSpriteDesc(ctx, anim_sprite[boar_idx]);
+		Rect rect = GetFrameHitbox(sd, anim_frame_idx[boar_idx], dir[boar_idx]);
+		ivec2s pos = {pos_x[boar_idx], pos_y[boar_idx]};
+		rect.min = glms_ivec2_add(rect.min, pos);
+		rect.max = glms_ivec2_add(rect.max, pos);
+
+		if (moving_x[boar_idx])
+		{
+			int32_t delta = delta_x[boar_idx];
+			int32_t sweep_dir = delta > 0 ? 1 : delta < 0 ? -1 : dir[boar_idx];
+			int32_t moved = SweepRectX(ctx, rect, delta, sweep_dir);
+			if (moved != delta)
+			{
+				rem_x[boar_idx] = 0.0f;
+			}
+			pos_x[boar_idx] += moved;
+		}
+
+		int32_t moved = delta_y[boar_idx];
+		if (vel_y[boar_idx] > 0.0f)
+		{
+			moved = SweepRectY(ctx, rect, delta_y[boar_idx], 1);
+			if (moved != delta_y[boar_idx])
+			{
+				rem_y[boar_idx] = 0.0f;
+			}
+		}
+		pos_y[boar_idx] += moved;
+	}
+
+	// AnimateBoars
+	for (size_t boar_idx = 0; boar_idx < num_boars; boar_idx += 1)
+	{
+		if (!awake[boar_idx]) continue;
+		bool loop = state[boar_idx] != EntityState_Hurt;
+		if (!loop && anim_ended[boar_idx]) continue;
+
+		SpriteDesc* sd = GetSpriteDesc(ctx, anim_sprite[boar_idx]);
+		SDL_assert(anim_frame_idx[boar_idx] < sd->num_frames);
+		anim_dt_accumulator[boar_idx] += dt;
+		if (anim_dt_accumulator[boar_idx] >= sd->frames[anim_frame_idx[boar_idx]].dur)
+		{
+			anim_dt_accumulator[boar_idx] = 0.0f;
+			anim_frame_idx[boar_idx] += 1;
+			if (anim_frame_idx[boar_idx] >= sd->num_frames)
+			{
+				if (loop) anim_frame_idx[boar_idx] = 0;
+				else
+				{
+					anim_frame_idx[boar_idx] -= 1;
+					anim_ended[boar_idx] = true;
+				}
+			}
+		}
+	}
+	for (size_t boar_idx = 0; boar_idx < num_boars; boar_idx += 1)
+	{
+		if (awake[boar_idx] && state[boar_idx] == EntityState_Hurt && anim_ended[boar_idx])
+		{
+			state[boar_idx] = EntityState_Inactive;
+		}
+	}
+
+	StackFree(stack, scratch);
+}
+
+typedef struct BoarUpdate
+{
+	Context* ctx;
+	EntityStore* store;
+	size_t first; size_t num_boars;
+} BoarUpdate;
+
+static void UpdateBoarsJob(void* user_data, size_t job_idx, JobThread* thread)
+{
+	BoarUpdate* update = user_data;
+	size_t start = job_idx*BOAR_JOB_SIZE;
+	size_t num_boars = SDL_min(update->num_boars - start, (size_t)BOAR_JOB_SIZE);
+	UpdateBoarRange(update->ctx, &thread->stack, update->store, update->first + start, num_boars);
+}
+
+/**
+ * Splits the boars into jobs of BOAR_JOB_SIZE and runs them on ctx->jobs. Boars don't collide with 
+ * each other, and the only thing that touches them from outside is the player's attack, which has 
+ * already happened by the time they update. So every boar only depends on its own state and the 
+ * level, and the result is the same no matter how many threads there are or which one ran what.
+ */
+static void UpdateBoars(Context* ctx, EntityStore* store)
+{
+	SPALL_BUFFER_BEGIN();
 
-		default: 
-		{
-			// TODO?
-		} break;
+	BoarUpdate update = 
+	{
+		.ctx = ctx,
+		.store = store,
+		.first = store->type_starts[EntityType_Boar],
+		.num_boars = store->type_starts[EntityType_Boar + 1] - store->type_starts[EntityType_Boar],
+	};
+	size_t num_jobs = (update.num_boars + BOAR_JOB_SIZE - 1)/BOAR_JOB_SIZE;
+	if (num_jobs == 1)
+	{
+		// Not worth waking up the workers for.
+		UpdateBoarRange(ctx, &ctx->stack, store, update.first, update.num_boars);
+	}
+	else
+	{
+		RunJobs(&ctx->jobs, num_jobs, UpdateBoarsJob, &update);
+
+		// Nothing outlives a job, so the thread stacks start every tick empty.
+		ResetJobArenas(&ctx->jobs);
 	}
 
 	SPALL_BUFFER_END();
 }
 
-static void UpdateBoar(Context* ctx, Entity* boar) 
+/**
+ * Times UpdateBoars against UpdateBoarAoS on num_boars boars dropped at random into the top half of 
+ * the player's level, and counts the boars the two disagree on, which should always be none. This runs before the world streamer 
+ * exists, so the level gets loaded straight into the first slot. Replaces the world's enemies.
+ */
+static void BenchmarkBoars(Context* ctx, size_t num_boars, size_t num_ticks)
 {
-	SPALL_BUFFER_BEGIN();
+	World* world = &ctx->world;
 
-	bool touching_left, touching_right, touching_down;
-	RectTouchingLevel(ctx, GetEntityRect(ctx, boar), 
-		&touching_left, &touching_right, &touching_down);
-	switch (boar->state)
+	Level* level = GetLevelAt(world, GetPlayer(ctx)->start_pos); SDL_assert(level);
+	if (level->state != LevelState_Resident)
 	{
-		case EntityState_Fall:
-		{
-			if (touching_down)
-			{
-				boar->state = EntityState_Free;
-				boar->vel.y = 0.0f;
-			}
-		} break;
-		case EntityState_Jump:
-		{
-			if (boar->vel.y > 0.0f)
-			{
-				boar->state = EntityState_Fall;
-			}
-		} break;
-		case EntityState_Free:
-		{
-			if (!touching_down)
-			{
-				boar->pos.x += boar->dir*(TILE_SIZE-1);
-				boar->state = EntityState_Fall;
-			}
-		} break;
+		LevelSlot* slot = &world->slots[0];
+		slot->collision.rows = SDL_malloc(SDL_max(world->max_collision_words, (size_t)1)*sizeof(uint64_t)); SDL_CHECK(slot->collision.rows);
+		slot->staging_tiles = SDL_malloc(SDL_max(world->max_tiles_per_level, (size_t)1)*sizeof(Tile)); SDL_CHECK(slot->staging_tiles);
+		slot->level = level;
+		LoadLevelIntoSlot(slot);
+		level->state = LevelState_Resident;
+		level->slot_idx = 0;
+		level->collision = &slot->collision;
 	}
 
-	switch (boar->state) 
+	EntityStore* store = &world->enemies;
+	SDL_aligned_free(store->block);
+	AllocEntityStore(store, num_boars);
+	for (EntityType type = 0; type <= EntityType_Count; type += 1)
 	{
-		case EntityState_Hurt: 
-		{
-			SetAnimSprite(&boar->anim, boar_hit);
-
-			bool loop = false;
-			UpdateAnim(ctx, &boar->anim, loop);
+		store->type_starts[type] = type <= EntityType_Boar ? 0 : num_boars;
+	}
 
-			if (boar->anim.ended) 
-			{
-				boar->state = EntityState_Inactive;
-			}
-		} break;
+	Entity* boars = SDL_malloc(num_boars*sizeof(Entity)); SDL_CHECK(boars);
+	Uint64 seed = 1;
+	ivec2s level_size = glms_ivec2_scale(level->size, TILE_SIZE);
+	for (size_t boar_idx = 0; boar_idx < num_boars; boar_idx += 1)
+	{
+		Entity boar = {0};
+		boar.type = EntityType_Boar;
+		boar.state = EntityState_Free;
+		boar.dir = SDL_rand_r(&seed, 2) ? 1 : -1;
+		boar.pos.x = level->pos.x + SDL_rand_r(&seed, level_size.x);
+		boar.pos.y = level->pos.y + SDL_rand_r(&seed, SDL_max(level_size.y/2, 1));
+		boar.start_pos = boar.pos;
+		SetAnimSprite(&boar.anim, boar_idle);
+		boars[boar_idx] = boar;
+		SetStoreEntity(store, boar_idx, &boar);
+	}
 
-		case EntityState_Fall: 
+	uint64_t start_ns = SDL_GetTicksNS();
+	for (size_t tick = 0; tick < num_ticks; tick += 1)
+	{
+		for (size_t boar_idx = 0; boar_idx < num_boars; boar_idx += 1)
 		{
-			SetAnimSprite(&boar->anim, boar_idle);
-
-			Entity boar_x = *boar;
-			Entity boar_y = *boar;
-			if (boar->vel.x != 0.0f || boar->pos_remainder.x != 0.0f)
-			{
-				MoveEntityX(ctx, &boar_x, 0.0f, 0.0f, 0.0f);
-				boar->pos.x = boar_x.pos.x;
-				boar->pos_remainder.x = boar_x.pos_remainder.x;
-				boar->vel.x = boar_x.vel.x;
-			}
-			MoveEntityY(ctx, &boar_y, GRAVITY);
-			boar->pos.y = boar_y.pos.y;
-			boar->pos_remainder.y = boar_y.pos_remainder.y;
-			boar->vel.y = boar_y.vel.y;
-			
-			bool loop = true;
-			UpdateAnim(ctx, &boar->anim, loop);
-		} break;
+			if (!LevelIsResidentAt(world, boars[boar_idx].pos)) continue;
+			UpdateBoarAoS(ctx, &boars[boar_idx]);
+		}
+	}
+	uint64_t aos_ns = SDL_GetTicksNS() - start_ns;
 
-		case EntityState_Free: 
+	// At 100k boars, a stack that grew by even a few KB a tick would run out well before the end.
+	size_t stack_offset = ctx->stack.curr_offset;
+	start_ns = SDL_GetTicksNS();
+	for (size_t tick = 0; tick < num_ticks; tick += 1)
+	{
+		UpdateBoars(ctx, store);
+		SDL_assert(ctx->stack.curr_offset == stack_offset);
+		for (size_t thread_idx = 0; thread_idx < ctx->jobs.num_threads; thread_idx += 1)
 		{
-			SetAnimSprite(&boar->anim, boar_idle);
-
-			bool loop = true;
-			UpdateAnim(ctx, &boar->anim, loop);
-		} break;
+			SDL_assert(ctx->jobs.threads[thread_idx].stack.curr_offset == 0);
+		}
+	}
+	uint64_t soa_ns = SDL_GetTicksNS() - start_ns;
 
-		default: 
+	size_t num_mismatches = 0;
+	for (size_t boar_idx = 0; boar_idx < num_boars; boar_idx += 1)
+	{
+		Entity a = boars[boar_idx];
+		Entity b = GetStoreEntity(store, boar_idx);
+		if (!glms_ivec2_eqv(a.pos, b.pos) || a.state != b.state || a.anim.frame_idx != b.anim.frame_idx)
 		{
-			// TODO?
-		} break;
+			num_mismatches += 1;
+		}
 	}
 
-	SPALL_BUFFER_END();
+	double aos_ms = (double)aos_ns/1000000.0/(double)num_ticks;
+	double soa_ms = (double)soa_ns/1000000.0/(double)num_ticks;
+	SDL_Log("Updated %llu boars for %llu ticks: %.3f ms/tick one at a time, %.3f ms/tick batched on %llu threads (%.2fx), %llu mismatches", 
+		num_boars, num_ticks, aos_ms, soa_ms, ctx->jobs.num_threads, aos_ms/SDL_max(soa_ms, 0.000001), num_mismatches);
+
+	SDL_free(boars);
 }
 
 #if TOGGLE_REPLAY_FRAMES
@@ -1286,8 +3623,8 @@ static void SetReplayFrame(Context* ctx, size_t replay_frame_idx)
 	{
 		ctx->replay_frame_idx = replay_frame_idx;
 		ReplayFrame* replay_frame = &ctx->replay_frames[ctx->replay_frame_idx];
-		SDL_memcpy(ctx->level.entities, replay_frame->entities, replay_frame->num_entities * sizeof(Entity));
-		ctx->level.num_entities = replay_frame->num_entities;
+		ctx->world.player = replay_frame->player;
+		SDL_memcpy(ctx->world.enemies.block, replay_frame->enemies, ctx->world.enemies.block_size);
 	}
 }
 #endif // TOGGLE_REPLAY_FRAMES
@@ -1305,9 +3642,6 @@ VkBool32 VKAPI_CALL VulkanDebugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT s
 
 int32_t main(int32_t argc, char* argv[]) 
 {
-	UNUSED(argc);
-	UNUSED(argv);
-
 	// InitContext
 	Context* ctx;
 	{
@@ -1333,6 +3667,26 @@ int32_t main(int32_t argc, char* argv[])
 		ctx->stack = stack;
 	}
 
+	// ParseCommandLine
+	bool bake_only = false;
+	bool bench_boars = false;
+	for (int32_t arg_idx = 1; arg_idx < argc; arg_idx += 1)
+	{
+		if (SDL_strcmp(argv[arg_idx], "--bake") == 0)
+		{
+			// Offline bake step: rebuild the whole bake cache from source, then exit before
+			// creating the window.
+			bake_only = true;
+			ctx->rebake = true;
+		}
+		else if (SDL_strcmp(argv[arg_idx], "--bench-boars") == 0)
+		{
+			// Times the batched boar update against the one-at-a-time one, then exits before creating 
+			// the window.
+			bench_boars = true;
+		}
+	}
+
 #if TOGGLE_PROFILING
 	{
 		bool ok;
@@ -1350,23 +3704,95 @@ int32_t main(int32_t argc, char* argv[])
 	}
 #endif // TOGGLE_PROFILING
 
-	// This is the only time that we set the sprite variables.
-	// After that, they are effectively constants.
+	CreateJobPool(&ctx->jobs, &ctx->arena);
+
+	LoadSprites(ctx, sprite_load_requests, SDL_arraysize(sprite_load_requests));
+	{
+		SpriteLoadStats* stats = &ctx->sprite_load_stats;
+		SDL_Log("Loaded %llu sprites (%llu cold, %llu warm) on %llu threads in %.2f ms: parse %.2f ms, %llu cells inflated in %.2f ms (%.2f MB)", 
+			ctx->num_sprites, stats->num_cold, stats->num_warm, ctx->jobs.num_threads,
+			(double)stats->total_ns/1000000.0, 
+			(double)stats->parse_ns/1000000.0, 
+			stats->num_cells_decoded, (double)stats->decode_ns/1000000.0,
+			(double)stats->pixels_size/(1024.0*1024.0));
+	}
+
+	// LoadWorld
+	{
+		SPALL_BUFFER_BEGIN_NAME("LoadWorld");
+		uint64_t start_ns = SDL_GetTicksNS();
+
+		// Same scheme as the sprites: the bake is keyed on the contents of the .ldtk file. Unlike 
+		// the sprites, the bake stays mapped, since levels get loaded out of it as the player moves.
+		char* level_path = "assets\\levels\\test.ldtk";
+		MappedFile source;
+		bool mapped = MapFile(level_path, &source); SDL_assert(mapped);
+		uint64_t source_hash = XXH3_64bits(source.data, source.size);
+
+		char bake_path[64];
+		GetLevelBakePath(level_path, bake_path, sizeof(bake_path));
+		MappedFile bake = {0};
+		bool warm = !ctx->rebake && MapFile(bake_path, &bake);
+		if (warm && !LoadWorldBake(&ctx->arena, &ctx->world, bake, source_hash))
+		{
+			UnmapFile(&bake);
+			warm = false;
+		}
+		if (!warm)
+		{
+			size_t bake_size;
+			void* bake_buf = BakeWorldLdtk(source.data, source.size, source_hash, &bake_size);
+
+			// Same as SaveSpriteBake: the bake cache is only an optimization. If it can't be written, 
+			// the world gets loaded straight out of memory instead.
+			if (SDL_CreateDirectory(BAKE_CACHE_DIR) && SDL_SaveFile(bake_path, bake_buf, bake_size) && MapFile(bake_path, &bake))
+			{
+				SDL_free(bake_buf);
+			}
+			else
+			{
+				SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Failed to write %s: %s", bake_path, SDL_GetError());
+				bake = (MappedFile){bake_buf, bake_size};
+				ctx->world.bake_buf = bake_buf;
+			}
+			bool loaded = LoadWorldBake(&ctx->arena, &ctx->world, bake, source_hash); SDL_assert(loaded);
+		}
+		UnmapFile(&source);
+
+		SDL_Log("Loaded world of %llu levels, %dx%d pixels (%s) in %.2f ms", 
+			ctx->world.num_levels, 
+			ctx->world.bounds.max.x - ctx->world.bounds.min.x, ctx->world.bounds.max.y - ctx->world.bounds.min.y,
+			warm ? "warm" : "cold", 
+			(double)(SDL_GetTicksNS() - start_ns)/1000000.0);
 
-	player_idle = LoadSprite(ctx, "assets\\legacy_fantasy_high_forest\\Character\\Idle\\Idle.aseprite");
-	player_run = LoadSprite(ctx, "assets\\legacy_fantasy_high_forest\\Character\\Run\\Run.aseprite");
-	player_jump_start = LoadSprite(ctx, "assets\\legacy_fantasy_high_forest\\Character\\Jump-Start\\Jump-Start.aseprite");
-	player_jump_end = LoadSprite(ctx, "assets\\legacy_fantasy_high_forest\\Character\\Jump-End\\Jump-End.aseprite");
-	player_attack = LoadSprite(ctx, "assets\\legacy_fantasy_high_forest\\Character\\Attack-01\\Attack-01.aseprite");
-	player_die = LoadSprite(ctx, "assets\\legacy_fantasy_high_forest\\Character\\Dead\\Dead.aseprite");
+		SPALL_BUFFER_END();
+	}
 
-	boar_idle = LoadSprite(ctx, "assets\\legacy_fantasy_high_forest\\Mob\\Boar\\Idle\\Idle.aseprite");
-	boar_walk = LoadSprite(ctx, "assets\\legacy_fantasy_high_forest\\Mob\\Boar\\Walk\\Walk-Base.aseprite");
-	boar_run = LoadSprite(ctx, "assets\\legacy_fantasy_high_forest\\Mob\\Boar\\Run\\Run.aseprite");
-	boar_hit = LoadSprite(ctx, "assets\\legacy_fantasy_high_forest\\Mob\\Boar\\Hit-Vanish\\Hit.aseprite");
+	if (bench_boars)
+	{
+		BenchmarkBoars(ctx, 10000, 60);
+		BenchmarkBoars(ctx, 100000, 60);
+		DestroyJobPool(&ctx->jobs);
+		SDL_Quit();
+		return 0;
+	}
 
-	spr_tiles = LoadSprite(ctx, "assets\\legacy_fantasy_high_forest\\Assets\\Tiles.aseprite");
+	if (bake_only)
+	{
+		DestroyJobPool(&ctx->jobs);
+		SDL_Quit();
+		return 0;
+	}
 
+	PackSpriteAtlas(ctx);
+	for (SpriteFormat format = 0; format < SpriteFormat_Count; format += 1)
+	{
+		SpriteAtlas* atlas = &ctx->atlases[format];
+		if (atlas->num_cells == 0) continue;
+		SDL_Log("Packed %llu %s cells (%llu duplicates skipped) into %llu atlas pages of %dx%d", 
+			atlas->num_cells, format == SpriteFormat_Indexed ? "indexed" : "RGBA", atlas->num_dups, 
+			atlas->num_pages, atlas->page_size, atlas->page_size);
+	}
 
 	// CreateWindow
 	{
@@ -1380,9 +3806,6 @@ int32_t main(int32_t argc, char* argv[])
 		const SDL_DisplayMode* display_mode = SDL_GetDesktopDisplayMode(display);
 		SPALL_BUFFER_END();
 		SDL_CHECK(display_mode);
-		
-		// NOTE: After this, dt is effectively a constant.
-		dt = 60.0f/display_mode->refresh_rate;
 
 		{
 			SPALL_BUFFER_BEGIN_NAME("SDL_CreateWindow");
@@ -1617,6 +4040,14 @@ int32_t main(int32_t argc, char* argv[])
 
 		}
 
+		for (extension_idx = 0; extension_idx < ctx->vk.num_device_extensions; extension_idx += 1)
+		{
+			if (SDL_strcmp(ctx->vk.device_extensions[extension_idx].extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+			{
+				ctx->vk.has_memory_budget = true;
+			}
+		}
+
 		SPALL_BUFFER_END();
 	}
 
@@ -1679,10 +4110,16 @@ int32_t main(int32_t argc, char* argv[])
 		}
 
 #ifdef _DEBUG
-		static char const * const vk_device_extensions[] = { "VK_KHR_swapchain" };
+		char const * vk_device_extensions[] = { "VK_KHR_swapchain", NULL };
 #else
-		static char const * const vk_device_extensions[] = { "VK_KHR_swapchain" };
+		char const * vk_device_extensions[] = { "VK_KHR_swapchain", NULL };
 #endif // _DEBUG
+		uint32_t num_vk_device_extensions = 1;
+		if (ctx->vk.has_memory_budget)
+		{
+			vk_device_extensions[num_vk_device_extensions] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+			num_vk_device_extensions += 1;
+		}
 
 		VkDeviceCreateInfo device_info = 
 		{
@@ -1690,7 +4127,7 @@ int32_t main(int32_t argc, char* argv[])
 			.pNext = &physical_device_features,
 			.queueCreateInfoCount = (uint32_t)num_queue_infos,
 			.pQueueCreateInfos = queue_infos,
-			.enabledExtensionCount = SDL_arraysize(vk_device_extensions),
+			.enabledExtensionCount = num_vk_device_extensions,
 			.ppEnabledExtensionNames = vk_device_extensions,
 		};
 		if (vkCreateDevice(ctx->vk.physical_device, &device_info, NULL, &ctx->vk.device) != VK_SUCCESS)
@@ -1883,9 +4320,9 @@ int32_t main(int32_t argc, char* argv[])
 			.magFilter = VK_FILTER_NEAREST,
 			.minFilter = VK_FILTER_NEAREST,
 			.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
-			.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-			.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-			.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+			.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
 			.compareOp = VK_COMPARE_OP_ALWAYS,
 			.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
 		};
@@ -1916,6 +4353,7 @@ int32_t main(int32_t argc, char* argv[])
 		VK_CHECK(vkCreateDescriptorSetLayout(ctx->vk.device, &info, NULL, &ctx->vk.descriptor_set_layout_uniforms));
 	}
 	{
+		// The RGBA atlas, the indexed atlas, and the palettes for the indexed atlas.
 		VkDescriptorSetLayoutBinding bindings[] =
 		{
 			{
@@ -1923,7 +4361,19 @@ int32_t main(int32_t argc, char* argv[])
 				.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
 				.descriptorCount = 1,
 				.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
-			}
+			},
+			{
+				.binding = 1,
+				.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				.descriptorCount = 1,
+				.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+			},
+			{
+				.binding = 2,
+				.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				.descriptorCount = 1,
+				.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+			},
 		};
 
 		VkDescriptorSetLayoutCreateInfo info =
@@ -1933,20 +4383,55 @@ int32_t main(int32_t argc, char* argv[])
 			.pBindings = bindings,
 		};
 
-		VK_CHECK(vkCreateDescriptorSetLayout(ctx->vk.device, &info, NULL, &ctx->vk.descriptor_set_layout_sprites));
+		VK_CHECK(vkCreateDescriptorSetLayout(ctx->vk.device, &info, NULL, &ctx->vk.descriptor_set_layout_atlas));
+	}
+#if TOGGLE_GPU_ENTITIES
+	{
+		// The entities, the sprites, their frames, their cells, the instances, and the draws.
+		VkDescriptorSetLayoutBinding bindings[6];
+		for (uint32_t binding_idx = 0; binding_idx < SDL_arraysize(bindings); binding_idx += 1)
+		{
+			bindings[binding_idx] = (VkDescriptorSetLayoutBinding)
+			{
+				.binding = binding_idx,
+				.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				.descriptorCount = 1,
+				.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			};
+		}
+
+		VkDescriptorSetLayoutCreateInfo info =
+		{
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+			.bindingCount = SDL_arraysize(bindings),
+			.pBindings = bindings,
+		};
+
+		VK_CHECK(vkCreateDescriptorSetLayout(ctx->vk.device, &info, NULL, &ctx->vk.descriptor_set_layout_entities));
 	}
+#endif // TOGGLE_GPU_ENTITIES
 
 	// VulkanCreatePipelineLayout
 	{
 		SPALL_BUFFER_BEGIN_NAME("VulkanCreatePipelineLayout");
 
-		VkDescriptorSetLayout layouts[] = {ctx->vk.descriptor_set_layout_uniforms, ctx->vk.descriptor_set_layout_sprites};
+		VkDescriptorSetLayout layouts[] = {ctx->vk.descriptor_set_layout_uniforms, ctx->vk.descriptor_set_layout_atlas};
+
+		// Context::camera_pos, which changes every frame.
+		VkPushConstantRange push_constant_range = 
+		{
+			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+			.offset = 0,
+			.size = sizeof(ivec2s),
+		};
 
 		VkPipelineLayoutCreateInfo pipeline_layout_info =
 		{
 			.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
 			.setLayoutCount = SDL_arraysize(layouts),
 			.pSetLayouts = layouts,
+			.pushConstantRangeCount = 1,
+			.pPushConstantRanges = &push_constant_range,
 		};
 
 		VK_CHECK(vkCreatePipelineLayout(ctx->vk.device, &pipeline_layout_info, NULL, &ctx->vk.pipeline_layout));
@@ -2047,7 +4532,32 @@ int32_t main(int32_t argc, char* argv[])
 		{
 			.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
 		};
+
+		// Not every driver is good at rejecting a cache that some other GPU or driver wrote, so 
+		// that gets checked before the driver ever sees it.
+		MappedFile file = {0};
+		if (!ctx->rebake && MapFile(PIPELINE_CACHE_PATH, &file) && file.size >= sizeof(PipelineCacheHeader))
+		{
+			PipelineCacheHeader* header = file.data;
+			VkPhysicalDeviceProperties* properties = &ctx->vk.physical_device_properties;
+			bool valid = 
+				header->magic == PIPELINE_CACHE_MAGIC && 
+				header->version == PIPELINE_CACHE_VERSION && 
+				header->vendor_id == properties->vendorID && 
+				header->device_id == properties->deviceID && 
+				header->driver_version == properties->driverVersion && 
+				SDL_memcmp(header->pipeline_cache_uuid, properties->pipelineCacheUUID, VK_UUID_SIZE) == 0 && 
+				header->data_size == file.size - sizeof(PipelineCacheHeader) && 
+				XXH3_64bits(header + 1, header->data_size) == header->data_hash;
+			if (valid)
+			{
+				info.initialDataSize = header->data_size;
+				info.pInitialData = header + 1;
+			}
+		}
+		ctx->vk.pipeline_cache_warm = info.initialDataSize > 0;
 		VK_CHECK(vkCreatePipelineCache(ctx->vk.device, &info, NULL, &ctx->vk.pipeline_cache));
+		UnmapFile(&file);
 
 		SPALL_BUFFER_END();
 	}
@@ -2129,8 +4639,8 @@ int32_t main(int32_t argc, char* argv[])
 		};
 
 		// VulkanCreateGraphicsPipelineTile
-		VkPipelineShaderStageCreateInfo tile_vert = VulkanCreateShaderStage(ctx->vk.device, "build/shaders/tile_vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
-		VkPipelineShaderStageCreateInfo tile_frag = VulkanCreateShaderStage(ctx->vk.device, "build/shaders/tile_frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+		VkPipelineShaderStageCreateInfo tile_vert = VulkanCreateShaderStage(ctx->vk.device, tile_vert_spv, sizeof(tile_vert_spv), VK_SHADER_STAGE_VERTEX_BIT);
+		VkPipelineShaderStageCreateInfo tile_frag = VulkanCreateShaderStage(ctx->vk.device, tile_frag_spv, sizeof(tile_frag_spv), VK_SHADER_STAGE_FRAGMENT_BIT);
 		VkPipelineShaderStageCreateInfo tile_shader_stages[] = 
 		{
 			tile_vert,
@@ -2173,8 +4683,8 @@ int32_t main(int32_t argc, char* argv[])
 		tile_graphics_pipeline_info.pVertexInputState = &tile_vertex_input_info;
 
 		// VulkanCreateGraphicsPipelineEntity
-		VkPipelineShaderStageCreateInfo entity_vert = VulkanCreateShaderStage(ctx->vk.device, "build/shaders/entity_vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
-		VkPipelineShaderStageCreateInfo entity_frag = VulkanCreateShaderStage(ctx->vk.device, "build/shaders/entity_frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+		VkPipelineShaderStageCreateInfo entity_vert = VulkanCreateShaderStage(ctx->vk.device, entity_vert_spv, sizeof(entity_vert_spv), VK_SHADER_STAGE_VERTEX_BIT);
+		VkPipelineShaderStageCreateInfo entity_frag = VulkanCreateShaderStage(ctx->vk.device, entity_frag_spv, sizeof(entity_frag_spv), VK_SHADER_STAGE_FRAGMENT_BIT);
 		VkPipelineShaderStageCreateInfo entity_shader_stages[] = 
 		{
 			entity_vert,
@@ -2199,8 +4709,20 @@ int32_t main(int32_t argc, char* argv[])
 			{
 				.location = 1,
 				.binding = 0,
+				.format = VK_FORMAT_R32G32B32A32_SINT,
+				.offset = offsetof(Instance, src),
+			},
+			{
+				.location = 2,
+				.binding = 0,
+				.format = VK_FORMAT_R32_SINT,
+				.offset = offsetof(Instance, atlas_page),
+			},
+			{
+				.location = 3,
+				.binding = 0,
 				.format = VK_FORMAT_R32_SINT,
-				.offset = offsetof(Instance, anim_frame_idx),
+				.offset = offsetof(Instance, palette),
 			},
 		};
 		VkPipelineVertexInputStateCreateInfo entity_vertex_input_info = 
@@ -2222,7 +4744,10 @@ int32_t main(int32_t argc, char* argv[])
 			entity_graphics_pipeline_info,
 		};
 
+		uint64_t start_ns = SDL_GetTicksNS();
 		VK_CHECK(vkCreateGraphicsPipelines(ctx->vk.device, ctx->vk.pipeline_cache, SDL_arraysize(infos), infos, NULL, ctx->vk.pipelines));
+		SDL_Log("Created %d graphics pipelines in %.2f ms with a %s pipeline cache", 
+			PIPELINE_COUNT, (double)(SDL_GetTicksNS() - start_ns)/1e6, ctx->vk.pipeline_cache_warm ? "warm" : "cold");
 
 		vkDestroyShaderModule(ctx->vk.device, entity_frag.module, NULL);
 		vkDestroyShaderModule(ctx->vk.device, entity_vert.module, NULL);
@@ -2231,240 +4756,89 @@ int32_t main(int32_t argc, char* argv[])
 		SPALL_BUFFER_END();
 	}
 
-#if TOGGLE_TESTS
-	size_t error_count = 0;
-	for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
-	{
-		SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
-		if (sd) 
-		{
-			for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1) 
-			{
-				for (size_t cell_idx = 0; cell_idx < sd->frames[frame_idx].num_cells; cell_idx += 1) 
-				{
-					SpriteCell* cell = &ctx->sprites[sprite_idx].frames[frame_idx].cells[cell_idx];
-					if (cell->size.x == 0 || cell->size.y == 0) 
-					{
-						SDL_Log("ERROR: (%s).frames[%llu].cells[%llu].size == 0", sd->name, frame_idx, cell_idx);
-						error_count += 1;
-					}
-				}
-			}
-		}
-	}
-	SDL_Log("Error count: %llu", error_count);
-#endif
-
-	// LoadLevel
+#if TOGGLE_GPU_ENTITIES
+	// VulkanCreateComputePipeline
 	{
-		SPALL_BUFFER_BEGIN_NAME("LoadLevel");
-
-		cJSON* head;
-		{
-			size_t file_len;
-
-			void* file_data = SDL_LoadFile("assets\\levels\\test.ldtk", &file_len); 
-			SDL_CHECK(file_data);
-
-			SPALL_BUFFER_BEGIN_NAME("cJSON_ParseWithLength");
-			head = cJSON_ParseWithLength((const char*)file_data, file_len);
-			SPALL_BUFFER_END();
-
-			SDL_free(file_data);
-		}
-		SDL_assert(HAS_FLAG(head->type, cJSON_Object));
-
-		cJSON* level_nodes = cJSON_GetObjectItem(head, "levels");
-		cJSON* level_node = level_nodes->child;
-
-		cJSON* w = cJSON_GetObjectItem(level_node, "pxWid");
-		ctx->level.size.x = ((int32_t)cJSON_GetNumberValue(w))/TILE_SIZE;
-
-		cJSON* h = cJSON_GetObjectItem(level_node, "pxHei");
-		ctx->level.size.y = ((int32_t)cJSON_GetNumberValue(h))/TILE_SIZE;
-
-		size_t num_tiles = (size_t)(ctx->level.size.x*ctx->level.size.y);
-		ctx->level.tiles = ArenaAlloc(&ctx->arena, num_tiles, bool);
-
-		ctx->level.num_tile_layers = 3;
-		ctx->level.tile_layers = ArenaAlloc(&ctx->arena, ctx->level.num_tile_layers, TileLayer);
-
-		const char* layer_tiles = "Tiles";
-		const char* layer_props = "Props";
-		const char* layer_grass = "Grass";
-
-		ctx->level.num_entities = 1; // the player
-
-		const char* layer_player = "Player";
-		const char* layer_enemies = "Enemies";
-
-		cJSON* layer_instances = cJSON_GetObjectItem(level_node, "layerInstances");
-		cJSON* layer_instance; 
-		cJSON_ArrayForEach(layer_instance, layer_instances) 
-		{
-			cJSON* node_type = cJSON_GetObjectItem(layer_instance, "__type");
-			char* type = cJSON_GetStringValue(node_type); SDL_assert(type);
-			cJSON* node_ident = cJSON_GetObjectItem(layer_instance, "__identifier");
-			char* ident = cJSON_GetStringValue(node_ident); SDL_assert(ident);
+		SPALL_BUFFER_BEGIN_NAME("VulkanCreateComputePipeline");
 
-			if (SDL_strcmp(type, "Tiles") == 0) 
-			{
-				TileLayer* tile_layer = NULL;
-				// TODO
- 				if (SDL_strcmp(ident, layer_tiles) == 0) 
- 				{
-					tile_layer = &ctx->level.tile_layers[0];
-				} 
-				else if (SDL_strcmp(ident, layer_props) == 0) 
-				{
-					tile_layer = &ctx->level.tile_layers[1];
-				} 
-				else if (SDL_strcmp(ident, layer_grass) == 0) 
-				{
-					tile_layer = &ctx->level.tile_layers[2];
-				} 
-				else 
-				{
-					SDL_assert(!"Invalid layer!");
-				}
-
-				cJSON* grid_tiles = cJSON_GetObjectItem(layer_instance, "gridTiles");
-				cJSON* grid_tile; 
-				cJSON_ArrayForEach(grid_tile, grid_tiles) 
-				{
-					tile_layer->num_tiles += 1;
-				}
-				tile_layer->tiles = ArenaAlloc(&ctx->arena, tile_layer->num_tiles, Tile);
-				SDL_memset(tile_layer->tiles, -1, tile_layer->num_tiles * sizeof(Tile));
-			}
-			else if (SDL_strcmp(ident, layer_enemies) == 0) 
-			{
-				cJSON* entity_instances = cJSON_GetObjectItem(layer_instance, "entityInstances");
-				cJSON* entity_instance; 
-				cJSON_ArrayForEach(entity_instance, entity_instances) 
-				{
-					ctx->level.num_entities += 1;
-				}
-			}
-			else if (SDL_strcmp(ident, "IntGrid") == 0)
-			{
-				cJSON* tile_collisions = cJSON_GetObjectItem(layer_instance, "intGridCsv"); SDL_assert(tile_collisions);
-				cJSON* tile_collision;
-				size_t tile_collision_idx = 0;
-				cJSON_ArrayForEach(tile_collision, tile_collisions) 
-				{
-					bool val = (bool)cJSON_GetNumberValue(tile_collision);
-					ctx->level.tiles[tile_collision_idx++] = val;
-				}
-			}
-		}
-
-		ctx->level.entities = ArenaAlloc(&ctx->arena, ctx->level.num_entities, Entity);
-		Entity* enemy = &ctx->level.entities[1];
-
-		cJSON_ArrayForEach(layer_instance, layer_instances) 
+		VkPushConstantRange push_constant_range = 
 		{
-			cJSON* node_type = cJSON_GetObjectItem(layer_instance, "__type");
-			char* type = cJSON_GetStringValue(node_type); SDL_assert(type);
-			cJSON* node_ident = cJSON_GetObjectItem(layer_instance, "__identifier");
-			char* ident = cJSON_GetStringValue(node_ident); SDL_assert(ident);
-			if (SDL_strcmp(type, "Tiles") == 0) 
-			{
-				cJSON* grid_tiles = cJSON_GetObjectItem(layer_instance, "gridTiles");
-
-				// TODO
-				TileLayer* tile_layer = NULL;
- 				if (SDL_strcmp(ident, layer_tiles) == 0) 
- 				{
-					tile_layer = &ctx->level.tile_layers[0];
-				} 
-				else if (SDL_strcmp(ident, layer_props) == 0) 
-				{
-					tile_layer = &ctx->level.tile_layers[1];
-				} 
-				else if (SDL_strcmp(ident, layer_grass) == 0) 
-				{
-					tile_layer = &ctx->level.tile_layers[2];
-				} 
-				else 
-				{
-					SDL_assert(!"Invalid layer!");
-				}
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.offset = 0,
+			.size = sizeof(GpuEntityPushConstants),
+		};
 
-				size_t i = 0;
-				cJSON* grid_tile; 
-				cJSON_ArrayForEach(grid_tile, grid_tiles) 
-				{
-					cJSON* src_node = cJSON_GetObjectItem(grid_tile, "src");
-					ivec2s src = 
-					{
-						(int32_t)cJSON_GetNumberValue(src_node->child),
-						(int32_t)cJSON_GetNumberValue(src_node->child->next),
-					};
+		VkPipelineLayoutCreateInfo pipeline_layout_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+			.setLayoutCount = 1,
+			.pSetLayouts = &ctx->vk.descriptor_set_layout_entities,
+			.pushConstantRangeCount = 1,
+			.pPushConstantRanges = &push_constant_range,
+		};
+		VK_CHECK(vkCreatePipelineLayout(ctx->vk.device, &pipeline_layout_info, NULL, &ctx->vk.compute_pipeline_layout));
 
-					cJSON* dst_node = cJSON_GetObjectItem(grid_tile, "px");
-					ivec2s dst = 
-					{
-						(int32_t)cJSON_GetNumberValue(dst_node->child),
-						(int32_t)cJSON_GetNumberValue(dst_node->child->next),
-					};
+		VkPipelineShaderStageCreateInfo entity_comp = VulkanCreateShaderStage(ctx->vk.device, entity_comp_spv, sizeof(entity_comp_spv), VK_SHADER_STAGE_COMPUTE_BIT);
+		VkComputePipelineCreateInfo info = 
+		{
+			.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+#ifdef _DEBUG
+			.flags = VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT,
+#endif // _DEBUG
+			.stage = entity_comp,
+			.layout = ctx->vk.compute_pipeline_layout,
+		};
+		VK_CHECK(vkCreateComputePipelines(ctx->vk.device, ctx->vk.pipeline_cache, 1, &info, NULL, &ctx->vk.compute_pipeline));
 
-					SDL_assert(i < tile_layer->num_tiles);
-					tile_layer->tiles[i++] = (Tile){src, dst};
-				}
-			}
-			else if (SDL_strcmp(type, "Entities") == 0) 
-			{
-				cJSON* entity_instances = cJSON_GetObjectItem(layer_instance, "entityInstances");
+		vkDestroyShaderModule(ctx->vk.device, entity_comp.module, NULL);
+		SPALL_BUFFER_END();
+	}
+#endif // TOGGLE_GPU_ENTITIES
 
-				if (SDL_strcmp(ident, layer_player) == 0) 
-				{
-					cJSON* entity_instance = entity_instances->child;
-					cJSON* world_x = cJSON_GetObjectItem(entity_instance, "__worldX");
-					cJSON* world_y = cJSON_GetObjectItem(entity_instance, "__worldY");
-					ctx->level.entities[0].start_pos = (ivec2s){(int32_t)cJSON_GetNumberValue(world_x), (int32_t)cJSON_GetNumberValue(world_y)};
-				} 
-				else if (SDL_strcmp(ident, layer_enemies) == 0) 
+#if TOGGLE_TESTS
+	size_t error_count = 0;
+	for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
+	{
+		SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
+		if (sd) 
+		{
+			for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1) 
+			{
+				for (size_t cell_idx = 0; cell_idx < sd->frames[frame_idx].num_cells; cell_idx += 1) 
 				{
-					cJSON* entity_instance; cJSON_ArrayForEach(entity_instance, entity_instances) 
+					SpriteCell* cell = &ctx->sprites[sprite_idx].frames[frame_idx].cells[cell_idx];
+					if (cell->size.x == 0 || cell->size.y == 0) 
 					{
-						cJSON* identifier_node = cJSON_GetObjectItem(entity_instance, "__identifier");
-						char* identifier = cJSON_GetStringValue(identifier_node);
-						cJSON* world_x = cJSON_GetObjectItem(entity_instance, "__worldX");
-						cJSON* world_y = cJSON_GetObjectItem(entity_instance, "__worldY");
-						enemy->start_pos = (ivec2s){(int32_t)cJSON_GetNumberValue(world_x), (int32_t)cJSON_GetNumberValue(world_y)};
-						if (SDL_strcmp(identifier, "Boar") == 0) 
-						{
-							enemy->type = EntityType_Boar;
-						} // else if (SDL_strcmp(identifier, "") == 0) {}
-						enemy += 1;
+						SDL_Log("ERROR: (%s).frames[%llu].cells[%llu].size == 0", sd->name, frame_idx, cell_idx);
+						error_count += 1;
 					}
 				}
-			}	
+			}
 		}
-
-		cJSON_Delete(head);
-
-		SPALL_BUFFER_END();
 	}
+	SDL_Log("Error count: %llu", error_count);
+#endif
 
 #if TOGGLE_TESTS
 	// PrintLevel
+	for (size_t level_idx = 0; level_idx < ctx->world.num_levels; level_idx += 1) 
 	{
-		uint8_t* buf = StackAllocRaw(&ctx->stack, ctx->level.size.val.x + 1, 1);
-		SDL_Log("level start");
-		for (size_t y = 0; y < (size_t)(ctx->level.size.val.y); y += 1) 
+		// Levels aren't resident yet, so this goes straight to the bake.
+		Level* level = &ctx->world.levels[level_idx];
+		uint8_t* buf = StackAllocRaw(&ctx->stack, level->size.val.x + 1, 1);
+		SDL_Log("level %llu start", level_idx);
+		for (size_t y = 0; y < (size_t)(level->size.val.y); y += 1) 
 		{
-			for (size_t x = 0; x < (size_t)(ctx->level.size.val.x); x += 1) 
+			for (size_t x = 0; x < (size_t)(level->size.val.x); x += 1) 
 			{
-				buf[x] = ctx->level.tiles[x + y*(size_t)ctx->level.size.val.x];
+				buf[x] = level->bake_collision[x + y*(size_t)level->size.val.x];
 				if (buf[x] == 0) buf[x] = '0';
 				else buf[x] = '1';
 			}
-			buf[ctx->level.size.val.x] = 0;
+			buf[level->size.val.x] = 0;
 			SDL_Log((const char*)buf);
 		}
-		SDL_Log("level end");
+		SDL_Log("level %llu end", level_idx);
 		StackFree(&ctx->stack, buf);
 	}
 #endif
@@ -2473,63 +4847,34 @@ int32_t main(int32_t argc, char* argv[])
 	{
 		SPALL_BUFFER_BEGIN_NAME("VulkanCreateStaticStagingBuffer");
 
-		for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
-		{
-			SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
-			if (sd) 
-			{
-				for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1) 
-				{
-					for (size_t cell_idx = 0; cell_idx < sd->frames[frame_idx].num_cells; cell_idx += 1) 
-					{
-						SpriteCell* cell = &sd->frames[frame_idx].cells[cell_idx];
-						ctx->vk.static_staging_buffer.size += cell->size.x*cell->size.y * sizeof(uint32_t);
-					}
-				}
-			}
-		}
+		ctx->vk.static_staging_buffer.size += ctx->vk.num_palettes*PALETTE_SIZE*sizeof(uint32_t);
 		ctx->vk.static_staging_buffer.size += sizeof(Uniforms);
-		for (size_t tile_layer_idx = 0; tile_layer_idx < ctx->level.num_tile_layers; tile_layer_idx += 1) 
-		{
-			TileLayer* tile_layer = &ctx->level.tile_layers[tile_layer_idx];
-			ctx->vk.static_staging_buffer.size += tile_layer->num_tiles * sizeof(Tile);
-		}
 
 		ctx->vk.static_staging_buffer = VulkanCreateBuffer(&ctx->vk, ctx->vk.static_staging_buffer.size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 		VulkanSetBufferName(ctx->vk.device, ctx->vk.static_staging_buffer.handle, "Static Staging Buffer");
 
 		VulkanMapBufferMemory(&ctx->vk, &ctx->vk.static_staging_buffer);
 
+		// Palettes go in the order of SpriteDesc::palette_idx, which is the order of the hash map.
 		for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
 		{
 			SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
-			if (sd) 
+			if (sd && sd->format == SpriteFormat_Indexed) 
 			{
-				for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1) 
-				{
-					for (size_t cell_idx = 0; cell_idx < sd->frames[frame_idx].num_cells; cell_idx += 1) 
-					{
-						SpriteCell* cell = &sd->frames[frame_idx].cells[cell_idx];
-						VulkanCopyBuffer(cell->size.x*cell->size.y * sizeof(uint32_t), cell->dst_buf, &ctx->vk.static_staging_buffer);
-
-						SDL_free(cell->dst_buf); 
-						cell->dst_buf = NULL;
-					}
-				}
+				VulkanCopyBuffer(PALETTE_SIZE*sizeof(uint32_t), sd->palette, &ctx->vk.static_staging_buffer);
 			}
 		}
-		ivec2s tileset_size = GetTilesetDimensions(ctx, spr_tiles);
+
+		SpriteDesc* tileset_sd = GetSpriteDesc(ctx, spr_tiles);
+		SpriteCell* tileset = GetTilesetCell(ctx, spr_tiles);
 		Uniforms uniforms = {
 			.viewport_size = ctx->viewport_size,
-			.tileset_size = tileset_size,
+			.tileset_pos = glms_ivec2_sub(tileset->atlas_pos, glms_ivec2_add(tileset->origin, tileset->trim.min)),
+			.tileset_page = (int32_t)tileset->atlas_page,
+			.tileset_palette = tileset_sd->format == SpriteFormat_Indexed ? (int32_t)tileset_sd->palette_idx : -1,
 			.tile_size = 16,
 		};
 		VulkanCopyBuffer(sizeof(uniforms), &uniforms, &ctx->vk.static_staging_buffer);
-		for (size_t tile_layer_idx = 0; tile_layer_idx < ctx->level.num_tile_layers; tile_layer_idx += 1) 
-		{
-			TileLayer* tile_layer = &ctx->level.tile_layers[tile_layer_idx];
-			VulkanCopyBuffer(tile_layer->num_tiles*sizeof(Tile), tile_layer->tiles, &ctx->vk.static_staging_buffer);
-		}
 
 		SDL_assert(ctx->vk.static_staging_buffer.offset == ctx->vk.static_staging_buffer.size);
 		VulkanUnmapBufferMemory(&ctx->vk, &ctx->vk.static_staging_buffer);
@@ -2537,117 +4882,196 @@ int32_t main(int32_t argc, char* argv[])
 		SPALL_BUFFER_END();
 	}
 
-	// VulkanCreateImages
+	// VulkanCreateUploadRing
 	{
-		SPALL_BUFFER_BEGIN_NAME("VulkanCreateImages");
+		SPALL_BUFFER_BEGIN_NAME("VulkanCreateUploadRing");
 
-		VkMemoryRequirements mem_reqs[MAX_SPRITES];
-		VkBindImageMemoryInfo bind_infos[MAX_SPRITES];
-		VkDeviceSize memory_offset = 0;
-		size_t i = 0;
-		for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
+		size_t num_upload_cells = 0;
+		for (SpriteFormat format = 0; format < SpriteFormat_Count; format += 1)
 		{
-			SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
-			if (sd) 
-			{
-				VkImageCreateInfo info = 
-				{
-					.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-					.imageType = VK_IMAGE_TYPE_2D,
-					.format = VK_FORMAT_R8G8B8A8_SRGB,
-					.extent = (VkExtent3D){(uint32_t)sd->size.x, (uint32_t)sd->size.y, 1},
-					.mipLevels = 1,
-					.samples = VK_SAMPLE_COUNT_1_BIT,
-					.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT|VK_IMAGE_USAGE_SAMPLED_BIT,
-				};
+			num_upload_cells += ctx->atlases[format].num_cells;
+		}
+		ctx->vk.upload_cells = ArenaAlloc(&ctx->arena, num_upload_cells, SpriteCell*);
 
-				// Different frames might have different amounts of cells.
+		// Only the trimmed part of each cell gets streamed, so that's all the ring ever has to hold.
+		size_t upload_size = 0;
+		for (SpriteFormat format = 0; format < SpriteFormat_Count; format += 1)
+		{
+			for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
+			{
+				SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
+				if (!sd || sd->format != format) continue;
 				for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1) 
 				{
-					info.arrayLayers += (uint32_t)sd->frames[frame_idx].num_cells;
+					SpriteFrame* sf = &sd->frames[frame_idx];
+					for (size_t cell_idx = 0; cell_idx < sf->num_cells; cell_idx += 1) 
+					{
+						SpriteCell* cell = &sf->cells[cell_idx];
+						if (cell->dup) continue;
+						SDL_assert(ctx->vk.num_upload_cells < num_upload_cells);
+						ctx->vk.upload_cells[ctx->vk.num_upload_cells++] = cell;
+
+						SpriteCell trimmed = {.size = glms_ivec2_sub(cell->trim.max, cell->trim.min), .format = cell->format};
+						upload_size += AlignForward(GetSpriteCellBufSize(&trimmed), 4);
+					}
 				}
-				sd->vk_image_array_layers = (size_t)info.arrayLayers;
+			}
+		}
+		SDL_assert(ctx->vk.num_upload_cells == num_upload_cells);
 
-				VK_CHECK(vkCreateImage(ctx->vk.device, &info, NULL, &sd->vk_image));
-				VulkanSetImageName(ctx->vk.device, sd->vk_image, sd->name);
+		// The ring has to fit at least one row of the widest possible cell.
+		size_t ring_size = SDL_min(AlignForward(upload_size, 4), (size_t)UPLOAD_RING_SIZE);
+		ring_size = SDL_max(ring_size, (size_t)ATLAS_MAX_PAGE_SIZE*sizeof(uint32_t));
+		ctx->vk.upload_ring = VulkanCreateBuffer(&ctx->vk, ring_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		VulkanSetBufferName(ctx->vk.device, ctx->vk.upload_ring.handle, "Upload Ring");
+		VulkanMapBufferMemory(&ctx->vk, &ctx->vk.upload_ring);
 
-				vkGetImageMemoryRequirements(ctx->vk.device, sd->vk_image, &mem_reqs[i]);
-				memory_offset = AlignForward(memory_offset, mem_reqs[i].alignment);
-				bind_infos[i] = (VkBindImageMemoryInfo)
-				{
-					.sType = VK_STRUCTURE_TYPE_BIND_IMAGE_MEMORY_INFO,
-					.image = sd->vk_image,
-					//.memory = scroll down a little more!,
-					.memoryOffset = memory_offset,
-				};
-				memory_offset += mem_reqs[i].size;
-				i += 1;
-			}
+		SDL_Log("Streaming %.2f MB of sprite pixels through a %.2f MB upload ring", 
+			(double)upload_size/(1024.0*1024.0), (double)ring_size/(1024.0*1024.0));
+
+		SPALL_BUFFER_END();
+	}
+
+	// VulkanCreateImages
+	{
+		SPALL_BUFFER_BEGIN_NAME("VulkanCreateImages");
+
+		static const VkFormat atlas_formats[SpriteFormat_Count] = {VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_R8_UINT};
+		static char* atlas_names[SpriteFormat_Count] = {"Sprite Atlas (RGBA)", "Sprite Atlas (Indexed)"};
+
+		VkImageCreateInfo infos[SpriteFormat_Count + 1];
+		VkImage images[SpriteFormat_Count + 1];
+		for (SpriteFormat format = 0; format < SpriteFormat_Count; format += 1)
+		{
+			SpriteAtlas* atlas = &ctx->atlases[format];
+			SDL_assert((uint32_t)atlas->page_size <= ctx->vk.physical_device_properties.limits.maxImageDimension2D);
+			SDL_assert((uint32_t)atlas->num_pages <= ctx->vk.physical_device_properties.limits.maxImageArrayLayers);
+
+			infos[format] = (VkImageCreateInfo)
+			{
+				.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+				.imageType = VK_IMAGE_TYPE_2D,
+				.format = atlas_formats[format],
+				.extent = (VkExtent3D){(uint32_t)atlas->page_size, (uint32_t)atlas->page_size, 1},
+				.mipLevels = 1,
+				.arrayLayers = (uint32_t)atlas->num_pages,
+				.samples = VK_SAMPLE_COUNT_1_BIT,
+				.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT|VK_IMAGE_USAGE_SAMPLED_BIT,
+			};
+			VK_CHECK(vkCreateImage(ctx->vk.device, &infos[format], NULL, &ctx->vk.atlas_images[format]));
+			VulkanSetImageName(ctx->vk.device, ctx->vk.atlas_images[format], atlas_names[format]);
+			images[format] = ctx->vk.atlas_images[format];
 		}
-		SDL_assert(i == ctx->num_sprites);
 
-		VkMemoryAllocateInfo allocate_info = 
+		// Even without any indexed sprites there has to be something to bind.
+		size_t num_palette_rows = SDL_max(ctx->vk.num_palettes, (size_t)1);
+		SDL_assert(num_palette_rows <= ctx->vk.physical_device_properties.limits.maxImageDimension2D);
+		infos[SpriteFormat_Count] = (VkImageCreateInfo)
 		{
-			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-			.allocationSize = memory_offset,
-			.memoryTypeIndex = VulkanGetMemoryTypeIdx(&ctx->vk, &mem_reqs[0], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+			.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+			.imageType = VK_IMAGE_TYPE_2D,
+			.format = VK_FORMAT_R8G8B8A8_SRGB,
+			.extent = (VkExtent3D){PALETTE_SIZE, (uint32_t)num_palette_rows, 1},
+			.mipLevels = 1,
+			.arrayLayers = 1,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT|VK_IMAGE_USAGE_SAMPLED_BIT,
 		};
-		VK_CHECK(vkAllocateMemory(ctx->vk.device, &allocate_info, NULL, &ctx->vk.image_memory));
+		VK_CHECK(vkCreateImage(ctx->vk.device, &infos[SpriteFormat_Count], NULL, &ctx->vk.palette_image));
+		VulkanSetImageName(ctx->vk.device, ctx->vk.palette_image, "Palettes");
+		images[SpriteFormat_Count] = ctx->vk.palette_image;
+
+		// All of the images share one suballocation.
+		VkMemoryRequirements mem_reqs = {.memoryTypeBits = UINT32_MAX};
+		VkDeviceSize offsets[SpriteFormat_Count + 1];
+		for (size_t image_idx = 0; image_idx < SDL_arraysize(images); image_idx += 1)
+		{
+			VkMemoryRequirements image_mem_reqs;
+			vkGetImageMemoryRequirements(ctx->vk.device, images[image_idx], &image_mem_reqs);
+			offsets[image_idx] = AlignForward(mem_reqs.size, image_mem_reqs.alignment);
+			mem_reqs.size = offsets[image_idx] + image_mem_reqs.size;
+			mem_reqs.alignment = SDL_max(mem_reqs.alignment, image_mem_reqs.alignment);
+			mem_reqs.memoryTypeBits &= image_mem_reqs.memoryTypeBits;
+		}
+		SDL_assert(mem_reqs.memoryTypeBits != 0);
 
-		for (size_t i = 0; i < ctx->num_sprites; i += 1) 
+		ctx->vk.image_memory = VulkanAllocateMemory(&ctx->vk, &mem_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VulkanMemoryCategory_Image);
+		VkDeviceMemory image_memory = ctx->vk.memory_blocks[ctx->vk.image_memory.block_idx].memory;
+		for (size_t image_idx = 0; image_idx < SDL_arraysize(images); image_idx += 1)
 		{
-			bind_infos[i].memory = ctx->vk.image_memory;
+			VK_CHECK(vkBindImageMemory(ctx->vk.device, images[image_idx], image_memory, ctx->vk.image_memory.offset + offsets[image_idx]));
 		}
-		VK_CHECK(vkBindImageMemory2(ctx->vk.device, (uint32_t)ctx->num_sprites, bind_infos));
 
-		for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
+		for (SpriteFormat format = 0; format < SpriteFormat_Count; format += 1)
 		{
-			SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
-			if (sd) 
+			VkImageViewCreateInfo view_info = 
 			{
-				bool is_tileset = false;
-				is_tileset = sprite_idx == spr_tiles.idx;
-				if (is_tileset) 
+				.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+				.image = ctx->vk.atlas_images[format],
+				.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+				.format = atlas_formats[format],
+				.subresourceRange = 
 				{
-					SDL_assert(sd->vk_image_array_layers == 1);
-					VkImageViewCreateInfo info = 
-					{
-						.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-						.image = sd->vk_image,
-						.viewType = VK_IMAGE_VIEW_TYPE_2D,
-						.format = VK_FORMAT_R8G8B8A8_SRGB,
-						.subresourceRange = 
-						{
-							.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-							.baseMipLevel = 0,
-							.levelCount = 1,
-							.baseArrayLayer = 0,
-							.layerCount = 1,
-						},
-					};
-					VK_CHECK(vkCreateImageView(ctx->vk.device, &info, NULL, &sd->vk_image_view));
-				} 
-				else 
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.baseMipLevel = 0,
+					.levelCount = 1,
+					.baseArrayLayer = 0,
+					.layerCount = (uint32_t)ctx->atlases[format].num_pages,
+				},
+			};
+			VK_CHECK(vkCreateImageView(ctx->vk.device, &view_info, NULL, &ctx->vk.atlas_image_views[format]));
+			VulkanSetImageViewName(ctx->vk.device, ctx->vk.atlas_image_views[format], atlas_names[format]);
+		}
+
+		VkImageViewCreateInfo palette_view_info = 
+		{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+			.image = ctx->vk.palette_image,
+			.viewType = VK_IMAGE_VIEW_TYPE_2D,
+			.format = VK_FORMAT_R8G8B8A8_SRGB,
+			.subresourceRange = 
+			{
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = 1,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			},
+		};
+		VK_CHECK(vkCreateImageView(ctx->vk.device, &palette_view_info, NULL, &ctx->vk.palette_image_view));
+		VulkanSetImageViewName(ctx->vk.device, ctx->vk.palette_image_view, "Palettes");
+
+		// ReportImageMemory
+		// Before the atlas, every sprite had its own RGBA texture array with one layer per cell, and
+		// every layer was as big as the whole sprite. Those images only get created here so that
+		// the driver can tell us how much memory they would have needed.
+		{
+			VkDeviceSize per_sprite_size = 0;
+			for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
+			{
+				SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
+				if (!sd) continue;
+
+				VkImageCreateInfo sprite_info = infos[SpriteFormat_RGBA];
+				sprite_info.extent = (VkExtent3D){(uint32_t)sd->size.x, (uint32_t)sd->size.y, 1};
+				sprite_info.arrayLayers = 0;
+				for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1) 
 				{
-					VkImageViewCreateInfo info = 
-					{
-						.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-						.image = sd->vk_image,
-						.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
-						.format = VK_FORMAT_R8G8B8A8_SRGB,
-						.subresourceRange = 
-						{
-							.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-							.baseMipLevel = 0,
-							.levelCount = 1,
-							.baseArrayLayer = 0,
-							.layerCount = (uint32_t)sd->vk_image_array_layers,
-						},
-					};
-					VK_CHECK(vkCreateImageView(ctx->vk.device, &info, NULL, &sd->vk_image_view));
+					sprite_info.arrayLayers += (uint32_t)sd->frames[frame_idx].num_cells;
 				}
-				VulkanSetImageViewName(ctx->vk.device, sd->vk_image_view, sd->name);
+
+				VkImage image;
+				VK_CHECK(vkCreateImage(ctx->vk.device, &sprite_info, NULL, &image));
+				VkMemoryRequirements sprite_mem_reqs;
+				vkGetImageMemoryRequirements(ctx->vk.device, image, &sprite_mem_reqs);
+				per_sprite_size = AlignForward(per_sprite_size, sprite_mem_reqs.alignment) + sprite_mem_reqs.size;
+				vkDestroyImage(ctx->vk.device, image, NULL);
 			}
+
+			SDL_Log("Sprite VRAM: %.2f MB as per-sprite texture arrays, %.2f MB as atlases and palettes (%.1f%%)", 
+				(double)per_sprite_size/(1024.0*1024.0), 
+				(double)mem_reqs.size/(1024.0*1024.0), 
+				100.0*(double)mem_reqs.size/(double)per_sprite_size);
 		}
 
 		SPALL_BUFFER_END();
@@ -2664,14 +5088,20 @@ int32_t main(int32_t argc, char* argv[])
 			},
 			{
 				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-				(uint32_t)ctx->num_sprites,
+				SpriteFormat_Count + 1,
+			},
+#if TOGGLE_GPU_ENTITIES
+			{
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				6,
 			},
+#endif // TOGGLE_GPU_ENTITIES
 		};
 
 		VkDescriptorPoolCreateInfo info =
 		{
 			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-			.maxSets = (uint32_t)ctx->num_sprites+1,
+			.maxSets = 2 + TOGGLE_GPU_ENTITIES,
 			.poolSizeCount = SDL_arraysize(sizes),
 			.pPoolSizes = sizes,
 		};
@@ -2695,119 +5125,266 @@ int32_t main(int32_t argc, char* argv[])
 	{
 		SPALL_BUFFER_BEGIN_NAME("VulkanCreateDescriptorSets");
 
-		const size_t descriptor_set_count = ctx->num_sprites + 1;
-
-		VkDescriptorSetLayout* descriptor_set_layouts = StackAlloc(&ctx->stack, descriptor_set_count, VkDescriptorSetLayout);
-		descriptor_set_layouts[0] = ctx->vk.descriptor_set_layout_uniforms;
-		for (size_t i = 1; i < descriptor_set_count; i += 1) 
+		VkDescriptorSetLayout descriptor_set_layouts[] = 
 		{
-			descriptor_set_layouts[i] = ctx->vk.descriptor_set_layout_sprites;
-		}
+			ctx->vk.descriptor_set_layout_uniforms,
+			ctx->vk.descriptor_set_layout_atlas,
+		};
 
 		VkDescriptorSetAllocateInfo info =
 		{
 			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
 			.descriptorPool = ctx->vk.descriptor_pool,
-			.descriptorSetCount = (uint32_t)descriptor_set_count,
+			.descriptorSetCount = SDL_arraysize(descriptor_set_layouts),
 			.pSetLayouts = descriptor_set_layouts,
 		};
 
-		VkDescriptorSet* descriptor_sets = StackAlloc(&ctx->stack, descriptor_set_count, VkDescriptorSet);
+		VkDescriptorSet descriptor_sets[SDL_arraysize(descriptor_set_layouts)];
 		VK_CHECK(vkAllocateDescriptorSets(ctx->vk.device, &info, descriptor_sets));
+		ctx->vk.descriptor_set_uniforms = descriptor_sets[0];
+		ctx->vk.descriptor_set_atlas = descriptor_sets[1];
 
-		VkDescriptorImageInfo* image_infos = StackAlloc(&ctx->stack, descriptor_set_count - 1, VkDescriptorImageInfo);
+		VkWriteDescriptorSet writes[] = 
+		{
+			{
+			    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			    .dstSet = ctx->vk.descriptor_set_uniforms,
+			    .dstBinding = 0,
+			    .descriptorCount = 1,
+			    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			    .pBufferInfo = &(VkDescriptorBufferInfo){
+			    	.buffer = ctx->vk.uniform_buffer.handle,
+			    	.offset = 0,
+			    	.range = ctx->vk.uniform_buffer.size,
+			    },
+			},
+			{
+			    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			    .dstSet = ctx->vk.descriptor_set_atlas,
+			    .dstBinding = 0,
+			    .descriptorCount = 1,
+			    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			    .pImageInfo = &(VkDescriptorImageInfo){
+					.sampler = ctx->vk.sampler,
+					.imageView = ctx->vk.atlas_image_views[SpriteFormat_RGBA],
+					.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			    },
+			},
+			{
+			    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			    .dstSet = ctx->vk.descriptor_set_atlas,
+			    .dstBinding = 1,
+			    .descriptorCount = 1,
+			    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			    .pImageInfo = &(VkDescriptorImageInfo){
+					.sampler = ctx->vk.sampler,
+					.imageView = ctx->vk.atlas_image_views[SpriteFormat_Indexed],
+					.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			    },
+			},
+			{
+			    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			    .dstSet = ctx->vk.descriptor_set_atlas,
+			    .dstBinding = 2,
+			    .descriptorCount = 1,
+			    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			    .pImageInfo = &(VkDescriptorImageInfo){
+					.sampler = ctx->vk.sampler,
+					.imageView = ctx->vk.palette_image_view,
+					.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			    },
+			},
+		};
+		vkUpdateDescriptorSets(ctx->vk.device, SDL_arraysize(writes), writes, 0, NULL);
 
-		// NOTE: For some strange reason, this array gets overwritten while writing to image_infos if we allocate it with the stack allocator.
-		// I have tried using address sanitizer and it does not catch anything. Also the stack allocator isn't causing problems anywhere else,
-		// which makes it strange that it seems to be causing problems here. I tried allocating more memory at startup, but that doesn't change anything
-		// either. Whatever, we can just allocate it with malloc and it's fine.
-		VkWriteDescriptorSet* writes = SDL_malloc(descriptor_set_count * sizeof(VkWriteDescriptorSet)); SDL_CHECK(writes); 
+		SPALL_BUFFER_END();
+	}
 
-		ctx->vk.descriptor_set_uniforms = descriptor_sets[0];
-		writes[0] = (VkWriteDescriptorSet)
-		{
-		    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-		    .dstSet = ctx->vk.descriptor_set_uniforms,
-		    .dstBinding = 0,
-		    .descriptorCount = 1,
-		    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-		    .pBufferInfo = &(VkDescriptorBufferInfo){
-		    	.buffer = ctx->vk.uniform_buffer.handle,
-		    	.offset = 0,
-		    	.range = ctx->vk.uniform_buffer.size,
-		    },
-		};
+	// VulkanCreateInstanceBuffer
+	{
+		SPALL_BUFFER_BEGIN_NAME("VulkanCreateInstanceBuffer");
 
-		size_t i = 1;
-		for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
+		VkMemoryPropertyFlags memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		if (VulkanHasMemoryType(&ctx->vk, memory_properties|VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+		{
+			memory_properties |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		}
+
+		// Every entity fits in its row no matter which frame it's on, even if its sprite isn't flattened.
+		size_t max_cells_per_entity = 1;
+		for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1)
 		{
 			SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
-			if (sd) 
+			for (size_t frame_idx = 0; sd && frame_idx < sd->num_frames; frame_idx += 1)
 			{
-				sd->vk_descriptor_set = descriptor_sets[i];
+				max_cells_per_entity = SDL_max(max_cells_per_entity, sd->frames[frame_idx].num_cells);
+			}
+		}
+#if TOGGLE_GPU_ENTITIES
+		ctx->vk.max_entities_per_frame = 1 + ctx->world.enemies.count;
+		ctx->vk.max_cells_per_entity = max_cells_per_entity;
+		ctx->vk.max_instances_per_frame = ctx->vk.max_entities_per_frame*ctx->vk.max_cells_per_entity;
+		VkDeviceSize size = ctx->vk.num_frames*ctx->vk.max_instances_per_frame*sizeof(Instance);
+		ctx->vk.instance_buffer = VulkanCreateBuffer(&ctx->vk, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VulkanSetBufferName(ctx->vk.device, ctx->vk.instance_buffer.handle, "Instance Buffer");
+
+		size = ctx->vk.num_frames*ctx->vk.max_entities_per_frame*sizeof(GpuEntity);
+		ctx->vk.entity_buffer = VulkanCreateBuffer(&ctx->vk, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, memory_properties);
+		VulkanSetBufferName(ctx->vk.device, ctx->vk.entity_buffer.handle, "Entity Buffer");
+		VulkanMapBufferMemory(&ctx->vk, &ctx->vk.entity_buffer);
+
+		size = ctx->vk.num_frames*sizeof(VkDrawIndirectCommand);
+		ctx->vk.draw_buffer = VulkanCreateBuffer(&ctx->vk, size, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VulkanSetBufferName(ctx->vk.device, ctx->vk.draw_buffer.handle, "Draw Buffer");
+#else
+		ctx->vk.max_instances_per_frame = (1 + ctx->world.enemies.count)*max_cells_per_entity;
+		VkDeviceSize size = ctx->vk.num_frames*ctx->vk.max_instances_per_frame*sizeof(Instance);
+		ctx->vk.instance_buffer = VulkanCreateBuffer(&ctx->vk, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, memory_properties);
+		VulkanSetBufferName(ctx->vk.device, ctx->vk.instance_buffer.handle, "Instance Buffer");
+		VulkanMapBufferMemory(&ctx->vk, &ctx->vk.instance_buffer);
+#endif // TOGGLE_GPU_ENTITIES
 
-				image_infos[i-1] = (VkDescriptorImageInfo)
-				{
-					.sampler = ctx->vk.sampler,
-					.imageView = sd->vk_image_view,
-					.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-				};
+		SPALL_BUFFER_END();
+	}
 
-				writes[i] = (VkWriteDescriptorSet)
-				{
-				    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-				    .dstSet = sd->vk_descriptor_set,
-				    .dstBinding = 0,
-				    .descriptorCount = 1,
-				    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-				    .pImageInfo = &image_infos[i-1],
-				};
+#if TOGGLE_GPU_ENTITIES
+	// VulkanCreateSpriteTable
+	// Everything entity.comp needs to know about the sprites, which never changes after 
+	// PackSpriteAtlas. Small enough that it doesn't need to go through a staging buffer.
+	{
+		SPALL_BUFFER_BEGIN_NAME("VulkanCreateSpriteTable");
 
-				i += 1;
+		size_t num_frames = 0;
+		size_t num_cells = 0;
+		for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1)
+		{
+			SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
+			for (size_t frame_idx = 0; sd && frame_idx < sd->num_frames; frame_idx += 1)
+			{
+				num_frames += 1;
+				num_cells += sd->frames[frame_idx].num_cells;
 			}
 		}
-		SDL_assert(i == descriptor_set_count);
 
-		vkUpdateDescriptorSets(ctx->vk.device, (uint32_t)descriptor_set_count, writes, 0, NULL);
+		VkDeviceSize alignment = ctx->vk.physical_device_properties.limits.minStorageBufferOffsetAlignment;
+		VkDeviceSize sprites_size = MAX_SPRITES*sizeof(GpuSprite);
+		VkDeviceSize frames_offset = AlignForward(sprites_size, alignment);
+		VkDeviceSize frames_size = SDL_max(num_frames, (size_t)1)*sizeof(GpuSpriteFrame);
+		VkDeviceSize cells_offset = AlignForward(frames_offset + frames_size, alignment);
+		VkDeviceSize cells_size = SDL_max(num_cells, (size_t)1)*sizeof(GpuSpriteCell);
+		ctx->vk.sprite_table_buffer = VulkanCreateBuffer(&ctx->vk, cells_offset + cells_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		VulkanSetBufferName(ctx->vk.device, ctx->vk.sprite_table_buffer.handle, "Sprite Table Buffer");
+		VulkanMapBufferMemory(&ctx->vk, &ctx->vk.sprite_table_buffer);
+
+		uint8_t* mapped_memory = ctx->vk.sprite_table_buffer.mapped_memory;
+		GpuSprite* sprites = (GpuSprite*)mapped_memory;
+		GpuSpriteFrame* frames = (GpuSpriteFrame*)(mapped_memory + frames_offset);
+		GpuSpriteCell* cells = (GpuSpriteCell*)(mapped_memory + cells_offset);
+		SDL_memset(mapped_memory, 0, cells_offset + cells_size);
+		for (size_t sprite_idx = 0, frame_base = 0, cell_base = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1)
+		{
+			SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
+			if (!sd) continue;
 
-		SDL_free(writes);
-		StackFree(&ctx->stack, image_infos);
-		StackFree(&ctx->stack, descriptor_sets);
-		StackFree(&ctx->stack, descriptor_set_layouts);
+			sprites[sprite_idx] = (GpuSprite)
+			{
+				.origin = sd->origin,
+				.size = sd->size,
+				.first_frame = (uint32_t)frame_base,
+				.palette = sd->format == SpriteFormat_Indexed ? (int32_t)sd->palette_idx : -1,
+			};
+			for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1, frame_base += 1)
+			{
+				SpriteFrame* sf = &sd->frames[frame_idx];
+				frames[frame_base] = (GpuSpriteFrame){(uint32_t)cell_base, (uint32_t)sf->num_cells};
+				for (size_t cell_idx = 0; cell_idx < sf->num_cells; cell_idx += 1, cell_base += 1)
+				{
+					SpriteCell* cell = &sf->cells[cell_idx];
+					cells[cell_base] = (GpuSpriteCell)
+					{
+						.pos = glms_ivec2_add(cell->origin, cell->trim.min),
+						.size = glms_ivec2_sub(cell->trim.max, cell->trim.min),
+						.atlas_pos = cell->atlas_pos,
+						.atlas_page = (int32_t)cell->atlas_page,
+					};
+				}
+			}
+		}
 
-		SPALL_BUFFER_END();
-	}
+		VulkanUnmapBufferMemory(&ctx->vk, &ctx->vk.sprite_table_buffer);
 
-	// VulkanCreateDynamicStagingBuffer
-	{
-		SPALL_BUFFER_BEGIN_NAME("VulkanCreateDynamicStagingBuffer");
+		VkDescriptorSetAllocateInfo info =
+		{
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+			.descriptorPool = ctx->vk.descriptor_pool,
+			.descriptorSetCount = 1,
+			.pSetLayouts = &ctx->vk.descriptor_set_layout_entities,
+		};
+		VK_CHECK(vkAllocateDescriptorSets(ctx->vk.device, &info, &ctx->vk.descriptor_set_entities));
 
-		VkDeviceSize size = 0;
-		size += ctx->level.num_entities*sizeof(Instance)*2;
-		ctx->vk.dynamic_staging_buffer = VulkanCreateBuffer(&ctx->vk, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		VulkanSetBufferName(ctx->vk.device, ctx->vk.dynamic_staging_buffer.handle, "Dynamic Staging Buffer");
-		VulkanMapBufferMemory(&ctx->vk, &ctx->vk.dynamic_staging_buffer);
+		// Same order as the bindings of descriptor_set_layout_entities.
+		VkDescriptorBufferInfo buffer_infos[] = 
+		{
+			{ ctx->vk.entity_buffer.handle, 0, VK_WHOLE_SIZE },
+			{ ctx->vk.sprite_table_buffer.handle, 0, sprites_size },
+			{ ctx->vk.sprite_table_buffer.handle, frames_offset, frames_size },
+			{ ctx->vk.sprite_table_buffer.handle, cells_offset, cells_size },
+			{ ctx->vk.instance_buffer.handle, 0, VK_WHOLE_SIZE },
+			{ ctx->vk.draw_buffer.handle, 0, VK_WHOLE_SIZE },
+		};
+		VkWriteDescriptorSet writes[SDL_arraysize(buffer_infos)];
+		for (uint32_t binding_idx = 0; binding_idx < SDL_arraysize(buffer_infos); binding_idx += 1)
+		{
+			writes[binding_idx] = (VkWriteDescriptorSet)
+			{
+			    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			    .dstSet = ctx->vk.descriptor_set_entities,
+			    .dstBinding = binding_idx,
+			    .descriptorCount = 1,
+			    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			    .pBufferInfo = &buffer_infos[binding_idx],
+			};
+		}
+		vkUpdateDescriptorSets(ctx->vk.device, SDL_arraysize(writes), writes, 0, NULL);
 
 		SPALL_BUFFER_END();
 	}
+#endif // TOGGLE_GPU_ENTITIES
 
-	// VulkanCreateVertexBuffer
+	// CreateWorldStreamer
 	{
-		SPALL_BUFFER_BEGIN_NAME("VulkanCreateVertexBuffer");
-
-		size_t size = 0;
-		size += ctx->level.num_entities*sizeof(Instance)*2;
-		for (size_t tile_layer_idx = 0; tile_layer_idx < ctx->level.num_tile_layers; tile_layer_idx += 1) 
+		SPALL_BUFFER_BEGIN_NAME("CreateWorldStreamer");
+
+		World* world = &ctx->world;
+
+		// Every slot is as big as the biggest level, so what this costs depends on how many levels 
+		// can be resident at once and how big they are, not on how many of them there are.
+		size_t size = SDL_max(WORLD_MAX_RESIDENT_LEVELS*world->max_tiles_per_level*sizeof(Tile), sizeof(Tile));
+		ctx->vk.world_staging_buffer = VulkanCreateBuffer(&ctx->vk, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		VulkanSetBufferName(ctx->vk.device, ctx->vk.world_staging_buffer.handle, "World Staging Buffer");
+		VulkanMapBufferMemory(&ctx->vk, &ctx->vk.world_staging_buffer);
+		ctx->vk.world_tile_buffer = VulkanCreateBuffer(&ctx->vk, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VulkanSetBufferName(ctx->vk.device, ctx->vk.world_tile_buffer.handle, "World Tile Buffer");
+
+		uint64_t* collision_words = SDL_malloc(WORLD_MAX_RESIDENT_LEVELS*SDL_max(world->max_collision_words, (size_t)1)*sizeof(uint64_t)); SDL_CHECK(collision_words);
+		Tile* staging_tiles = ctx->vk.world_staging_buffer.mapped_memory;
+		for (size_t slot_idx = 0; slot_idx < WORLD_MAX_RESIDENT_LEVELS; slot_idx += 1)
 		{
-			TileLayer* tile_layer = &ctx->level.tile_layers[tile_layer_idx];
-			size += tile_layer->num_tiles*sizeof(Tile);
+			LevelSlot* slot = &world->slots[slot_idx];
+			slot->collision.rows = collision_words + slot_idx*world->max_collision_words;
+			slot->staging_tiles = staging_tiles + slot_idx*world->max_tiles_per_level;
 		}
-		ctx->vk.vertex_buffer = VulkanCreateBuffer(&ctx->vk, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		VulkanSetBufferName(ctx->vk.device, ctx->vk.vertex_buffer.handle, "Vertex Buffer");
+
+		world->mutex = SDL_CreateMutex(); SDL_CHECK(world->mutex);
+		world->requests_available = SDL_CreateCondition(); SDL_CHECK(world->requests_available);
+		world->level_loaded = SDL_CreateCondition(); SDL_CHECK(world->level_loaded);
+		world->streamer = SDL_CreateThread(WorldStreamer, "WorldStreamer", world); SDL_CHECK(world->streamer);
 
 		SPALL_BUFFER_END();
 	}
 
+	VulkanLogMemoryUsage(&ctx->vk);
+
 	// InitReplayFrames
 #if TOGGLE_REPLAY_FRAMES
 	{
@@ -2819,6 +5396,7 @@ int32_t main(int32_t argc, char* argv[])
 	ResetGame(ctx);
 
 	ctx->running = true;
+	ctx->last_frame_ns = SDL_GetTicksNS();
 	while (ctx->running) 
 	{	
 		// GetInput
@@ -2835,8 +5413,6 @@ int32_t main(int32_t argc, char* argv[])
 				}
 			}
 
-			ctx->button_jump = false;
-			ctx->button_attack = false;
 			ctx->left_mouse_pressed = false;
 
 			SDL_Event event;
@@ -2957,29 +5533,55 @@ int32_t main(int32_t argc, char* argv[])
 
 			SPALL_BUFFER_END();
 		}
+		UpdateWorld(ctx);
+
 		bool paused;
 #if TOGGLE_REPLAY_FRAMES
 		paused = ctx->paused;
 #else
 		paused = false;
 #endif // TOGGLE_REPLAY_FRAMES
-		if (!paused) 
+
+		// The game ticks TICK_RATE times a second, however often frames come in: a frame runs as many
+		// ticks as fit into the time since the last one, and leaves the rest for the next frame.
+		uint64_t frame_ns = SDL_GetTicksNS();
+		ctx->tick_accumulator_ns += frame_ns - ctx->last_frame_ns;
+		ctx->last_frame_ns = frame_ns;
+		if (paused)
+		{
+			ctx->tick_accumulator_ns = 0;
+		}
+		for (size_t tick = 0; ctx->tick_accumulator_ns >= TICK_NS; tick += 1)
 		{
+			if (tick == MAX_TICKS_PER_FRAME)
+			{
+				// Catching up any further would only make the next frame slower still.
+				ctx->tick_accumulator_ns %= TICK_NS;
+				break;
+			}
+			ctx->tick_accumulator_ns -= TICK_NS;
+
 			// UpdateGame
 			{
 				SPALL_BUFFER_BEGIN_NAME("UpdateGame");
 
-				UpdatePlayer(ctx);
-				size_t num_enemies; Entity* enemies = GetEnemies(ctx, &num_enemies);
-				for (size_t enemy_idx = 0; enemy_idx < num_enemies; enemy_idx += 1) 
+				Entity* player = GetPlayer(ctx);
+				player->prev_pos = player->pos;
+				EntityStore* enemies = &ctx->world.enemies;
+				for (size_t enemy_idx = 0; enemy_idx < enemies->count; enemy_idx += 1)
 				{
-					Entity* enemy = &enemies[enemy_idx];
-					if (enemy->type == EntityType_Boar) 
-					{
-						UpdateBoar(ctx, enemy);
-					} // else if (enemy->type == EntityType_) { }
+					enemies->prev_pos[enemy_idx] = (ivec2s){enemies->pos_x[enemy_idx], enemies->pos_y[enemy_idx]};
 				}
 
+				RebuildEntityGrid(ctx);
+				UpdatePlayer(ctx);
+				UpdateBoars(ctx, enemies);
+
+				// Presses only ever count for one tick, but they still count if they came in during a 
+				// frame that had no tick.
+				ctx->button_jump = false;
+				ctx->button_attack = false;
+
 				SPALL_BUFFER_END();
 			}
 
@@ -2990,9 +5592,9 @@ int32_t main(int32_t argc, char* argv[])
 
 				ReplayFrame replay_frame = {0};
 				
-				replay_frame.entities = SDL_malloc(ctx->level.num_entities * sizeof(Entity)); SDL_CHECK(replay_frame.entities);
-				SDL_memcpy(replay_frame.entities, ctx->level.entities, ctx->level.num_entities * sizeof(Entity));
-				replay_frame.num_entities = ctx->level.num_entities;
+				replay_frame.player = ctx->world.player;
+				replay_frame.enemies = SDL_malloc(ctx->world.enemies.block_size); SDL_CHECK(replay_frame.enemies);
+				SDL_memcpy(replay_frame.enemies, ctx->world.enemies.block, ctx->world.enemies.block_size);
 					
 				ctx->replay_frames[ctx->replay_frame_idx++] = replay_frame;
 				if (ctx->replay_frame_idx >= ctx->c_replay_frames - 1) 
@@ -3006,60 +5608,30 @@ int32_t main(int32_t argc, char* argv[])
 			}
 #endif // TOGGLE_REPLAY_FRAMES
 		}
-		
-		// VulkanCopyInstancesToDynamicStagingBuffer
-		size_t num_instances;
-		{
-			SPALL_BUFFER_BEGIN_NAME("VulkanCopyInstancesToDynamicStagingBuffer");
-
-			size_t num_entities = ctx->level.num_entities;
-			Entity* entities = ctx->level.entities;
-			num_instances = 0;
-			for (size_t entity_idx = 0; entity_idx < num_entities; entity_idx += 1) 
-			{
-				Entity* entity = &entities[entity_idx];
-				if (entity->state != EntityState_Inactive)
-				{
-					SpriteDesc* sd = GetSpriteDesc(ctx, entity->anim.sprite);
-					num_instances += sd->frames[entity->anim.frame_idx].num_cells;
-				}
-			}
 
-			Instance* instances = StackAlloc(&ctx->stack, num_instances, Instance);
+		// Frames get drawn in between the last two ticks, so that movement looks smooth even when 
+		// there are more frames than ticks.
+		float alpha = paused ? 1.0f : (float)ctx->tick_accumulator_ns/(float)TICK_NS;
 
-			for (size_t entity_idx = 0, instance_idx = 0; entity_idx < num_entities && instance_idx < num_instances; entity_idx += 1) 
+		// UpdateCamera
+		{
+			// The camera follows the player, but never shows anything outside of the level the 
+			// player is in, unless the level is smaller than the screen.
+			Entity* player = GetPlayer(ctx);
+			ivec2s player_pos = InterpolatePos(player->prev_pos, player->pos, alpha);
+			ivec2s screen_size = glms_ivec2_scale(ctx->viewport_size, 2);
+			ivec2s camera_pos = glms_ivec2_sub(player_pos, ctx->viewport_size);
+			Level* level = GetLevelAt(&ctx->world, player->pos);
+			if (level)
 			{
-				Entity* entity = &entities[entity_idx];
-				if (entity->state != EntityState_Inactive)
-				{
-					SpriteDesc* sd = GetSpriteDesc(ctx, entity->anim.sprite);
-					size_t base_frame_idx = 0;
-					for (size_t frame_idx = 0; frame_idx < entity->anim.frame_idx; frame_idx += 1) 
-					{
-						base_frame_idx += sd->frames[frame_idx].num_cells;
-					}
-					for (
-						size_t cell_idx = 0; 
-						cell_idx < sd->frames[entity->anim.frame_idx].num_cells && instance_idx < num_instances; 
-						++cell_idx, ++instance_idx) 
-					{
-						Instance* instance = &instances[instance_idx];
-						ivec2s origin = GetEntityOrigin(ctx, entity);
-						instance->rect.min = glms_ivec2_sub(entity->pos, origin);
-						instance->rect.max = glms_ivec2_add(instance->rect.min, sd->size);
-						instance->anim_frame_idx = (int32_t)(base_frame_idx + cell_idx + 1)*entity->dir;
-					}			
-				}
-			}
-
-			VulkanCopyBuffer(num_instances * sizeof(Instance), instances, &ctx->vk.dynamic_staging_buffer);
-			VulkanResetBuffer(&ctx->vk.dynamic_staging_buffer);
-
-			StackFree(&ctx->stack, instances);
-			
-			SPALL_BUFFER_END();
+				ivec2s level_size = glms_ivec2_scale(level->size, TILE_SIZE);
+				ivec2s max = glms_ivec2_sub(glms_ivec2_add(level->pos, level_size), screen_size);
+				camera_pos.x = level_size.x > screen_size.x ? SDL_clamp(camera_pos.x, level->pos.x, max.x) : level->pos.x;
+				camera_pos.y = level_size.y > screen_size.y ? SDL_clamp(camera_pos.y, level->pos.y, max.y) : level->pos.y;
+			}
+			ctx->camera_pos = camera_pos;
 		}
-
+		
 		uint32_t image_idx;
 		VkCommandBuffer cb;
 
@@ -3069,6 +5641,9 @@ int32_t main(int32_t argc, char* argv[])
 
 			VK_CHECK(vkWaitForFences(ctx->vk.device, 1, &ctx->vk.frames[ctx->vk.current_frame].fence_in_flight, VK_TRUE, UINT64_MAX));
 			VK_CHECK(vkResetFences(ctx->vk.device, 1, &ctx->vk.frames[ctx->vk.current_frame].fence_in_flight));
+			
+			// Frames finish in order, so everything this frame put into the upload ring is free again.
+			ctx->vk.upload_ring_tail = SDL_max(ctx->vk.upload_ring_tail, ctx->vk.frames[ctx->vk.current_frame].upload_ring_head);
 
 			VK_CHECK(vkAcquireNextImageKHR(ctx->vk.device, ctx->vk.swapchain, UINT64_MAX, ctx->vk.frames[ctx->vk.current_frame].sem_image_available, VK_NULL_HANDLE, &image_idx));
 			if (image_idx == 0 && ctx->vk.staged && ctx->vk.static_staging_buffer.handle) 
@@ -3095,48 +5670,55 @@ int32_t main(int32_t argc, char* argv[])
 			{
 				ctx->vk.staged = true;
 
-				VkImageMemoryBarrier* image_memory_barriers_before = StackAlloc(&ctx->stack, ctx->num_sprites, VkImageMemoryBarrier);
-				VkImageMemoryBarrier* image_memory_barriers_after = StackAlloc(&ctx->stack, ctx->num_sprites, VkImageMemoryBarrier);
-				size_t i = 0;
-				for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
+				VkImage images[SpriteFormat_Count + 1];
+				VkImageSubresourceRange subresource_ranges[SpriteFormat_Count + 1];
+				for (SpriteFormat format = 0; format < SpriteFormat_Count; format += 1)
 				{
-					SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
-					if (!sd) continue;
-
-					VkImageSubresourceRange subresource_range = 
+					images[format] = ctx->vk.atlas_images[format];
+					subresource_ranges[format] = (VkImageSubresourceRange)
 					{
 						.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
 						.baseMipLevel = 0,
 						.levelCount = 1,
 						.baseArrayLayer = 0,
-						.layerCount = (uint32_t)sd->vk_image_array_layers,
+						.layerCount = (uint32_t)ctx->atlases[format].num_pages,
 					};
+				}
+				images[SpriteFormat_Count] = ctx->vk.palette_image;
+				subresource_ranges[SpriteFormat_Count] = (VkImageSubresourceRange)
+				{
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.baseMipLevel = 0,
+					.levelCount = 1,
+					.baseArrayLayer = 0,
+					.layerCount = 1,
+				};
 
-					image_memory_barriers_before[i] = (VkImageMemoryBarrier)
+				VkImageMemoryBarrier image_memory_barriers_before[SpriteFormat_Count + 1];
+				VkImageMemoryBarrier image_memory_barriers_after[SpriteFormat_Count + 1];
+				for (size_t image_idx = 0; image_idx < SDL_arraysize(images); image_idx += 1)
+				{
+					image_memory_barriers_before[image_idx] = (VkImageMemoryBarrier)
 					{
 						.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
 						.srcAccessMask = 0,
 						.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
 						.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
 						.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-						.image = sd->vk_image,
-						.subresourceRange = subresource_range,
+						.image = images[image_idx],
+						.subresourceRange = subresource_ranges[image_idx],
 					};
-
-					image_memory_barriers_after[i] = (VkImageMemoryBarrier)
+					image_memory_barriers_after[image_idx] = (VkImageMemoryBarrier)
 					{
 						.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
 						.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
 						.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
 						.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 						.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-						.image = sd->vk_image,
-						.subresourceRange = subresource_range,
+						.image = images[image_idx],
+						.subresourceRange = subresource_ranges[image_idx],
 					};
-
-					i += 1;
 				}
-				SDL_assert(i == ctx->num_sprites);
 
 				VkBufferMemoryBarrier buffer_memory_barriers_before[] = 
 				{
@@ -3147,20 +5729,6 @@ int32_t main(int32_t argc, char* argv[])
 						.buffer = ctx->vk.static_staging_buffer.handle,
 						.size = ctx->vk.static_staging_buffer.size,
 					},
-					{
-						.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-						.srcAccessMask = 0,
-						.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
-						.buffer = ctx->vk.dynamic_staging_buffer.handle,
-						.size = ctx->vk.dynamic_staging_buffer.size,
-					},
-					{
-						.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-						.srcAccessMask = 0,
-						.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-						.buffer = ctx->vk.vertex_buffer.handle,
-						.size = ctx->vk.vertex_buffer.size,
-					},
 					{
 						.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
 						.srcAccessMask = 0,
@@ -3173,75 +5741,51 @@ int32_t main(int32_t argc, char* argv[])
 					VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 
 					0, NULL, 
 					SDL_arraysize(buffer_memory_barriers_before), buffer_memory_barriers_before, 
-					(uint32_t)ctx->num_sprites, image_memory_barriers_before);
-				
-				for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
+					SDL_arraysize(image_memory_barriers_before), image_memory_barriers_before);
+
+				// Nothing else ever gets written to the atlases, so the padding between cells has to be
+				// cleared before VulkanStreamSpriteCells starts putting cells in. Until a cell arrives,
+				// whatever uses it just draws nothing.
+				for (size_t image_idx = 0; image_idx < SDL_arraysize(images); image_idx += 1)
 				{
-					SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
-					if (!sd) continue;
-					VkBufferImageCopy* regions = StackAlloc(&ctx->stack, sd->vk_image_array_layers, VkBufferImageCopy);
-					size_t region_idx = 0;
-					for (size_t frame_idx = 0; frame_idx < sd->num_frames; frame_idx += 1) 
-					{
-						SpriteFrame* sf = &sd->frames[frame_idx];
-						for (size_t cell_idx = 0; cell_idx < sf->num_cells; cell_idx += 1) 
-						{
-							SpriteCell* cell = &sf->cells[cell_idx];
-							SDL_assert(region_idx < sd->vk_image_array_layers);
-							regions[region_idx] = (VkBufferImageCopy)
-							{
-								.bufferOffset = ctx->vk.static_staging_buffer.offset,
-								.imageSubresource = (VkImageSubresourceLayers)
-								{
-									.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-									.mipLevel = 0,
-									.baseArrayLayer = (uint32_t)region_idx,
-									.layerCount = 1,
-								},
-								.imageOffset = (VkOffset3D)
-								{
-									.x = cell->origin.x,
-									.y = cell->origin.y,
-									.z = 0,
-								},
-								.imageExtent = (VkExtent3D)
-								{
-									.width = (uint32_t)cell->size.x,
-									.height = (uint32_t)cell->size.y,
-									.depth = 1,
-								},
-							};
-							region_idx += 1;
-							ctx->vk.static_staging_buffer.offset += cell->size.x*cell->size.y * sizeof(uint32_t);
-						}
-					}
-					vkCmdCopyBufferToImage(cb, ctx->vk.static_staging_buffer.handle, sd->vk_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)sd->vk_image_array_layers, regions);
-					StackFree(&ctx->stack, regions);
+					vkCmdClearColorImage(cb, images[image_idx], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &(VkClearColorValue){0}, 1, &subresource_ranges[image_idx]);
 				}
-
-				VulkanCmdCopyBuffer(cb, &ctx->vk.static_staging_buffer, &ctx->vk.uniform_buffer, UINT64_MAX);
-
-				VulkanCmdCopyBuffer(cb, &ctx->vk.static_staging_buffer, &ctx->vk.vertex_buffer, UINT64_MAX);
-				VkDeviceSize vertex_buffer_start = ctx->vk.vertex_buffer.offset;
-				VulkanCmdCopyBuffer(cb, &ctx->vk.dynamic_staging_buffer, &ctx->vk.vertex_buffer, UINT64_MAX);
-				ctx->vk.vertex_buffer.start = vertex_buffer_start;
-
 				{
-					VkBufferMemoryBarrier barrier = {
-						.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+					VkMemoryBarrier barrier = {
+						.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
 						.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-						.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
-						.buffer = ctx->vk.vertex_buffer.handle,
-						.size = ctx->vk.vertex_buffer.size,
+						.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
 					};
 
 					vkCmdPipelineBarrier(cb, 
-						VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 
-						0, NULL, 
+						VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 
 						1, &barrier, 
+						0, NULL, 
 						0, NULL);
 				}
 
+				// Same order as VulkanCreateStaticStagingBuffer: palettes, then uniforms. Tiles come from 
+				// world_staging_buffer instead, see VulkanUploadLevels.
+				if (ctx->vk.num_palettes > 0)
+				{
+					VkBufferImageCopy region = 
+					{
+						.bufferOffset = ctx->vk.static_staging_buffer.offset,
+						.imageSubresource = (VkImageSubresourceLayers)
+						{
+							.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+							.mipLevel = 0,
+							.baseArrayLayer = 0,
+							.layerCount = 1,
+						},
+						.imageExtent = (VkExtent3D){PALETTE_SIZE, (uint32_t)ctx->vk.num_palettes, 1},
+					};
+					vkCmdCopyBufferToImage(cb, ctx->vk.static_staging_buffer.handle, ctx->vk.palette_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+					ctx->vk.static_staging_buffer.offset += ctx->vk.num_palettes*PALETTE_SIZE*sizeof(uint32_t);
+				}
+
+				VulkanCmdCopyBuffer(cb, &ctx->vk.static_staging_buffer, &ctx->vk.uniform_buffer, UINT64_MAX);
+
 				{
 					VkBufferMemoryBarrier barrier = {
 						.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
@@ -3262,47 +5806,299 @@ int32_t main(int32_t argc, char* argv[])
 					VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 
 					0, NULL, 
 					0, NULL, 
-					(uint32_t)ctx->num_sprites, image_memory_barriers_after);
+					SDL_arraysize(image_memory_barriers_after), image_memory_barriers_after);
+			}
 
-				StackFree(&ctx->stack, image_memory_barriers_after);				
-				StackFree(&ctx->stack, image_memory_barriers_before);
-			} 
-			else 
+			// VulkanStreamSpriteCells
+			// Every frame copies as many trimmed rows of cells into the upload ring as fit in its 
+			// share of it, then copies those rows into the atlases. A frame's share frees up again
+			// once DrawBegin has waited on its fence, so host-visible memory stays at the size of 
+			// the ring no matter how many sprites there are.
+			if (ctx->vk.upload_ring.handle)
 			{
-				VkBufferMemoryBarrier buffer_memory_barriers_before[] = 
+				VulkanBuffer* ring = &ctx->vk.upload_ring;
+				size_t budget = ring->size/ctx->vk.num_frames;
+
+				// A cell can't take up more than two regions in one frame: one before the ring wraps 
+				// around, and one after.
+				size_t max_regions = 2*(ctx->vk.num_upload_cells - ctx->vk.upload_cell_idx);
+				// One allocation for both, since StackFree only ever gives back the last one.
+				size_t cap_regions = SDL_max(max_regions, (size_t)1);
+				VkBufferImageCopy* regions = StackAllocRaw(&ctx->stack, cap_regions*(sizeof(VkBufferImageCopy) + sizeof(SpriteFormat)), alignof(VkBufferImageCopy));
+				SpriteFormat* region_formats = (SpriteFormat*)(regions + cap_regions);
+				size_t num_regions = 0;
+				while (ctx->vk.upload_cell_idx < ctx->vk.num_upload_cells)
+				{
+					SpriteCell* cell = ctx->vk.upload_cells[ctx->vk.upload_cell_idx];
+					size_t bytes_per_pixel = cell->format == SpriteFormat_Indexed ? sizeof(uint8_t) : sizeof(uint32_t);
+					ivec2s trim_size = glms_ivec2_sub(cell->trim.max, cell->trim.min);
+					size_t row_size = (size_t)trim_size.x*bytes_per_pixel;
+					SDL_assert(row_size <= ring->size);
+
+					size_t ring_offset = ctx->vk.upload_ring_head % ring->size;
+					size_t contiguous = ring->size - ring_offset;
+					size_t num_free = ring->size - (ctx->vk.upload_ring_head - ctx->vk.upload_ring_tail);
+					if (contiguous < row_size && num_free >= contiguous && budget >= contiguous)
+					{
+						// Not even one row fits before the end, so skip ahead to the start.
+						ctx->vk.upload_ring_head += contiguous;
+						budget -= contiguous;
+						continue;
+					}
+
+					// Rounded down to 4 bytes, which keeps every region properly aligned for RGBA.
+					size_t available = SDL_min(SDL_min(contiguous, num_free), budget) & ~(size_t)3;
+					int32_t num_rows = (int32_t)SDL_min(available/row_size, (size_t)(trim_size.y - ctx->vk.upload_row));
+					if (num_rows == 0) break;
+
+					uint8_t* dst = (uint8_t*)ring->mapped_memory + ring_offset;
+					for (int32_t row = ctx->vk.upload_row; row < ctx->vk.upload_row + num_rows; row += 1)
+					{
+						size_t src_offset = ((size_t)(cell->trim.min.y + row)*cell->size.x + cell->trim.min.x)*bytes_per_pixel;
+						SDL_memcpy(dst, (const uint8_t*)cell->dst_buf + src_offset, row_size);
+						dst += row_size;
+					}
+
+					SDL_assert(num_regions < max_regions);
+					region_formats[num_regions] = cell->format;
+					regions[num_regions++] = (VkBufferImageCopy)
+					{
+						.bufferOffset = ring_offset,
+						.imageSubresource = (VkImageSubresourceLayers)
+						{
+							.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+							.mipLevel = 0,
+							.baseArrayLayer = cell->atlas_page,
+							.layerCount = 1,
+						},
+						.imageOffset = (VkOffset3D)
+						{
+							.x = cell->atlas_pos.x,
+							.y = cell->atlas_pos.y + ctx->vk.upload_row,
+							.z = 0,
+						},
+						.imageExtent = (VkExtent3D)
+						{
+							.width = (uint32_t)trim_size.x,
+							.height = (uint32_t)num_rows,
+							.depth = 1,
+						},
+					};
+
+					size_t num_bytes = AlignForward((size_t)num_rows*row_size, 4);
+					ctx->vk.upload_ring_head += num_bytes;
+					budget -= num_bytes;
+					ctx->vk.upload_row += num_rows;
+					if (ctx->vk.upload_row == trim_size.y)
+					{
+						cell->dst_buf = NULL;
+						ctx->vk.upload_row = 0;
+						ctx->vk.upload_cell_idx += 1;
+					}
+				}
+
+				if (num_regions > 0)
+				{
+					VkImageMemoryBarrier barriers_before[SpriteFormat_Count];
+					VkImageMemoryBarrier barriers_after[SpriteFormat_Count];
+					for (SpriteFormat format = 0; format < SpriteFormat_Count; format += 1)
+					{
+						VkImageSubresourceRange subresource_range = 
+						{
+							.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+							.baseMipLevel = 0,
+							.levelCount = 1,
+							.baseArrayLayer = 0,
+							.layerCount = (uint32_t)ctx->atlases[format].num_pages,
+						};
+						barriers_before[format] = (VkImageMemoryBarrier)
+						{
+							.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+							.srcAccessMask = 0,
+							.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+							.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+							.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+							.image = ctx->vk.atlas_images[format],
+							.subresourceRange = subresource_range,
+						};
+						barriers_after[format] = (VkImageMemoryBarrier)
+						{
+							.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+							.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+							.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+							.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+							.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+							.image = ctx->vk.atlas_images[format],
+							.subresourceRange = subresource_range,
+						};
+					}
+					vkCmdPipelineBarrier(cb, 
+						VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 
+						0, NULL, 
+						0, NULL, 
+						SDL_arraysize(barriers_before), barriers_before);
+
+					// upload_cells is grouped by format, so this is at most one copy per atlas.
+					for (size_t first_region = 0, region_idx = 1; region_idx <= num_regions; region_idx += 1)
+					{
+						if (region_idx == num_regions || region_formats[region_idx] != region_formats[first_region])
+						{
+							vkCmdCopyBufferToImage(cb, ring->handle, ctx->vk.atlas_images[region_formats[first_region]], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
+								(uint32_t)(region_idx - first_region), &regions[first_region]);
+							first_region = region_idx;
+						}
+					}
+
+					vkCmdPipelineBarrier(cb, 
+						VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 
+						0, NULL, 
+						0, NULL, 
+						SDL_arraysize(barriers_after), barriers_after);
+
+					ctx->vk.num_upload_frames += 1;
+				}
+				StackFree(&ctx->stack, regions);
+				ctx->vk.frames[ctx->vk.current_frame].upload_ring_head = ctx->vk.upload_ring_head;
+
+				if (ctx->vk.upload_cell_idx == ctx->vk.num_upload_cells)
+				{
+					// Every pixel is in the ring by now, so none of them are needed on the CPU anymore.
+					if (ctx->sprite_pixels)
+					{
+						SDL_free(ctx->sprite_pixels);
+						ctx->sprite_pixels = NULL;
+						for (size_t sprite_idx = 0; sprite_idx < MAX_SPRITES; sprite_idx += 1) 
+						{
+							SpriteDesc* sd = GetSpriteDesc(ctx, (Sprite){sprite_idx});
+							if (sd) UnmapFile(&sd->bake);
+						}
+						SDL_Log("Streamed every sprite cell in %llu frames", ctx->vk.num_upload_frames);
+					}
+
+					// The ring itself has to wait for the GPU to be done with it.
+					if (ctx->vk.upload_ring_tail == ctx->vk.upload_ring_head)
+					{
+						VulkanUnmapBufferMemory(&ctx->vk, ring);
+						VulkanDestroyBuffer(&ctx->vk, ring);
+					}
+				}
+			}
+
+			// VulkanUploadLevels
+			// Levels that the world streamer has finished loading get copied from their row of the 
+			// staging buffer into the same row of the tile buffer. Their staging row can't be reused 
+			// until the GPU is done with this frame, see RequestLevel.
+			{
+				World* world = &ctx->world;
+				VkBufferCopy regions[WORLD_MAX_RESIDENT_LEVELS];
+				uint32_t num_regions = 0;
+				for (size_t slot_idx = 0; slot_idx < WORLD_MAX_RESIDENT_LEVELS; slot_idx += 1)
+				{
+					LevelSlot* slot = &world->slots[slot_idx];
+					if (!slot->needs_upload) continue;
+					slot->needs_upload = false;
+					slot->reusable_frame = ctx->vk.frame_count + ctx->vk.num_frames + 1;
+
+					VkDeviceSize offset = slot_idx*world->max_tiles_per_level*sizeof(Tile);
+					regions[num_regions++] = (VkBufferCopy)
+					{
+						.srcOffset = offset,
+						.dstOffset = offset,
+						.size = slot->level->num_tiles*sizeof(Tile),
+					};
+				}
+
+				if (num_regions > 0)
 				{
+					VkBufferMemoryBarrier barrier_before = 
 					{
 						.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
 						.srcAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
 						.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-						.buffer = ctx->vk.vertex_buffer.handle,
-						.size = ctx->vk.vertex_buffer.size,
-					},
+						.buffer = ctx->vk.world_tile_buffer.handle,
+						.size = ctx->vk.world_tile_buffer.size,
+					};
+					vkCmdPipelineBarrier(cb, 
+						VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 
+						0, NULL, 
+						1, &barrier_before, 
+						0, NULL);
+
+					vkCmdCopyBuffer(cb, ctx->vk.world_staging_buffer.handle, ctx->vk.world_tile_buffer.handle, num_regions, regions);
+
+					VkBufferMemoryBarrier barrier_after = 
+					{
+						.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+						.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+						.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+						.buffer = ctx->vk.world_tile_buffer.handle,
+						.size = ctx->vk.world_tile_buffer.size,
+					};
+					vkCmdPipelineBarrier(cb, 
+						VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 
+						0, NULL, 
+						1, &barrier_after, 
+						0, NULL);
+				}
+			}
+
+#if TOGGLE_GPU_ENTITIES
+			// VulkanExpandEntities
+			// entity.comp turns the GpuEntities of this frame into instances, and works out how many 
+			// of them to draw, so the CPU never has to look at a single sprite frame. This has to 
+			// happen outside of the render pass. See Vulkan::entity_buffer.
+			{
+				VkDeviceSize draw_offset = ctx->vk.current_frame*sizeof(VkDrawIndirectCommand);
+				VkDrawIndirectCommand draw = {.vertexCount = 6};
+				vkCmdUpdateBuffer(cb, ctx->vk.draw_buffer.handle, draw_offset, sizeof(draw), &draw);
+
+				VkMemoryBarrier barrier_before = 
+				{
+					.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+					.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+					.dstAccessMask = VK_ACCESS_SHADER_READ_BIT|VK_ACCESS_SHADER_WRITE_BIT,
 				};
 				vkCmdPipelineBarrier(cb, 
-					VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 
+					VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 
+					1, &barrier_before, 
 					0, NULL, 
-					SDL_arraysize(buffer_memory_barriers_before), buffer_memory_barriers_before, 
 					0, NULL);
 
-				VulkanCmdCopyBuffer(cb, &ctx->vk.dynamic_staging_buffer, &ctx->vk.vertex_buffer, UINT64_MAX);
+				vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, ctx->vk.compute_pipeline);
+				vkCmdBindDescriptorSets(cb, 
+					VK_PIPELINE_BIND_POINT_COMPUTE, ctx->vk.compute_pipeline_layout, 
+					0, 1, &ctx->vk.descriptor_set_entities, 
+					0, NULL);
 
-				VkBufferMemoryBarrier buffer_memory_barriers_after[] = 
+				GpuEntityPushConstants push_constants = 
 				{
-					{
-						.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-						.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-						.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
-						.buffer = ctx->vk.vertex_buffer.handle,
-						.size = ctx->vk.vertex_buffer.size,
-					},
+					.num_entities = (uint32_t)ctx->vk.max_entities_per_frame,
+					.first_entity = (uint32_t)(ctx->vk.current_frame*ctx->vk.max_entities_per_frame),
+					.first_instance = (uint32_t)(ctx->vk.current_frame*ctx->vk.max_instances_per_frame),
+					.draw_idx = (uint32_t)ctx->vk.current_frame,
+					.max_cells_per_entity = (uint32_t)ctx->vk.max_cells_per_entity,
+					.alpha = alpha,
+				};
+				vkCmdPushConstants(cb, 
+					ctx->vk.compute_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 
+					0, sizeof(push_constants), &push_constants);
+
+				// Same as local_size_x in entity.comp.
+				vkCmdDispatch(cb, (uint32_t)((ctx->vk.max_entities_per_frame + 63)/64), 1, 1);
+
+				VkMemoryBarrier barrier_after = 
+				{
+					.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+					.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+					.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT|VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
 				};
 				vkCmdPipelineBarrier(cb, 
-					VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 
+					VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT|VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 
+					1, &barrier_after, 
 					0, NULL, 
-					SDL_arraysize(buffer_memory_barriers_after), buffer_memory_barriers_after, 
 					0, NULL);
 			}
+#endif // TOGGLE_GPU_ENTITIES
 
 			// VulkanBeginRenderPass
 			{
@@ -3322,6 +6118,117 @@ int32_t main(int32_t argc, char* argv[])
 			SPALL_BUFFER_END();
 		}
 
+#if TOGGLE_GPU_ENTITIES
+		// VulkanWriteEntities
+		// Same as VulkanWriteInstances, except that entity.comp takes it from here. Straight out of 
+		// the store's arrays, since this is all the CPU does per entity to draw it.
+		{
+			SPALL_BUFFER_BEGIN_NAME("VulkanWriteEntities");
+
+			GpuEntity* gpu_entities = (GpuEntity*)ctx->vk.entity_buffer.mapped_memory + ctx->vk.current_frame*ctx->vk.max_entities_per_frame;
+			Entity* player = GetPlayer(ctx);
+			gpu_entities[0] = (GpuEntity)
+			{
+				.pos = player->pos,
+				.prev_pos = player->prev_pos,
+				.sprite = (uint32_t)player->anim.sprite.idx,
+				.frame_idx = player->anim.frame_idx,
+				.dir = player->dir,
+				.active = player->state != EntityState_Inactive,
+			};
+			EntityStore* enemies = &ctx->world.enemies;
+			for (size_t enemy_idx = 0; enemy_idx < enemies->count; enemy_idx += 1)
+			{
+				gpu_entities[1 + enemy_idx] = (GpuEntity)
+				{
+					.pos = {enemies->pos_x[enemy_idx], enemies->pos_y[enemy_idx]},
+					.prev_pos = enemies->prev_pos[enemy_idx],
+					.sprite = (uint32_t)enemies->anim_sprite[enemy_idx].idx,
+					.frame_idx = enemies->anim_frame_idx[enemy_idx],
+					.dir = enemies->dir[enemy_idx],
+					.active = enemies->state[enemy_idx] != EntityState_Inactive,
+				};
+			}
+
+			SPALL_BUFFER_END();
+		}
+#else
+		// VulkanWriteInstances
+		// Instances go straight into this frame's region of the instance buffer, which DrawBegin
+		// just waited for the GPU to be done with.
+		size_t num_instances;
+		{
+			SPALL_BUFFER_BEGIN_NAME("VulkanWriteInstances");
+
+			// Drawing isn't hot enough to be worth its own pass over the store's arrays.
+			EntityStore* enemies = &ctx->world.enemies;
+			size_t num_entities = 1 + enemies->count;
+			Entity* entities = StackAlloc(&ctx->stack, num_entities, Entity);
+			entities[0] = *GetPlayer(ctx);
+			for (size_t enemy_idx = 0; enemy_idx < enemies->count; enemy_idx += 1)
+			{
+				entities[1 + enemy_idx] = GetStoreEntity(enemies, enemy_idx);
+			}
+
+			num_instances = 0;
+			for (size_t entity_idx = 0; entity_idx < num_entities; entity_idx += 1) 
+			{
+				Entity* entity = &entities[entity_idx];
+				if (entity->state != EntityState_Inactive)
+				{
+					SpriteDesc* sd = GetSpriteDesc(ctx, entity->anim.sprite);
+					num_instances += sd->frames[entity->anim.frame_idx].num_cells;
+				}
+			}
+
+			SDL_assert(num_instances <= ctx->vk.max_instances_per_frame);
+			num_instances = SDL_min(num_instances, ctx->vk.max_instances_per_frame);
+			Instance* instances = (Instance*)ctx->vk.instance_buffer.mapped_memory + ctx->vk.current_frame*ctx->vk.max_instances_per_frame;
+
+			for (size_t entity_idx = 0, instance_idx = 0; entity_idx < num_entities && instance_idx < num_instances; entity_idx += 1) 
+			{
+				Entity* entity = &entities[entity_idx];
+				if (entity->state != EntityState_Inactive)
+				{
+					SpriteDesc* sd = GetSpriteDesc(ctx, entity->anim.sprite);
+					SpriteFrame* sf = &sd->frames[entity->anim.frame_idx];
+					ivec2s pos = InterpolatePos(entity->prev_pos, entity->pos, alpha);
+					ivec2s sprite_pos = glms_ivec2_sub(pos, GetEntityOrigin(ctx, entity));
+					for (
+						size_t cell_idx = 0; 
+						cell_idx < sf->num_cells && instance_idx < num_instances; 
+						++cell_idx, ++instance_idx) 
+					{
+						SpriteCell* cell = &sf->cells[cell_idx];
+						ivec2s cell_pos = glms_ivec2_add(cell->origin, cell->trim.min);
+						ivec2s cell_size = glms_ivec2_sub(cell->trim.max, cell->trim.min);
+						if (entity->dir == -1)
+						{
+							cell_pos.x = sd->size.x - (cell_pos.x + cell_size.x);
+						}
+
+						Instance* instance = &instances[instance_idx];
+						instance->rect.min = glms_ivec2_add(sprite_pos, cell_pos);
+						instance->rect.max = glms_ivec2_add(instance->rect.min, cell_size);
+						instance->src.min = cell->atlas_pos;
+						instance->src.max = glms_ivec2_add(cell->atlas_pos, cell_size);
+						if (entity->dir == -1)
+						{
+							instance->src.min.x = cell->atlas_pos.x + cell_size.x;
+							instance->src.max.x = cell->atlas_pos.x;
+						}
+						instance->atlas_page = (int32_t)cell->atlas_page;
+						instance->palette = sd->format == SpriteFormat_Indexed ? (int32_t)sd->palette_idx : -1;
+					}			
+				}
+			}
+
+			StackFree(&ctx->stack, entities);
+			
+			SPALL_BUFFER_END();
+		}
+#endif // TOGGLE_GPU_ENTITIES
+
 		/**
 		 * By this point you might be asking: why on Earth are you doing things this way? Why not
 		 * just write a simple GL 1.1x style renderer on top of Vulkan? That would take about the
@@ -3356,97 +6263,49 @@ int32_t main(int32_t argc, char* argv[])
 		// DrawTiles
 		{
 			VkDeviceSize offset = 0;
-			vkCmdBindVertexBuffers(cb, 0, 1, &ctx->vk.vertex_buffer.handle, &offset);
+			vkCmdBindVertexBuffers(cb, 0, 1, &ctx->vk.world_tile_buffer.handle, &offset);
 
 			vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->vk.pipelines[0]);
 
-			SpriteDesc* sd =  GetSpriteDesc(ctx, spr_tiles);
 			VkDescriptorSet descriptor_sets[] = {
 				ctx->vk.descriptor_set_uniforms, 
-				sd->vk_descriptor_set
+				ctx->vk.descriptor_set_atlas
 			};
 			vkCmdBindDescriptorSets(cb, 
 				VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->vk.pipeline_layout, 
 				0, SDL_arraysize(descriptor_sets), descriptor_sets, 
 				0, NULL);
 
-			size_t num_tiles = 0;
-			for (size_t layer_idx = 0; layer_idx < ctx->level.num_tile_layers; layer_idx += 1) 
+			vkCmdPushConstants(cb, 
+				ctx->vk.pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 
+				0, sizeof(ctx->camera_pos), &ctx->camera_pos);
+
+			// One draw per resident level, each out of its own row of the tile buffer. By now 
+			// VulkanUploadLevels has copied every one of them.
+			for (size_t slot_idx = 0; slot_idx < WORLD_MAX_RESIDENT_LEVELS; slot_idx += 1) 
 			{
-				num_tiles += ctx->level.tile_layers[layer_idx].num_tiles;
+				Level* level = ctx->world.slots[slot_idx].level;
+				if (!level || level->state != LevelState_Resident || level->num_tiles == 0) continue;
+				vkCmdDraw(cb, 6, (uint32_t)level->num_tiles, 0, (uint32_t)(slot_idx*ctx->world.max_tiles_per_level));
 			}
-			vkCmdDraw(cb, 6, (uint32_t)num_tiles, 0, 0);
 		}
 		// DrawEntities
 		{
+			VkDeviceSize offset = ctx->vk.current_frame*ctx->vk.max_instances_per_frame*sizeof(Instance);
 			vkCmdBindVertexBuffers(cb, 
 				0, 1, 
-				&ctx->vk.vertex_buffer.handle, &ctx->vk.vertex_buffer.start);
+				&ctx->vk.instance_buffer.handle, &offset);
 
 			vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->vk.pipelines[1]);
 
-			size_t num_entities = ctx->level.num_entities;
-			Entity* entities = ctx->level.entities;
-			
-			// DrawPlayer
-			SpriteDesc* sd = GetSpriteDesc(ctx, entities[0].anim.sprite);
-			vkCmdBindDescriptorSets(cb, 
-				VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->vk.pipeline_layout, 
-				1, 1, &sd->vk_descriptor_set, 
-				0, NULL);
-			size_t num_instances_player = sd->frames[entities[0].anim.frame_idx].num_cells;
-			vkCmdDraw(cb, 6, (uint32_t)num_instances_player, 0, 0);
-
-			// DrawEnemies
-			// See VulkanCopyInstancesToDynamicStagingBuffer to see how num_instances was defined.
-			for (size_t
-				first_instance = num_instances_player,
-				num_instances_leftover = num_instances - num_instances_player,
-				cur_num_instances = 0,
-				entity_idx = 1;
-
-				first_instance < num_instances &&
-				num_instances_leftover > 0 &&
-				entity_idx < num_entities;
-
-				first_instance += cur_num_instances,
-				num_instances_leftover -= cur_num_instances)
-			{
-				Entity* entity = &entities[entity_idx];
-				if (entity->state == EntityState_Inactive)
-				{
-					entity_idx += 1;
-					continue;
-				}
-
-				Sprite sprite = entity->anim.sprite;
-				SpriteDesc* sd = GetSpriteDesc(ctx, sprite);
-
-				cur_num_instances = sd->frames[entity->anim.frame_idx].num_cells;
-
-				entity_idx += 1;
-				while (
-					entity_idx < num_entities && 
-					cur_num_instances < num_instances_leftover) 
-				{
-					if (entities[entity_idx].state != EntityState_Inactive)
-					{
-						if (!SpritesEqual(sprite, entities[entity_idx].anim.sprite))
-						{
-							break;
-						}
-						SpriteFrame* frame = &sd->frames[entities[entity_idx].anim.frame_idx];
-						cur_num_instances += frame->num_cells;
-					}
-					entity_idx += 1;
-				}
-
-				vkCmdBindDescriptorSets(cb, 
-					VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->vk.pipeline_layout, 
-					1, 1, &sd->vk_descriptor_set, 
-					0, NULL);
-				vkCmdDraw(cb, 6, (uint32_t)cur_num_instances, 0, (uint32_t)first_instance);
-			}
+			// Every cell lives in the atlas, which DrawTiles already bound, so all of the entities
+			// go out in one draw. See VulkanWriteInstances to see how num_instances was defined, or 
+			// VulkanExpandEntities for where the draw comes from with TOGGLE_GPU_ENTITIES.
+#if TOGGLE_GPU_ENTITIES
+			vkCmdDrawIndirect(cb, ctx->vk.draw_buffer.handle, ctx->vk.current_frame*sizeof(VkDrawIndirectCommand), 1, sizeof(VkDrawIndirectCommand));
+#else
+			vkCmdDraw(cb, 6, (uint32_t)num_instances, 0, 0);
+#endif // TOGGLE_GPU_ENTITIES
 		}
 
 		// DrawEnd
@@ -3484,14 +6343,61 @@ int32_t main(int32_t argc, char* argv[])
 			VK_CHECK(vkQueuePresentKHR(ctx->vk.graphics_queue, &present_info));
 
 			ctx->vk.current_frame = (ctx->vk.current_frame + 1) % ctx->vk.num_frames;
-
-			VulkanResetBuffer(&ctx->vk.dynamic_staging_buffer);
-			VulkanResetBuffer(&ctx->vk.vertex_buffer);
+			ctx->vk.frame_count += 1;
 
 			SPALL_BUFFER_END();
 		}
 	}
 
+	// DestroyWorldStreamer
+	{
+		// The streamer might be in the middle of writing a level into world_staging_buffer, so it 
+		// has to be done before anything goes away.
+		World* world = &ctx->world;
+		SDL_LockMutex(world->mutex);
+		world->quit = true;
+		SDL_BroadcastCondition(world->requests_available);
+		SDL_UnlockMutex(world->mutex);
+		SDL_WaitThread(world->streamer, NULL);
+		world->streamer = NULL;
+	}
+
+	DestroyJobPool(&ctx->jobs);
+
+	// VulkanSavePipelineCache
+	{
+		SPALL_BUFFER_BEGIN_NAME("VulkanSavePipelineCache");
+
+		size_t data_size;
+		VK_CHECK(vkGetPipelineCacheData(ctx->vk.device, ctx->vk.pipeline_cache, &data_size, NULL));
+		size_t file_size = sizeof(PipelineCacheHeader) + data_size;
+		uint8_t* buf = SDL_malloc(file_size); SDL_CHECK(buf);
+		VK_CHECK(vkGetPipelineCacheData(ctx->vk.device, ctx->vk.pipeline_cache, &data_size, buf + sizeof(PipelineCacheHeader)));
+
+		VkPhysicalDeviceProperties* properties = &ctx->vk.physical_device_properties;
+		PipelineCacheHeader* header = (PipelineCacheHeader*)buf;
+		*header = (PipelineCacheHeader)
+		{
+			.magic = PIPELINE_CACHE_MAGIC,
+			.version = PIPELINE_CACHE_VERSION,
+			.vendor_id = properties->vendorID,
+			.device_id = properties->deviceID,
+			.driver_version = properties->driverVersion,
+			.data_size = data_size,
+			.data_hash = XXH3_64bits(header + 1, data_size),
+		};
+		SDL_memcpy(header->pipeline_cache_uuid, properties->pipelineCacheUUID, VK_UUID_SIZE);
+
+		// The pipeline cache is only an optimization, so failing to write it isn't fatal.
+		if (!SDL_CreateDirectory(BAKE_CACHE_DIR) || !SDL_SaveFile(PIPELINE_CACHE_PATH, buf, file_size))
+		{
+			SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Failed to write %s: %s", PIPELINE_CACHE_PATH, SDL_GetError());
+		}
+
+		SDL_free(buf);
+		SPALL_BUFFER_END();
+	}
+
 	// NOTE: If we don't do this, we might not get the last few events.
 #if TOGGLE_PROFILING
 	spall_buffer_quit(&ctx->spall_ctx, &ctx->spall_buffer);
@@ -3,6 +3,21 @@
 #include <SDL_main.h>
 #include <SDL_vulkan.h>
 
+#ifdef SDL_PLATFORM_WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // SDL_PLATFORM_WINDOWS
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif // _MSC_VER
+
 #include <cglm/struct.h>
 
 #define XXH_STATIC_LINKING_ONLY /* access advanced declarations */
@@ -1,10 +1,20 @@
 #version 460
 
 layout (location = 0) in vec2 in_src;
+layout (location = 1) flat in int in_atlas_page;
+layout (location = 2) flat in int in_palette;
 layout (location = 0) out vec4 out_color;
 
-layout (binding = 0, set = 1) uniform sampler2D tileset;
+layout (binding = 0, set = 1) uniform sampler2DArray atlas;
+layout (binding = 1, set = 1) uniform usampler2DArray indexed_atlas;
+layout (binding = 2, set = 1) uniform sampler2D palettes;
 
 void main() {
-    out_color = texture(tileset, in_src);
-}
\ No newline at end of file
+    if (in_palette < 0) {
+        vec2 atlas_size = vec2(textureSize(atlas, 0).xy);
+        out_color = texture(atlas, vec3(in_src / atlas_size, float(in_atlas_page)));
+    } else {
+        uint idx = texelFetch(indexed_atlas, ivec3(ivec2(floor(in_src)), in_atlas_page), 0).r;
+        out_color = texelFetch(palettes, ivec2(int(idx), in_palette), 0);
+    }
+}
@@ -33,6 +33,64 @@ static size_t HashString(char* key, size_t len)
     return XXH3_64bits((const void*)key, len);
 }
 
+static bool MapFile(const char* path, MappedFile* file)
+{
+    SDL_assert(file);
+    *file = (MappedFile){0};
+#ifdef SDL_PLATFORM_WINDOWS
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL|FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    // CreateFileMappingA fails on empty files, so don't even try.
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(handle);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(handle);
+    if (!mapping) return false;
+
+    // The view keeps the mapping alive, so we don't need to hold onto either handle.
+    file->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!file->data) return false;
+    file->size = (size_t)size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    file->data = data;
+    file->size = (size_t)st.st_size;
+#endif // SDL_PLATFORM_WINDOWS
+    return true;
+}
+
+static void UnmapFile(MappedFile* file)
+{
+    if (file->data)
+    {
+#ifdef SDL_PLATFORM_WINDOWS
+        UnmapViewOfFile(file->data);
+#else
+        munmap(file->data, file->size);
+#endif // SDL_PLATFORM_WINDOWS
+    }
+    *file = (MappedFile){0};
+}
+
 // Why not just divide by 32768.0f? It's because there is one more negative value than positive value.
 static float NormInt16(int16_t i16) 
 {
@@ -43,61 +101,188 @@ static float NormInt16(int16_t i16)
     return res;
 }
 
-static bool* GetTiles(Level* level, size_t* num_tiles) 
+// Rounds toward negative infinity, unlike /, so that cells left of or above the origin work too.
+static int32_t FloorDiv(int32_t a, int32_t b) 
 {
-    SDL_assert(num_tiles);
-    ivec2s size = level->size;
-    *num_tiles = (size_t)(size.x*size.y);
-    return level->tiles;
+    SDL_assert(b > 0);
+    int32_t res = a/b;
+    if (a % b != 0 && a < 0) res -= 1;
+    return res;
 }
 
-static TileLayer* GetTileLayer(Level* level, size_t tile_layer_idx) 
+// Same as %, but never negative, to go with FloorDiv.
+static int32_t FloorMod(int32_t a, int32_t b) 
 {
-    return &level->tile_layers[tile_layer_idx];
+    return a - FloorDiv(a, b)*b;
 }
 
-static Tile* GetLayerTiles(Level* level, size_t tile_layer_idx, size_t* num_tiles) 
+// alpha of the way from prev to pos, rounded to the nearest pixel.
+static ivec2s InterpolatePos(ivec2s prev, ivec2s pos, float alpha) 
 {
-    SDL_assert(num_tiles);
-    *num_tiles = (size_t)level->size.x*level->size.y;
-    return level->tile_layers[tile_layer_idx].tiles;
+    ivec2s res;
+    res.x = prev.x + (int32_t)SDL_roundf((float)(pos.x - prev.x)*alpha);
+    res.y = prev.y + (int32_t)SDL_roundf((float)(pos.y - prev.y)*alpha);
+    return res;
 }
 
-static bool TileIsSolid(Level* level, ivec2s /* measured in tiles */ pos) 
+static int32_t CountTrailingZeros64(uint64_t x) 
 {
-    if ((!(pos.x >= 0 && pos.x < level->size.x && pos.y >= 0 && pos.y < level->size.y))) return false;
-    size_t idx = (size_t)(pos.x + pos.y*level->size.x);
-    SDL_assert(idx < level->size.x*level->size.y);
-    return level->tiles[idx];
+    SDL_assert(x != 0);
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward64(&idx, x);
+    return (int32_t)idx;
+#else
+    return __builtin_ctzll(x);
+#endif
 }
 
-static bool TileIsValid(Tile tile)
+static int32_t CountLeadingZeros64(uint64_t x) 
 {
-    return tile.src.x != -1 && tile.src.y != -1 && tile.dst.x != -1 && tile.dst.y != -1;
+    SDL_assert(x != 0);
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanReverse64(&idx, x);
+    return 63 - (int32_t)idx;
+#else
+    return __builtin_clzll(x);
+#endif
 }
 
-static bool TilesEqual(Tile a, Tile b) 
+// Bits lo through hi of a word, where 0 <= lo <= hi < 64.
+static uint64_t GetWordMask(int32_t lo, int32_t hi) 
 {
-    return a.src.x == b.src.x && a.src.y == b.src.y && a.dst.x == b.dst.x && a.dst.y == b.dst.y;
+    SDL_assert(0 <= lo && lo <= hi && hi < 64);
+    return (~0ULL >> (63 - hi)) & (~0ULL << lo);
 }
 
-static Entity* GetPlayer(Context* ctx) 
+// Index of the first set bit between lo and hi, or -1 if there isn't one. Only touches the words 
+// the span is in.
+static int32_t FindFirstBit(const uint64_t* bits, int32_t lo, int32_t hi) 
 {
-    return &ctx->level.entities[0];
+    for (int32_t word_idx = lo/64; word_idx <= hi/64; word_idx += 1) 
+    {
+        int32_t word_lo = word_idx == lo/64 ? lo%64 : 0;
+        int32_t word_hi = word_idx == hi/64 ? hi%64 : 63;
+        uint64_t word = bits[word_idx] & GetWordMask(word_lo, word_hi);
+        if (word) return word_idx*64 + CountTrailingZeros64(word);
+    }
+    return -1;
 }
 
-static Entity* GetEnemies(Context* ctx, size_t* num_enemies) 
+// Same as FindFirstBit, but for the last set bit.
+static int32_t FindLastBit(const uint64_t* bits, int32_t lo, int32_t hi) 
 {
-    SDL_assert(num_enemies);
-    if (ctx->level.num_entities <= 1) 
+    for (int32_t word_idx = hi/64; word_idx >= lo/64; word_idx -= 1) 
     {
-        *num_enemies = 0;
-        return NULL;
-    } else 
+        int32_t word_lo = word_idx == lo/64 ? lo%64 : 0;
+        int32_t word_hi = word_idx == hi/64 ? hi%64 : 63;
+        uint64_t word = bits[word_idx] & GetWordMask(word_lo, word_hi);
+        if (word) return word_idx*64 + 63 - CountLeadingZeros64(word);
+    }
+    return -1;
+}
+
+static size_t GetCollisionGridWords(ivec2s /* measured in tiles */ size) 
+{
+    size_t row_stride = ((size_t)size.x + 63)/64;
+    size_t col_stride = ((size_t)size.y + 63)/64;
+    return (size_t)size.y*row_stride + (size_t)size.x*col_stride;
+}
+
+/**
+ * Finds the first (or last) solid tile of a row (or column) between lo and hi, all measured in 
+ * tiles and relative to the world. The span gets clipped to each resident level once, after which it's just
+ * a few masked words, so wide hitboxes cost about the same as narrow ones.
+ */
+static bool FindSolidInSpan(World* world, bool column, bool last, int32_t line, int32_t lo, int32_t hi, int32_t* out_pos) 
+{
+    int32_t none = last ? INT32_MIN : INT32_MAX;
+    int32_t res = none;
+    for (size_t slot_idx = 0; slot_idx < WORLD_MAX_RESIDENT_LEVELS; slot_idx += 1) 
     {
-        *num_enemies = ctx->level.num_entities - 1;
-        return &ctx->level.entities[1];
+        Level* level = world->slots[slot_idx].level;
+        if (!level || !level->collision) continue;
+
+        ivec2s origin = glms_ivec2_divs(level->pos, TILE_SIZE);
+        int32_t level_line = line - (column ? origin.x : origin.y);
+        int32_t level_len = column ? level->size.y : level->size.x;
+        if (level_line < 0 || level_line >= (column ? level->size.x : level->size.y)) continue;
+        int32_t level_lo = SDL_max(lo - (column ? origin.y : origin.x), 0);
+        int32_t level_hi = SDL_min(hi - (column ? origin.y : origin.x), level_len - 1);
+        if (level_lo > level_hi) continue;
+
+        CollisionGrid* grid = level->collision;
+        const uint64_t* bits = column ? 
+            grid->cols + (size_t)level_line*grid->col_stride : 
+            grid->rows + (size_t)level_line*grid->row_stride;
+        int32_t idx = last ? FindLastBit(bits, level_lo, level_hi) : FindFirstBit(bits, level_lo, level_hi);
+        if (idx == -1) continue;
+        idx += column ? origin.y : origin.x;
+        res = last ? SDL_max(res, idx) : SDL_min(res, idx);
     }
+    if (out_pos) *out_pos = res;
+    return res != none;
+}
+
+static bool FindSolidInRow(World* world, int32_t y, int32_t x0, int32_t x1, int32_t* out_x) 
+{
+    return FindSolidInSpan(world, false, false, y, x0, x1, out_x);
+}
+
+static bool FindLastSolidInRow(World* world, int32_t y, int32_t x0, int32_t x1, int32_t* out_x) 
+{
+    return FindSolidInSpan(world, false, true, y, x0, x1, out_x);
+}
+
+static bool FindSolidInColumn(World* world, int32_t x, int32_t y0, int32_t y1, int32_t* out_y) 
+{
+    return FindSolidInSpan(world, true, false, x, y0, y1, out_y);
+}
+
+static bool FindLastSolidInColumn(World* world, int32_t x, int32_t y0, int32_t y1, int32_t* out_y) 
+{
+    return FindSolidInSpan(world, true, true, x, y0, y1, out_y);
+}
+
+static bool TileIsSolid(World* world, ivec2s /* measured in tiles, relative to the world */ pos) 
+{
+    return FindSolidInRow(world, pos.y, pos.x, pos.x, NULL);
+}
+
+static Level* GetLevelAt(World* world, ivec2s /* measured in pixels, relative to the world */ pos) 
+{
+    for (size_t level_idx = 0; level_idx < world->num_levels; level_idx += 1) 
+    {
+        Level* level = &world->levels[level_idx];
+        ivec2s level_pos = glms_ivec2_sub(pos, level->pos);
+        if (level_pos.x >= 0 && level_pos.x < level->size.x*TILE_SIZE && level_pos.y >= 0 && level_pos.y < level->size.y*TILE_SIZE) 
+        {
+            return level;
+        }
+    }
+    return NULL;
+}
+
+static bool LevelIsResidentAt(World* world, ivec2s /* measured in pixels, relative to the world */ pos) 
+{
+    Level* level = GetLevelAt(world, pos);
+    return level && level->state == LevelState_Resident;
+}
+
+static bool TileIsValid(Tile tile)
+{
+    return tile.src.x != -1 && tile.src.y != -1 && tile.dst.x != -1 && tile.dst.y != -1;
+}
+
+static bool TilesEqual(Tile a, Tile b) 
+{
+    return a.src.x == b.src.x && a.src.y == b.src.y && a.dst.x == b.dst.x && a.dst.y == b.dst.y;
+}
+
+static Entity* GetPlayer(Context* ctx) 
+{
+    return &ctx->world.player;
 }
 
 static void ResetAnim(Anim* anim) 
@@ -288,6 +473,24 @@ static int32_t SDLCALL CompareSpriteCells(const SpriteCell* a, const SpriteCell*
     return 0;
 }
 
+static size_t GetSpriteCellBufSize(const SpriteCell* cell)
+{
+	size_t bytes_per_pixel = cell->format == SpriteFormat_Indexed ? sizeof(uint8_t) : sizeof(uint32_t);
+	return (size_t)cell->size.x*(size_t)cell->size.y*bytes_per_pixel;
+}
+
+// Grouped by format (each format has its own atlas), then tallest first, then widest first, 
+// which is what a shelf packer wants.
+static int32_t SDLCALL CompareSpriteCellsBySize(SpriteCell* const* a, SpriteCell* const* b)
+{
+	if ((*a)->format != (*b)->format) return (*a)->format < (*b)->format ? -1 : 1;
+	ivec2s a_size = glms_ivec2_sub((*a)->trim.max, (*a)->trim.min);
+	ivec2s b_size = glms_ivec2_sub((*b)->trim.max, (*b)->trim.min);
+	if (a_size.y != b_size.y) return a_size.y > b_size.y ? -1 : 1;
+	if (a_size.x != b_size.x) return a_size.x > b_size.x ? -1 : 1;
+	return 0;
+}
+
 static Rect TileToRect(ivec2s tile)
 {
     Rect res;
@@ -295,3 +498,89 @@ static Rect TileToRect(ivec2s tile)
     res.max = glms_ivec2_adds(res.min, TILE_SIZE);
     return res;
 }
+
+// Carves every array of the store out of one block. type_starts is up to the caller.
+static void AllocEntityStore(EntityStore* store, size_t count) 
+{
+    struct { void** array; size_t size; } arrays[] = 
+    {
+        { (void**)&store->pos_x, sizeof(int32_t) },
+        { (void**)&store->pos_y, sizeof(int32_t) },
+        { (void**)&store->vel_x, sizeof(float) },
+        { (void**)&store->vel_y, sizeof(float) },
+        { (void**)&store->pos_remainder_x, sizeof(float) },
+        { (void**)&store->pos_remainder_y, sizeof(float) },
+        { (void**)&store->state, sizeof(EntityState) },
+        { (void**)&store->anim_dt_accumulator, sizeof(float) },
+        { (void**)&store->anim_frame_idx, sizeof(uint32_t) },
+        { (void**)&store->anim_sprite, sizeof(Sprite) },
+        { (void**)&store->anim_ended, sizeof(bool) },
+        { (void**)&store->dir, sizeof(int32_t) },
+        { (void**)&store->prev_pos, sizeof(ivec2s) },
+        { (void**)&store->start_pos, sizeof(ivec2s) },
+    };
+
+    // Every array starts on its own cache line.
+    size_t block_size = 0;
+    for (size_t array_idx = 0; array_idx < SDL_arraysize(arrays); array_idx += 1) 
+    {
+        block_size = AlignForward(block_size, 64) + arrays[array_idx].size*count;
+    }
+    store->count = count;
+    store->block_size = block_size;
+    store->block = SDL_aligned_alloc(64, SDL_max(block_size, (size_t)1)); SDL_CHECK(store->block);
+    SDL_memset(store->block, 0, block_size);
+
+    size_t offset = 0;
+    for (size_t array_idx = 0; array_idx < SDL_arraysize(arrays); array_idx += 1) 
+    {
+        offset = AlignForward(offset, 64);
+        *arrays[array_idx].array = (uint8_t*)store->block + offset;
+        offset += arrays[array_idx].size*count;
+    }
+}
+
+static Entity GetStoreEntity(EntityStore* store, size_t idx) 
+{
+    SDL_assert(idx < store->count);
+    Entity res = {0};
+    res.anim.sprite = store->anim_sprite[idx];
+    res.anim.dt_accumulator = store->anim_dt_accumulator[idx];
+    res.anim.frame_idx = store->anim_frame_idx[idx];
+    res.anim.ended = store->anim_ended[idx];
+    res.pos = (ivec2s){store->pos_x[idx], store->pos_y[idx]};
+    res.prev_pos = store->prev_pos[idx];
+    res.start_pos = store->start_pos[idx];
+    res.pos_remainder = (vec2s){store->pos_remainder_x[idx], store->pos_remainder_y[idx]};
+    res.vel = (vec2s){store->vel_x[idx], store->vel_y[idx]};
+    res.dir = store->dir[idx];
+    for (EntityType type = 0; type < EntityType_Count; type += 1) 
+    {
+        if (idx < store->type_starts[type + 1]) 
+        {
+            res.type = type;
+            break;
+        }
+    }
+    res.state = store->state[idx];
+    return res;
+}
+
+static void SetStoreEntity(EntityStore* store, size_t idx, Entity* entity) 
+{
+    SDL_assert(idx < store->count);
+    store->anim_sprite[idx] = entity->anim.sprite;
+    store->anim_dt_accumulator[idx] = entity->anim.dt_accumulator;
+    store->anim_frame_idx[idx] = entity->anim.frame_idx;
+    store->anim_ended[idx] = entity->anim.ended;
+    store->pos_x[idx] = entity->pos.x;
+    store->pos_y[idx] = entity->pos.y;
+    store->prev_pos[idx] = entity->prev_pos;
+    store->start_pos[idx] = entity->start_pos;
+    store->pos_remainder_x[idx] = entity->pos_remainder.x;
+    store->pos_remainder_y[idx] = entity->pos_remainder.y;
+    store->vel_x[idx] = entity->vel.x;
+    store->vel_y[idx] = entity->vel.y;
+    store->dir[idx] = entity->dir;
+    store->state[idx] = entity->state;
+}
@@ -1,20 +1,340 @@
+// Only considers memory types that have every one of the requested properties, and of those 
+// prefers the one with the fewest properties on top, so that e.g. a staging buffer doesn't end up 
+// in HOST_CACHED memory, or a DEVICE_LOCAL buffer in the small HOST_VISIBLE window of VRAM.
 static uint32_t VulkanGetMemoryTypeIdx(Vulkan* vk, VkMemoryRequirements* mem_req, VkMemoryPropertyFlags properties) 
 {
-    uint32_t memory_type_idx;
-    bool found_memory_type_idx = false;
-    for (memory_type_idx = 0; memory_type_idx < vk->physical_device_memory_properties.memoryTypeCount; memory_type_idx += 1) 
+    uint32_t res = UINT32_MAX;
+    uint32_t best_num_extra_properties = UINT32_MAX;
+    for (uint32_t memory_type_idx = 0; memory_type_idx < vk->physical_device_memory_properties.memoryTypeCount; memory_type_idx += 1) 
     {
-        if ((mem_req->memoryTypeBits & (1 << memory_type_idx)) && (vk->physical_device_memory_properties.memoryTypes[memory_type_idx].propertyFlags & properties)) 
+        VkMemoryPropertyFlags type_properties = vk->physical_device_memory_properties.memoryTypes[memory_type_idx].propertyFlags;
+        if (!(mem_req->memoryTypeBits & (1 << memory_type_idx)) || (type_properties & properties) != properties) 
+        {
+            continue;
+        }
+
+        uint32_t num_extra_properties = 0;
+        for (VkMemoryPropertyFlags extra_properties = type_properties & ~properties; extra_properties; extra_properties &= extra_properties - 1) 
+        {
+            num_extra_properties += 1;
+        }
+        if (num_extra_properties < best_num_extra_properties) 
+        {
+            res = memory_type_idx;
+            best_num_extra_properties = num_extra_properties;
+        }
+    }
+    SDL_assert(res != UINT32_MAX);
+    return res;
+}
+
+// Whether any memory type has every one of the requested properties, for properties that are 
+// nice to have. VulkanGetMemoryTypeIdx insists on all of them.
+static bool VulkanHasMemoryType(Vulkan* vk, VkMemoryPropertyFlags properties) 
+{
+    for (uint32_t memory_type_idx = 0; memory_type_idx < vk->physical_device_memory_properties.memoryTypeCount; memory_type_idx += 1) 
+    {
+        if ((vk->physical_device_memory_properties.memoryTypes[memory_type_idx].propertyFlags & properties) == properties) 
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static VulkanMemoryCategory VulkanGetBufferMemoryCategory(VkBufferUsageFlags usage) 
+{
+    if (usage & VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT) return VulkanMemoryCategory_Indirect;
+    if (usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT) return VulkanMemoryCategory_Vertex;
+    if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) return VulkanMemoryCategory_Uniform;
+    if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) return VulkanMemoryCategory_Storage;
+    SDL_assert(usage == VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    return VulkanMemoryCategory_Staging;
+}
+
+// Fills heap_budgets and heap_usages, of VK_MAX_MEMORY_HEAPS each, with what VK_EXT_memory_budget 
+// reports. Usage counts every process, not just the blocks of this one.
+static void VulkanGetMemoryBudget(Vulkan* vk, VkDeviceSize* heap_budgets, VkDeviceSize* heap_usages) 
+{
+    SDL_assert(vk->has_memory_budget);
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = 
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+    };
+    VkPhysicalDeviceMemoryProperties2 properties = 
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+        .pNext = &budget,
+    };
+    vkGetPhysicalDeviceMemoryProperties2(vk->physical_device, &properties);
+    SDL_memcpy(heap_budgets, budget.heapBudget, sizeof(budget.heapBudget));
+    SDL_memcpy(heap_usages, budget.heapUsage, sizeof(budget.heapUsage));
+}
+
+// Carves size bytes out of the block, or returns false if they don't fit.
+static bool VulkanSuballocate(VulkanMemoryBlock* block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset) 
+{
+    if (block->strategy == VulkanAllocStrategy_Linear) 
+    {
+        VkDeviceSize aligned_offset = AlignForward(block->used, alignment);
+        if (aligned_offset + size > block->size) 
+        {
+            return false;
+        }
+        *offset = aligned_offset;
+        block->used = aligned_offset + size;
+        return true;
+    }
+
+    SDL_assert(block->strategy == VulkanAllocStrategy_FreeList);
+    for (size_t range_idx = 0; range_idx < block->num_free_ranges; range_idx += 1) 
+    {
+        VulkanFreeRange* range = &block->free_ranges[range_idx];
+        VkDeviceSize aligned_offset = AlignForward(range->offset, alignment);
+        VkDeviceSize range_end = range->offset + range->size;
+        VkDeviceSize end = aligned_offset + size;
+        if (end > range_end) 
+        {
+            continue;
+        }
+
+        // Whatever is left on either side of the allocation stays free.
+        if (aligned_offset > range->offset && end < range_end) 
+        {
+            if (block->num_free_ranges == VULKAN_MAX_FREE_RANGES) 
+            {
+                continue;
+            }
+            SDL_memmove(range + 2, range + 1, (block->num_free_ranges - range_idx - 1)*sizeof(VulkanFreeRange));
+            range[1] = (VulkanFreeRange){end, range_end - end};
+            range->size = aligned_offset - range->offset;
+            block->num_free_ranges += 1;
+        } 
+        else if (aligned_offset > range->offset) 
+        {
+            range->size = aligned_offset - range->offset;
+        } 
+        else if (end < range_end) 
+        {
+            *range = (VulkanFreeRange){end, range_end - end};
+        } 
+        else 
+        {
+            SDL_memmove(range, range + 1, (block->num_free_ranges - range_idx - 1)*sizeof(VulkanFreeRange));
+            block->num_free_ranges -= 1;
+        }
+        *offset = aligned_offset;
+        return true;
+    }
+    return false;
+}
+
+/*
+Suballocates from a block of the best memory type for the requested properties (see 
+VulkanGetMemoryTypeIdx), and only calls vkAllocateMemory when none of the blocks of that type has 
+room. Staging memory gets freed while the game runs, so its blocks keep a free list. Everything 
+else lives until the game quits, so its blocks just bump an offset. Every allocation is aligned 
+to bufferImageGranularity as well, so that buffers and images can share a block.
+*/
+static VulkanAllocation VulkanAllocateMemory(Vulkan* vk, VkMemoryRequirements* mem_req, VkMemoryPropertyFlags properties, VulkanMemoryCategory category) 
+{
+    SDL_assert(mem_req->size > 0);
+    uint32_t memory_type_idx = VulkanGetMemoryTypeIdx(vk, mem_req, properties);
+    VulkanAllocStrategy strategy = (category == VulkanMemoryCategory_Staging) ? VulkanAllocStrategy_FreeList : VulkanAllocStrategy_Linear;
+    VkDeviceSize alignment = SDL_max(mem_req->alignment, vk->physical_device_properties.limits.bufferImageGranularity);
+
+    VulkanAllocation res = {.size = mem_req->size, .category = category};
+    uint32_t block_idx;
+    for (block_idx = 0; block_idx < VULKAN_MAX_MEMORY_BLOCKS; block_idx += 1) 
+    {
+        VulkanMemoryBlock* block = &vk->memory_blocks[block_idx];
+        if (block->memory && block->memory_type_idx == memory_type_idx && block->strategy == strategy && 
+            VulkanSuballocate(block, res.size, alignment, &res.offset)) 
         {
-            found_memory_type_idx = true;
             break;
         }
     }
-    SDL_assert(found_memory_type_idx);
-    return memory_type_idx;
+
+    if (block_idx == VULKAN_MAX_MEMORY_BLOCKS) 
+    {
+        for (block_idx = 0; block_idx < VULKAN_MAX_MEMORY_BLOCKS && vk->memory_blocks[block_idx].memory; block_idx += 1);
+        SDL_assert(block_idx < VULKAN_MAX_MEMORY_BLOCKS);
+        VulkanMemoryBlock* block = &vk->memory_blocks[block_idx];
+
+        VkMemoryType* memory_type = &vk->physical_device_memory_properties.memoryTypes[memory_type_idx];
+        VkDeviceSize heap_size = vk->physical_device_memory_properties.memoryHeaps[memory_type->heapIndex].size;
+        VkDeviceSize block_size = (heap_size <= 1024ULL*1024ULL*1024ULL) ? heap_size/8 : VULKAN_MEMORY_BLOCK_SIZE;
+        block_size = SDL_max(block_size, res.size);
+
+        if (vk->has_memory_budget) 
+        {
+            VkDeviceSize heap_budgets[VK_MAX_MEMORY_HEAPS];
+            VkDeviceSize heap_usages[VK_MAX_MEMORY_HEAPS];
+            VulkanGetMemoryBudget(vk, heap_budgets, heap_usages);
+            if (heap_usages[memory_type->heapIndex] + block_size > heap_budgets[memory_type->heapIndex]) 
+            {
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "A %.2f MB block goes over the budget of heap %u: %.2f of %.2f MB used", 
+                    (double)block_size/(1024.0*1024.0), memory_type->heapIndex, 
+                    (double)heap_usages[memory_type->heapIndex]/(1024.0*1024.0), (double)heap_budgets[memory_type->heapIndex]/(1024.0*1024.0));
+            }
+        }
+
+        VkMemoryAllocateInfo info = 
+        {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = block_size,
+            .memoryTypeIndex = memory_type_idx,
+        };
+        *block = (VulkanMemoryBlock)
+        {
+            .size = block_size,
+            .memory_type_idx = memory_type_idx,
+            .strategy = strategy,
+        };
+        VK_CHECK(vkAllocateMemory(vk->device, &info, NULL, &block->memory));
+        if (memory_type->propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) 
+        {
+            VK_CHECK(vkMapMemory(vk->device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped_memory));
+        }
+        if (strategy == VulkanAllocStrategy_FreeList) 
+        {
+            block->free_ranges[0] = (VulkanFreeRange){0, block_size};
+            block->num_free_ranges = 1;
+        }
+
+        bool suballocated = VulkanSuballocate(block, res.size, alignment, &res.offset);
+        SDL_assert(suballocated);
+    }
+
+    res.block_idx = block_idx;
+    vk->memory_blocks[block_idx].allocated += res.size;
+    vk->memory_blocks[block_idx].num_allocations += 1;
+    vk->memory_category_sizes[category] += res.size;
+    vk->memory_category_counts[category] += 1;
+    return res;
+}
+
+// A block that's left empty goes straight back to the driver.
+static void VulkanFreeMemory(Vulkan* vk, VulkanAllocation* allocation) 
+{
+    SDL_assert(allocation->size > 0);
+    VulkanMemoryBlock* block = &vk->memory_blocks[allocation->block_idx];
+    SDL_assert(block->memory);
+    SDL_assert(block->allocated >= allocation->size);
+
+    block->allocated -= allocation->size;
+    block->num_allocations -= 1;
+    vk->memory_category_sizes[allocation->category] -= allocation->size;
+    vk->memory_category_counts[allocation->category] -= 1;
+
+    if (block->num_allocations == 0) 
+    {
+        if (block->mapped_memory) 
+        {
+            vkUnmapMemory(vk->device, block->memory);
+        }
+        vkFreeMemory(vk->device, block->memory, NULL);
+        *block = (VulkanMemoryBlock){0};
+    } 
+    else if (block->strategy == VulkanAllocStrategy_FreeList) 
+    {
+        VkDeviceSize offset = allocation->offset;
+        VkDeviceSize end = allocation->offset + allocation->size;
+        size_t range_idx;
+        for (range_idx = 0; range_idx < block->num_free_ranges && block->free_ranges[range_idx].offset < offset; range_idx += 1);
+
+        VulkanFreeRange* prev = (range_idx > 0) ? &block->free_ranges[range_idx - 1] : NULL;
+        VulkanFreeRange* next = (range_idx < block->num_free_ranges) ? &block->free_ranges[range_idx] : NULL;
+        bool merge_prev = prev && prev->offset + prev->size == offset;
+        bool merge_next = next && end == next->offset;
+        if (merge_prev && merge_next) 
+        {
+            prev->size = next->offset + next->size - prev->offset;
+            SDL_memmove(next, next + 1, (block->num_free_ranges - range_idx - 1)*sizeof(VulkanFreeRange));
+            block->num_free_ranges -= 1;
+        } 
+        else if (merge_prev) 
+        {
+            prev->size = end - prev->offset;
+        } 
+        else if (merge_next) 
+        {
+            *next = (VulkanFreeRange){offset, next->offset + next->size - offset};
+        } 
+        else 
+        {
+            SDL_assert(block->num_free_ranges < VULKAN_MAX_FREE_RANGES);
+            SDL_memmove(&block->free_ranges[range_idx + 1], &block->free_ranges[range_idx], (block->num_free_ranges - range_idx)*sizeof(VulkanFreeRange));
+            block->free_ranges[range_idx] = (VulkanFreeRange){offset, allocation->size};
+            block->num_free_ranges += 1;
+        }
+    }
+
+    *allocation = (VulkanAllocation){0};
 }
 
-static VkPipelineShaderStageCreateInfo VulkanCreateShaderStage(VkDevice device, const char* path, VkShaderStageFlags stage) 
+static void VulkanLogMemoryUsage(Vulkan* vk) 
+{
+    static const char* category_names[VulkanMemoryCategory_Count] = 
+    {
+        [VulkanMemoryCategory_Staging] = "Staging",
+        [VulkanMemoryCategory_Vertex] = "Vertex",
+        [VulkanMemoryCategory_Uniform] = "Uniform",
+        [VulkanMemoryCategory_Storage] = "Storage",
+        [VulkanMemoryCategory_Indirect] = "Indirect",
+        [VulkanMemoryCategory_Image] = "Image",
+    };
+    static const char* strategy_names[VulkanAllocStrategy_Count] = 
+    {
+        [VulkanAllocStrategy_Linear] = "linear",
+        [VulkanAllocStrategy_FreeList] = "free list",
+    };
+
+    for (VulkanMemoryCategory category = 0; category < VulkanMemoryCategory_Count; category += 1) 
+    {
+        SDL_Log("Vulkan memory %-8s %3llu allocations, %8.2f MB", category_names[category], 
+            vk->memory_category_counts[category], (double)vk->memory_category_sizes[category]/(1024.0*1024.0));
+    }
+
+    VkDeviceSize heap_blocks[VK_MAX_MEMORY_HEAPS] = {0};
+    for (uint32_t block_idx = 0; block_idx < VULKAN_MAX_MEMORY_BLOCKS; block_idx += 1) 
+    {
+        VulkanMemoryBlock* block = &vk->memory_blocks[block_idx];
+        if (!block->memory) 
+        {
+            continue;
+        }
+        uint32_t heap_idx = vk->physical_device_memory_properties.memoryTypes[block->memory_type_idx].heapIndex;
+        heap_blocks[heap_idx] += block->size;
+        SDL_Log("Vulkan memory block %u: type %u, heap %u, %s, %llu allocations, %.2f of %.2f MB", 
+            block_idx, block->memory_type_idx, heap_idx, strategy_names[block->strategy], block->num_allocations, 
+            (double)block->allocated/(1024.0*1024.0), (double)block->size/(1024.0*1024.0));
+    }
+
+    VkDeviceSize heap_budgets[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize heap_usages[VK_MAX_MEMORY_HEAPS];
+    if (vk->has_memory_budget) 
+    {
+        VulkanGetMemoryBudget(vk, heap_budgets, heap_usages);
+    }
+    for (uint32_t heap_idx = 0; heap_idx < vk->physical_device_memory_properties.memoryHeapCount; heap_idx += 1) 
+    {
+        double heap_size = (double)vk->physical_device_memory_properties.memoryHeaps[heap_idx].size/(1024.0*1024.0);
+        if (vk->has_memory_budget) 
+        {
+            SDL_Log("Vulkan memory heap %u: %.2f MB in blocks, %.2f MB used by every process of a %.2f MB budget, %.2f MB heap", 
+                heap_idx, (double)heap_blocks[heap_idx]/(1024.0*1024.0), (double)heap_usages[heap_idx]/(1024.0*1024.0), 
+                (double)heap_budgets[heap_idx]/(1024.0*1024.0), heap_size);
+        } 
+        else 
+        {
+            SDL_Log("Vulkan memory heap %u: %.2f MB in blocks, %.2f MB heap", heap_idx, (double)heap_blocks[heap_idx]/(1024.0*1024.0), heap_size);
+        }
+    }
+}
+
+// code is one of the SPIR-V arrays that CMake compiles into the executable, see CMakeLists.txt.
+static VkPipelineShaderStageCreateInfo VulkanCreateShaderStage(VkDevice device, const uint32_t* code, size_t code_size, VkShaderStageFlags stage) 
 {
     VkPipelineShaderStageCreateInfo res = 
     {
@@ -23,18 +343,14 @@ static VkPipelineShaderStageCreateInfo VulkanCreateShaderStage(VkDevice device,
         .pName = "main",
     };
 
-    size_t len;
-    void* data = SDL_LoadFile(path, &len); SDL_CHECK(data);
-
     VkShaderModuleCreateInfo info = 
     { 
         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .codeSize = len,
-        .pCode = (uint32_t*)data,
+        .codeSize = code_size,
+        .pCode = code,
     };
     VK_CHECK(vkCreateShaderModule(device, &info, NULL, &res.module));
 
-    SDL_free(data);
     return res;
 }
 
@@ -58,18 +374,11 @@ static VulkanBuffer VulkanCreateBuffer(Vulkan* vk, VkDeviceSize size, VkBufferUs
 	{
 		VkMemoryRequirements mem_req;
 		vkGetBufferMemoryRequirements(vk->device, res.handle, &mem_req);
-		uint32_t memory_type_idx = VulkanGetMemoryTypeIdx(vk, &mem_req, memory_properties);
-		VkMemoryAllocateInfo mem_info = 
-		{
-			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-			.allocationSize = mem_req.size,
-			.memoryTypeIndex = memory_type_idx,
-		};
-		VK_CHECK(vkAllocateMemory(vk->device, &mem_info, NULL, &res.memory));
+		res.allocation = VulkanAllocateMemory(vk, &mem_req, memory_properties, VulkanGetBufferMemoryCategory(usage));
 	}
 	{
-		VkDeviceSize memory_offset = 0;
-		VK_CHECK(vkBindBufferMemory(vk->device, res.handle, res.memory, memory_offset));
+		VkDeviceMemory memory = vk->memory_blocks[res.allocation.block_idx].memory;
+		VK_CHECK(vkBindBufferMemory(vk->device, res.handle, memory, res.allocation.offset));
 	}
 	return res;
 }
@@ -78,10 +387,10 @@ static void VulkanDestroyBuffer(Vulkan* vk, VulkanBuffer* buffer)
 {
 	SDL_assert(!buffer->mapped_memory);
 	SDL_assert(buffer->handle);
-	SDL_assert(buffer->memory);
+	SDL_assert(buffer->allocation.size);
 
 	vkDestroyBuffer(vk->device, buffer->handle, NULL);
-	vkFreeMemory(vk->device, buffer->memory, NULL);
+	VulkanFreeMemory(vk, &buffer->allocation);
 
 	*buffer = (VulkanBuffer){0};
 }
@@ -93,7 +402,10 @@ static void VulkanMapBufferMemory(Vulkan* vk, VulkanBuffer* buffer)
 	SDL_assert(buffer->mode == VulkanBufferMode_None);
 	buffer->mode = VulkanBufferMode_Write;
 #endif
-	VK_CHECK(vkMapMemory(vk->device, buffer->memory, buffer->start + buffer->offset, buffer->size - buffer->start, 0, &buffer->mapped_memory));
+	// The block is already mapped, see VulkanMemoryBlock.
+	uint8_t* mapped_memory = vk->memory_blocks[buffer->allocation.block_idx].mapped_memory;
+	SDL_assert(mapped_memory);
+	buffer->mapped_memory = mapped_memory + buffer->allocation.offset + buffer->start + buffer->offset;
 }
 
 static void VulkanUnmapBufferMemory(Vulkan* vk, VulkanBuffer* buffer) 
@@ -103,7 +415,7 @@ static void VulkanUnmapBufferMemory(Vulkan* vk, VulkanBuffer* buffer)
 	SDL_assert(buffer->mode == VulkanBufferMode_Write);
 	buffer->mode = VulkanBufferMode_None;
 #endif
-	vkUnmapMemory(vk->device, buffer->memory);
+	UNUSED(vk);
 	buffer->mapped_memory = NULL;
 	buffer->offset = 0;
 }